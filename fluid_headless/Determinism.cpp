@@ -0,0 +1,97 @@
+#include "Determinism.h"
+#include "FluidCube.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+static const int defaultSize = 32;
+static const int defaultSteps = 20;
+// 0 is the serial FluidCubeCreateBox.
+static const int threadCounts[] = { 0, 1, 4, 32 };
+static const int emitters = 4;
+
+struct DeterminismResult
+{
+	std::vector<float> fields;
+	FluidStats stats;
+	double secondsPerStep;
+};
+
+// Emitter e circles the centre and shares the centre cell with every other emitter, several times per step.
+static void emit(FluidCube* cube, int emitter, int step)
+{
+	int c = cube->sizeX / 2;
+	int offset = cube->sizeX / 6;
+	int x = c + (emitter % 2 ? offset : -offset);
+	int z = c + (emitter / 2 ? offset : -offset);
+	FluidCubeQueueDensity(cube, emitter, x, 3, z, 50.f + emitter);
+	FluidCubeQueueVelocity(cube, emitter, x, 3, z, emitter % 2 ? -.5f : .5f, 2.f, step % 2 ? .3f : -.3f);
+	for (int i = 0; i < 3; i++)
+	{
+		// Yielding lets the emitters interleave even on a single core.
+		std::this_thread::yield();
+		FluidCubeQueueDensity(cube, emitter, c, 3, c, 10.f / (i + emitter + 1));
+		FluidCubeQueueVelocity(cube, emitter, c, 3, c, .1f * (emitter - 1.5f), 1.f / (i + 1), 0.f);
+	}
+}
+
+static DeterminismResult run(int size, int steps, int threads)
+{
+	size_t cells = (size_t)size * size * size;
+	FluidCube* cube;
+	if (threads > 0)
+		cube = FluidCubeCreateThreaded(size, size, size, 1e-4f, 1e-4f, .1f, threads, FLUID_PLACEMENT_NONE);
+	else
+	{
+		cube = FluidCubeCreateBox(size, size, size, 1e-4f, 1e-4f, .1f);
+		for (float* field : { cube->s, cube->density, cube->Vx, cube->Vy, cube->Vz, cube->Vx0, cube->Vy0, cube->Vz0 })
+			std::fill(field, field + cells, 0.f);
+	}
+	FluidCubeSetCFL(cube, 1.f, 4);
+	FluidCubeConserveDye(cube, true);
+
+	DeterminismResult result = {};
+	cube->stats = &result.stats;
+	double seconds = 0.;
+	for (int step = 0; step < steps; step++)
+	{
+		std::vector<std::thread> pool;
+		for (int emitter = 0; emitter < emitters; emitter++)
+			pool.emplace_back(emit, cube, emitter, step);
+		for (std::thread& thread : pool)
+			thread.join();
+
+		auto start = std::chrono::steady_clock::now();
+		FluidCubeStep(cube);
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	result.secondsPerStep = seconds / steps;
+
+	for (float* field : { cube->s, cube->density, cube->Vx, cube->Vy, cube->Vz, cube->Vx0, cube->Vy0, cube->Vz0 })
+		result.fields.insert(result.fields.end(), field, field + cells);
+	cube->stats = nullptr;
+	FluidCubeFree(cube);
+	return result;
+}
+
+bool DeterminismRun(int size, int steps)
+{
+	size = size > 0 ? size : defaultSize;
+	steps = steps > 0 ? steps : defaultSteps;
+
+	DeterminismResult reference = run(size, steps, 1);
+	bool ok = true;
+	for (int threads : threadCounts)
+	{
+		DeterminismResult result = threads == 1 ? reference : run(size, steps, threads);
+		bool same = memcmp(result.fields.data(), reference.fields.data(), result.fields.size() * sizeof(float)) == 0
+			&& memcmp(&result.stats, &reference.stats, sizeof(FluidStats)) == 0;
+		std::cout << "DETERMINISM::threads " << threads << " size " << size << " steps " << steps << (same ? " identical" : " DIFFERS")
+			<< " mass " << result.stats.mass << " energy " << result.stats.kineticEnergy << " ms per step " << result.secondsPerStep * 1000. << std::endl;
+		ok = ok && same;
+	}
+	return ok;
+}
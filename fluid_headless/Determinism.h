@@ -0,0 +1,9 @@
+#pragma once
+
+/*
+Steps the same cube on the serial solver and with 1, 4 and 32 workers and compares every field, scratch fields
+included, and the FluidStats bit for bit with the 1-worker run. Each step four threads queue the emitters at once,
+overlapping on shared cells, so the order sources are added in is tested too. Dye conservation and CFL substeps
+are on, so the reductions feed back into the fields. Fails on any difference.
+*/
+bool DeterminismRun(int size, int steps);
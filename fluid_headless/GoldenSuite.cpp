@@ -0,0 +1,394 @@
+#include "GoldenSuite.h"
+#include "FluidBackend.h"
+#include "FluidCube.h"
+#include "FluidSquare.h"
+#include "FluidStorage.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+static const int cubeSize = 24;
+static const int squareSize = 64;
+static const int steps = 40;
+static const float dt = .1f;
+// Small but not zero, so diffuse runs its solve too.
+static const float diffusion = 1e-4f;
+static const float viscosity = 1e-4f;
+static const char* const fieldNames[] = { "density", "vx", "vy", "vz" };
+
+// Either solver, so each scene is written once; the square ignores z.
+struct GoldenGrid
+{
+	FluidCube* cube;
+	FluidSquare* square;
+	int size;
+};
+
+static void addDensity(GoldenGrid& grid, int x, int y, int z, float amount)
+{
+	if (grid.cube)
+		FluidCubeAddDensity(grid.cube, x, y, z, amount);
+	else
+		FluidSquareAddDensity(grid.square, x, y, amount);
+}
+
+static void addVelocity(GoldenGrid& grid, int x, int y, int z, float amountX, float amountY, float amountZ)
+{
+	if (grid.cube)
+		FluidCubeAddVelocity(grid.cube, x, y, z, amountX, amountY, amountZ);
+	else
+		FluidSquareAddVelocity(grid.square, x, y, amountX, amountY);
+}
+
+static void pointSource(GoldenGrid& grid, int)
+{
+	int c = grid.size / 2;
+	addDensity(grid, c, 2, c, 100.f);
+	addVelocity(grid, c, 2, c, 0.f, 1.f, 0.f);
+}
+
+static void vortex(GoldenGrid& grid, int step)
+{
+	if (step > 0)
+		return;
+	int n = grid.size;
+	float c = (n - 1) * .5f;
+	float radius = n / 3.f;
+	for (int z = 1; z < (grid.cube ? n - 1 : 2); z++)
+	{
+		// A slight axial wobble in 3D, so the z velocity is not zero throughout.
+		float wobble = grid.cube ? .1f * sinf(6.2831853f * z / (n - 1)) : 0.f;
+		for (int y = 1; y < n - 1; y++)
+		{
+			for (int x = 1; x < n - 1; x++)
+			{
+				float dx = x - c;
+				float dy = y - c;
+				float r = sqrtf(dx * dx + dy * dy);
+				if (r >= radius)
+					continue;
+				addVelocity(grid, x, y, z, -dy * .5f / radius, dx * .5f / radius, wobble);
+				if (r > radius / 3.f && r < radius * 2.f / 3.f)
+					addDensity(grid, x, y, z, 50.f);
+			}
+		}
+	}
+}
+
+static void shearLayer(GoldenGrid& grid, int step)
+{
+	if (step > 0)
+		return;
+	int n = grid.size;
+	float c = (n - 1) * .5f;
+	for (int z = 1; z < (grid.cube ? n - 1 : 2); z++)
+	{
+		for (int y = 1; y < n - 1; y++)
+		{
+			for (int x = 1; x < n - 1; x++)
+			{
+				addVelocity(grid, x, y, z, y < c ? -.5f : .5f, .05f * sinf(6.2831853f * x / (n - 2)), 0.f);
+				if (fabsf(y - c) < 1.5f)
+					addDensity(grid, x, y, z, 50.f);
+			}
+		}
+	}
+}
+
+struct GoldenScene
+{
+	const char* name;
+	void (*emit)(GoldenGrid& grid, int step);
+};
+
+static const GoldenScene scenes[] = { { "point_source", pointSource }, { "vortex", vortex }, { "shear_layer", shearLayer } };
+
+struct GoldenRun
+{
+	// Row-major, in the order of fieldNames; the square has no vz.
+	vector<vector<float>> fields;
+	double secondsPerStep;
+};
+
+static double now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static GoldenRun runCube(const GoldenScene& scene, const FluidBackend* backend)
+{
+	size_t cells = (size_t)cubeSize * cubeSize * cubeSize;
+	FluidCube* cube = FluidCubeCreateBox(cubeSize, cubeSize, cubeSize, diffusion, viscosity, dt);
+	for (float* field : { cube->s, cube->density, cube->Vx, cube->Vy, cube->Vz, cube->Vx0, cube->Vy0, cube->Vz0 })
+		std::fill(field, field + cells, 0.f);
+	FluidCubeSetBackend(cube, backend->name);
+
+	GoldenGrid grid = { cube, nullptr, cubeSize };
+	double seconds = 0.;
+	for (int step = 0; step < steps; step++)
+	{
+		scene.emit(grid, step);
+		double start = now();
+		FluidCubeStep(cube);
+		seconds += now() - start;
+	}
+
+	GoldenRun run;
+	run.secondsPerStep = seconds / steps;
+	for (float* field : { cube->density, cube->Vx, cube->Vy, cube->Vz })
+	{
+		run.fields.emplace_back(cells);
+		FluidCubeCopyField(cube, field, run.fields.back().data());
+	}
+	FluidCubeFree(cube);
+	return run;
+}
+
+static GoldenRun runSquare(const GoldenScene& scene)
+{
+	size_t cells = (size_t)squareSize * squareSize;
+	FluidSquare* square = FluidSquareCreateRect(squareSize, squareSize, diffusion, viscosity, dt);
+	for (float* field : { square->s, square->density, square->Vx, square->Vy, square->Vx0, square->Vy0 })
+		std::fill(field, field + cells, 0.f);
+
+	GoldenGrid grid = { nullptr, square, squareSize };
+	double seconds = 0.;
+	for (int step = 0; step < steps; step++)
+	{
+		scene.emit(grid, step);
+		double start = now();
+		FluidSquareStep(square);
+		seconds += now() - start;
+	}
+
+	GoldenRun run;
+	run.secondsPerStep = seconds / steps;
+	for (float* field : { square->density, square->Vx, square->Vy })
+		run.fields.emplace_back(field, field + cells);
+	FluidSquareFree(square);
+	return run;
+}
+
+static double totalDye(const GoldenRun& run)
+{
+	double total = 0.;
+	for (float value : run.fields[0])
+		total += value;
+	return total;
+}
+
+// Largest central-difference divergence over the cells inside the walls, in velocity units per cell.
+static double maxDivergence(const GoldenRun& run, int size)
+{
+	bool cube = run.fields.size() == 4;
+	size_t strideY = size;
+	size_t strideZ = (size_t)size * size;
+	double largest = 0.;
+	for (int z = cube ? 1 : 0; z < (cube ? size - 1 : 1); z++)
+	{
+		for (int y = 1; y < size - 1; y++)
+		{
+			for (int x = 1; x < size - 1; x++)
+			{
+				size_t i = x + y * strideY + z * strideZ;
+				double divergence = .5 * ((double)run.fields[1][i + 1] - run.fields[1][i - 1] + run.fields[2][i + strideY] - run.fields[2][i - strideY]);
+				if (cube)
+					divergence += .5 * ((double)run.fields[3][i + strideZ] - run.fields[3][i - strideZ]);
+				largest = std::max(largest, fabs(divergence));
+			}
+		}
+	}
+	return largest;
+}
+
+// Distance between two floats counted in representable values, so adjacent floats are 1 apart across zero too.
+static int64_t ulpDistance(float a, float b)
+{
+	uint32_t bitsA = FluidAsBits(a);
+	uint32_t bitsB = FluidAsBits(b);
+	int64_t orderedA = bitsA & 0x80000000u ? -(int64_t)(bitsA & 0x7FFFFFFFu) : (int64_t)bitsA;
+	int64_t orderedB = bitsB & 0x80000000u ? -(int64_t)(bitsB & 0x7FFFFFFFu) : (int64_t)bitsB;
+	return orderedA > orderedB ? orderedA - orderedB : orderedB - orderedA;
+}
+
+static bool within(double value, double reference, int ulps, float relative)
+{
+	return ulpDistance((float)value, (float)reference) <= ulps || fabs(value - reference) <= relative * fabs(reference);
+}
+
+static string filePath(const char* dir, const GoldenScene& scene, const char* solver, const char* field)
+{
+	return string(dir) + "/" + scene.name + "_" + solver + "_" + field + ".raw";
+}
+
+static string baselinePath(const char* dir)
+{
+	return string(dir) + "/perf_baseline.txt";
+}
+
+static bool writeRaw(const string& path, const vector<float>& field)
+{
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file)
+	{
+		std::cout << "FILE_OPEN_FAILED::" << path << std::endl;
+		return false;
+	}
+	bool ok = fwrite(field.data(), sizeof(float), field.size(), file) == field.size();
+	return fclose(file) == 0 && ok;
+}
+
+static bool readRaw(const string& path, vector<float>& field)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file)
+	{
+		std::cout << "FILE_OPEN_FAILED::" << path << std::endl;
+		return false;
+	}
+	// One extra value to notice a file longer than the field.
+	size_t cells = field.size();
+	field.resize(cells + 1);
+	bool ok = fread(field.data(), sizeof(float), cells + 1, file) == cells;
+	fclose(file);
+	field.resize(cells);
+	if (!ok)
+		std::cout << "GOLDEN_FILE_SIZE::" << path << std::endl;
+	return ok;
+}
+
+bool GoldenRecord(const char* dir)
+{
+	std::ofstream baseline(baselinePath(dir));
+	if (!baseline)
+	{
+		std::cout << "FILE_OPEN_FAILED::" << baselinePath(dir) << std::endl;
+		return false;
+	}
+	baseline << "# scene solver ms-per-step, from fluid_headless --golden record" << std::endl;
+
+	bool ok = true;
+	for (const GoldenScene& scene : scenes)
+	{
+		for (const char* solver : { "cube", "square" })
+		{
+			bool cube = solver[0] == 'c';
+			GoldenRun run = cube ? runCube(scene, &FluidBackendReference) : runSquare(scene);
+			for (size_t f = 0; f < run.fields.size(); f++)
+				ok = writeRaw(filePath(dir, scene, solver, fieldNames[f]), run.fields[f]) && ok;
+			baseline << scene.name << " " << solver << " " << run.secondsPerStep * 1000. << std::endl;
+			std::cout << "GOLDEN_RECORDED::" << scene.name << " " << solver << " dye " << totalDye(run)
+				<< " divergence " << maxDivergence(run, cube ? cubeSize : squareSize) << " ms per step " << run.secondsPerStep * 1000. << std::endl;
+		}
+	}
+	return ok && baseline.good();
+}
+
+static std::map<string, double> readBaseline(const char* dir)
+{
+	std::map<string, double> milliseconds;
+	std::ifstream file(baselinePath(dir));
+	string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+		std::istringstream words(line);
+		string scene, solver;
+		double value;
+		if (words >> scene >> solver >> value)
+			milliseconds[scene + " " + solver] = value;
+	}
+	if (milliseconds.empty())
+		std::cout << "GOLDEN_NO_BASELINE::" << baselinePath(dir) << std::endl;
+	return milliseconds;
+}
+
+static bool compare(const char* dir, const GoldenScene& scene, const char* solver, const string& label, const GoldenRun& run,
+	const std::map<string, double>& baseline, int ulps, float relative)
+{
+	GoldenRun reference;
+	for (size_t f = 0; f < run.fields.size(); f++)
+	{
+		reference.fields.emplace_back(run.fields[f].size());
+		if (!readRaw(filePath(dir, scene, solver, fieldNames[f]), reference.fields.back()))
+			return false;
+	}
+
+	bool ok = true;
+	int64_t worstUlps = 0;
+	double worstRelative = 0.;
+	for (size_t f = 0; f < run.fields.size(); f++)
+	{
+		const vector<float>& expected = reference.fields[f];
+		double largest = 0.;
+		for (float value : expected)
+			largest = std::max(largest, (double)fabsf(value));
+
+		size_t failed = 0;
+		for (size_t i = 0; i < expected.size(); i++)
+		{
+			int64_t distance = ulpDistance(run.fields[f][i], expected[i]);
+			double error = fabs((double)run.fields[f][i] - expected[i]) / (largest > 0. ? largest : 1.);
+			worstUlps = std::max(worstUlps, distance);
+			worstRelative = std::max(worstRelative, error);
+			if (distance > ulps && !(error <= relative))
+				failed++;
+		}
+		if (failed)
+		{
+			std::cout << "GOLDEN_MISMATCH::" << scene.name << " " << label << " " << fieldNames[f] << " " << failed << " cells" << std::endl;
+			ok = false;
+		}
+	}
+
+	int size = run.fields.size() == 4 ? cubeSize : squareSize;
+	double dye = totalDye(run), expectedDye = totalDye(reference);
+	double divergence = maxDivergence(run, size), expectedDivergence = maxDivergence(reference, size);
+	if (!within(dye, expectedDye, ulps, relative))
+	{
+		std::cout << "GOLDEN_DYE_DRIFT::" << scene.name << " " << label << " " << dye << " expected " << expectedDye << std::endl;
+		ok = false;
+	}
+	if (divergence > expectedDivergence && !within(divergence, expectedDivergence, ulps, relative))
+	{
+		std::cout << "GOLDEN_DIVERGENCE::" << scene.name << " " << label << " " << divergence << " expected " << expectedDivergence << std::endl;
+		ok = false;
+	}
+
+	double milliseconds = run.secondsPerStep * 1000.;
+	std::cout << "GOLDEN::" << scene.name << " " << label << (ok ? " ok" : " FAILED") << " max ulps " << worstUlps
+		<< " max relative " << worstRelative << " dye " << dye << " divergence " << divergence << " ms per step " << milliseconds;
+	auto entry = baseline.find(string(scene.name) + " " + solver);
+	if (entry != baseline.end())
+		std::cout << " baseline " << entry->second << " speedup " << entry->second / milliseconds;
+	std::cout << std::endl;
+	return ok;
+}
+
+bool GoldenCheck(const char* dir, int ulps, float relative)
+{
+	std::map<string, double> baseline = readBaseline(dir);
+	bool ok = true;
+	for (const GoldenScene& scene : scenes)
+	{
+		for (int b = 0; b < FluidBackendCount(); b++)
+		{
+			const FluidBackend* backend = FluidBackendAt(b);
+			ok = compare(dir, scene, "cube", string("cube/") + backend->name, runCube(scene, backend), baseline, ulps, relative) && ok;
+		}
+		ok = compare(dir, scene, "square", "square", runSquare(scene), baseline, ulps, relative) && ok;
+	}
+	return ok;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+/*
+Canonical scenes run for a fixed number of steps, whose final fields are kept as reference files in a directory:
+
+	point_source   dye and an upward push from one cell near the floor on every step
+	vortex         a ring of dye in a swirl about the z axis, left to decay
+	shear_layer    two layers sliding past each other with a kink at the interface and dye along it
+
+Each scene runs on a FluidCube once per registered FluidBackend and on a FluidSquare. GoldenRecord writes the
+fields of the reference backend and of the square as raw floats, <scene>_<solver>_<field>.raw, and their time per
+step to perf_baseline.txt.
+*/
+bool GoldenRecord(const char* dir);
+
+/*
+Compares every run with the files GoldenRecord wrote. A cell passes within ulps units in the last place of the
+reference, or within relative times the largest magnitude in that reference field. Total dye must match and the
+largest divergence may not exceed the reference's, both within the same tolerances. Every run prints its worst
+cell, both metrics, its time per step and its speedup over the baseline file.
+*/
+bool GoldenCheck(const char* dir, int ulps, float relative);
+
+const int GOLDEN_DEFAULT_ULPS = 16;
+const float GOLDEN_DEFAULT_RELATIVE = 1e-5f;
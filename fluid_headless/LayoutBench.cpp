@@ -0,0 +1,57 @@
+#include "LayoutBench.h"
+#include "FluidCube.h"
+#include "FluidIsa.h"
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+static const int defaultSize = 128;
+static const int defaultSteps = 10;
+static const FluidLayoutKind layouts[] = { FLUID_LAYOUT_ROW_MAJOR, FLUID_LAYOUT_TILED, FLUID_LAYOUT_MORTON };
+
+// Sources off the centre lines and a sideways push, so the backtraces in advect point in every direction.
+static void emit(FluidCube* cube, int step)
+{
+	int c = cube->sizeX / 2;
+	int offset = cube->sizeX / 8;
+	FluidCubeAddDensity(cube, c - offset, c, c, 100.f);
+	FluidCubeAddDensity(cube, c + offset, c, c, 100.f);
+	FluidCubeAddVelocity(cube, c - offset, c, c, 0.f, 2.f, step % 2 ? 1.f : -1.f);
+	FluidCubeAddVelocity(cube, c + offset, c, c, 0.f, -2.f, step % 2 ? -1.f : 1.f);
+}
+
+bool LayoutBenchRun(int size, int steps)
+{
+	size = size > 0 ? size : defaultSize;
+	steps = steps > 0 ? steps : defaultSteps;
+	size_t cells = (size_t)size * size * size;
+	std::vector<float> reference(cells), density(cells);
+
+	bool ok = true;
+	for (FluidLayoutKind layout : layouts)
+	{
+		FluidCube* cube = FluidCubeCreateLayout(size, size, size, 0.f, 0.f, .1f, layout);
+		FluidKernelTimes times = {};
+		cube->kernelTimes = &times;
+		for (int step = 0; step < steps; step++)
+		{
+			emit(cube, step);
+			FluidCubeStep(cube);
+		}
+
+		double scale = 1000. / steps;
+		std::cout << "LAYOUT::" << FluidLayoutName(layout) << " size " << size << " isa " << FluidIsaName(FluidIsaActive()) << " ms per step: diffuse " << times.diffuse * scale
+			<< " project " << times.project * scale << " advect " << times.advect * scale
+			<< " total " << (times.diffuse + times.project + times.advect) * scale << std::endl;
+
+		std::vector<float>& result = layout == FLUID_LAYOUT_ROW_MAJOR ? reference : density;
+		FluidCubeCopyField(cube, cube->density, result.data());
+		if (layout != FLUID_LAYOUT_ROW_MAJOR && memcmp(result.data(), reference.data(), cells * sizeof(float)) != 0)
+		{
+			std::cout << "LAYOUT_MISMATCH::" << FluidLayoutName(layout) << std::endl;
+			ok = false;
+		}
+		FluidCubeFree(cube);
+	}
+	return ok;
+}
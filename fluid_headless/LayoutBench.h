@@ -0,0 +1,8 @@
+#pragma once
+
+/*
+Runs the same swirling plume for steps steps in a size^3 cube stored in each FluidLayoutKind, and prints the
+average time per step of every kernel group. The final density of every layout must equal the row-major one
+bit for bit, since only the addresses differ.
+*/
+bool LayoutBenchRun(int size, int steps);
@@ -0,0 +1,117 @@
+#include "PrecisionReport.h"
+#include "FluidCube.h"
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+static const int defaultSize = 64;
+static const int defaultSteps = 50;
+// Time step at the default size; other sizes scale it so the plume moves as many cells per step. At 0.1 the plume
+// turns chaotic: nudging the FP32 inputs by 1e-4 already moves the density by its own size, which would drown out
+// anything the storage does.
+static const float defaultDt = .02f;
+static const FluidStorageKind storages[] = { FLUID_STORAGE_FP32, FLUID_STORAGE_FP16, FLUID_STORAGE_BF16, FLUID_STORAGE_INT16 };
+
+// Same plume as LayoutBench.cpp: sources off the centre lines and a sideways push.
+static void emit(FluidCube* cube, int step)
+{
+	int c = cube->sizeX / 2;
+	int offset = cube->sizeX / 8;
+	FluidCubeAddDensity(cube, c - offset, c, c, 100.f);
+	FluidCubeAddDensity(cube, c + offset, c, c, 100.f);
+	FluidCubeAddVelocity(cube, c - offset, c, c, 0.f, 2.f, step % 2 ? 1.f : -1.f);
+	FluidCubeAddVelocity(cube, c + offset, c, c, 0.f, -2.f, step % 2 ? -1.f : 1.f);
+}
+
+struct PrecisionRun
+{
+	std::vector<float> density;
+	double mass;
+	double energy;
+	double seconds;
+	int bytes;
+};
+
+static void run(int size, int steps, FluidStorageKind storage, float dyeRange, PrecisionRun& result)
+{
+	size_t cells = (size_t)size * size * size;
+	FluidCube* cube = FluidCubeCreatePacked(size, size, size, 0.f, 0.f, defaultDt * defaultSize / size, FLUID_LAYOUT_ROW_MAJOR, storage, dyeRange);
+	FluidKernelTimes times = {};
+	cube->kernelTimes = &times;
+	for (int step = 0; step < steps; step++)
+	{
+		emit(cube, step);
+		FluidCubeStep(cube);
+	}
+
+	std::vector<float> vx(cells), vy(cells), vz(cells);
+	result.density.resize(cells);
+	FluidCubeCopyField(cube, cube->density, result.density.data());
+	FluidCubeCopyField(cube, cube->Vx, vx.data());
+	FluidCubeCopyField(cube, cube->Vy, vy.data());
+	FluidCubeCopyField(cube, cube->Vz, vz.data());
+	result.mass = 0.;
+	result.energy = 0.;
+	for (size_t i = 0; i < cells; i++)
+	{
+		result.mass += result.density[i];
+		result.energy += .5 * ((double)vx[i] * vx[i] + (double)vy[i] * vy[i] + (double)vz[i] * vz[i]);
+	}
+	result.seconds = times.diffuse + times.project + times.advect;
+	result.bytes = 0;
+	for (float* field : { cube->s, cube->density, cube->Vx, cube->Vy, cube->Vz, cube->Vx0, cube->Vy0, cube->Vz0 })
+		result.bytes += FluidStorageBytes(FluidCubeFieldStorage(cube, field));
+	FluidCubeFree(cube);
+}
+
+static double relative(double value, double reference)
+{
+	return reference != 0. ? (value - reference) / fabs(reference) : value - reference;
+}
+
+bool PrecisionReportRun(int size, int steps)
+{
+	size = size > 0 ? size : defaultSize;
+	steps = steps > 0 ? steps : defaultSteps;
+
+	PrecisionRun reference;
+	float dyeRange = 1.f;
+	bool ok = true;
+	for (FluidStorageKind storage : storages)
+	{
+		PrecisionRun result;
+		run(size, steps, storage, dyeRange, result);
+
+		if (storage == FLUID_STORAGE_FP32)
+		{
+			for (float value : result.density)
+				dyeRange = fmaxf(dyeRange, 2.f * fabsf(value));
+			reference = result;
+		}
+
+		double maxError = 0., squaredError = 0., squaredReference = 0.;
+		bool finite = std::isfinite(result.mass) && std::isfinite(result.energy);
+		for (size_t i = 0; i < result.density.size(); i++)
+		{
+			double error = (double)result.density[i] - reference.density[i];
+			maxError = fmax(maxError, fabs(error));
+			squaredError += error * error;
+			squaredReference += (double)reference.density[i] * reference.density[i];
+		}
+
+		std::cout << "PRECISION::" << FluidStorageName(storage) << " size " << size << " steps " << steps
+			<< " bytes per cell " << result.bytes << " ms per step " << result.seconds * 1000. / steps
+			<< " density max error " << maxError << " relative rms " << sqrt(squaredError / (squaredReference > 0. ? squaredReference : 1.))
+			<< " mass drift " << relative(result.mass, reference.mass) << " energy drift " << relative(result.energy, reference.energy);
+		if (storage == FLUID_STORAGE_INT16)
+			std::cout << " range " << dyeRange;
+		std::cout << std::endl;
+
+		if (!finite)
+		{
+			std::cout << "PRECISION_NOT_FINITE::" << FluidStorageName(storage) << std::endl;
+			ok = false;
+		}
+	}
+	return ok;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+/*
+Runs the same swirling plume for steps steps in a size^3 cube under every FluidStorageKind and compares each with
+the FP32 run: the largest and the relative RMS error of the final density, the drift of total density and of
+kinetic energy, the bytes a cell takes and the time per step. The time step keeps the plume smooth, so the errors
+come from the storage rather than from chaos. The INT16 range is set to twice the largest FP32 density. Fails only
+if a run produces a non-finite value.
+*/
+bool PrecisionReportRun(int size, int steps);
@@ -0,0 +1,726 @@
+#include "Scene.h"
+#include "FluidCheckpoint.h"
+#include "FluidCube.h"
+#include "FluidSlab.h"
+#include "FluidSparseCube.h"
+#include "FluidSquare.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <csignal>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+/*
+Scene files hold one directive per line, '#' starts a comment:
+
+	dimensions 3                            2 drives a FluidSquare, 3 a FluidCube
+	size 64 [128 [64]]                      cells along x, y and z; missing axes repeat the last one
+	dt 0.1
+	diffusion 0
+	viscosity 0
+	cfl 1 8                                 target CFL number and maximum substeps (3D only)
+	active 0.0001                           skip cells below this density/velocity (3D only)
+	sparse 0.0001                           run on sparse bricks, retiring those below this (3D only)
+	slabs 4                                 split z over this many local processes (3D only, not on Windows)
+	threads 8 [placement]                   split the kernels over this many workers (3D only)
+	layout row-major|tiled|morton           order the cells are stored in (3D only)
+	storage fp32|fp16|bf16|int16 [range]    number format of density and velocity; range bounds int16 density (3D only)
+	backend reference|sse4.2|avx2|avx512    registered FluidBackend to step with instead of the default (3D only)
+	conserve [every]                        hold the total dye, printing its drift every 10 steps (3D only)
+	stats every                             print the mass, kinetic energy, top speed and divergence
+	steps 200
+	density x y [z] amount [start end]
+	velocity x y [z] vx vy [vz] [start end]
+	raw density|vx|vy|vz pattern every
+	checkpoint pattern every                (3D only)
+	image pattern every min max [gray|inferno] [projection|slice z]
+	record path [density|velocity|all] [0|8|16]
+
+Sparse scenes need a cubic size that is a multiple of FLUID_BRICK_SIZE and support raw and image outputs only; cfl,
+active, threads, backend, conserve and stats do not apply to them. Slab scenes support raw outputs only and need at
+least FLUID_SLAB_GHOST planes per process; active, threads, backend, conserve and stats do not apply to them. Threaded
+scenes place the fields by first-touch (default), bind or interleave, or none to leave the workers unpinned; see
+FluidPlacement. Scenes with a layout other than row-major or a storage other than fp32 support raw outputs only,
+without active or threads; their raw files are converted back to row-major floats. Emitter coordinates and amounts
+take one component per dimension. Output patterns take the step number through one %d, which may have a width such
+as %04d, and need %% for a literal percent sign. Images are written as PNG unless the pattern ends in .ppm; 3D scenes
+draw a maximum projection along z unless a slice is given.
+*/
+static bool parseEmitter(std::istringstream& line, int dimensions, bool velocity, SceneEmitter& emitter)
+{
+	emitter.velocity = velocity;
+	emitter.z = 0;
+	emitter.amount[0] = emitter.amount[1] = emitter.amount[2] = 0.f;
+	emitter.start = 0;
+	emitter.end = -1;
+
+	line >> emitter.x >> emitter.y;
+	if (dimensions == 3)
+		line >> emitter.z;
+	int components = velocity ? dimensions : 1;
+	for (int i = 0; i < components; i++)
+		line >> emitter.amount[i];
+	if (line.fail())
+		return false;
+
+	int start, end;
+	if (!(line >> start))
+		return line.eof();
+	if (!(line >> end))
+		return false;
+	emitter.start = start;
+	emitter.end = end;
+	return true;
+}
+
+// Whether pattern takes the step through exactly one %d, optionally with flags and a width, and has no other
+// conversion but %%; formatPath hands it to snprintf.
+static bool stepPattern(const string& pattern)
+{
+	int conversions = 0;
+	for (size_t i = 0; i < pattern.size(); i++)
+	{
+		if (pattern[i] != '%')
+			continue;
+		if (i + 1 < pattern.size() && pattern[i + 1] == '%')
+		{
+			i++;
+			continue;
+		}
+		i = pattern.find_first_not_of("0-+ ", i + 1);
+		if (i != string::npos)
+			i = pattern.find_first_not_of("0123456789", i);
+		if (i == string::npos || pattern[i] != 'd')
+			return false;
+		conversions++;
+	}
+	return conversions == 1;
+}
+
+bool SceneLoad(const char* filePath, Scene& scene)
+{
+	std::ifstream file(filePath);
+	if (!file)
+	{
+		std::cout << "FILE_OPEN_FAILED::" << filePath << std::endl;
+		return false;
+	}
+
+	scene.name = filePath;
+	string text;
+	for (int lineNumber = 1; std::getline(file, text); lineNumber++)
+	{
+		text = text.substr(0, text.find('#'));
+		std::istringstream line(text);
+		string directive;
+		if (!(line >> directive))
+			continue;
+
+		bool ok = true;
+		if (directive == "dimensions")
+			ok = (line >> scene.dimensions) && (scene.dimensions == 2 || scene.dimensions == 3);
+		else if (directive == "size")
+		{
+			int sizes[3];
+			int count = 0;
+			while (count < 3 && line >> sizes[count])
+				count++;
+			for (int axis = count; axis < 3 && count > 0; axis++)
+				sizes[axis] = sizes[axis - 1];
+			ok = count > 0 && line.eof() && sizes[0] > 2 && sizes[1] > 2 && sizes[2] > 2;
+			scene.sizeX = sizes[0];
+			scene.sizeY = sizes[1];
+			scene.sizeZ = sizes[2];
+		}
+		else if (directive == "dt")
+			ok = !!(line >> scene.dt);
+		else if (directive == "diffusion")
+			ok = !!(line >> scene.diffusion);
+		else if (directive == "viscosity")
+			ok = !!(line >> scene.viscosity);
+		else if (directive == "cfl")
+			ok = !!(line >> scene.cfl >> scene.maxSubsteps);
+		else if (directive == "active")
+			ok = (line >> scene.activeThreshold) && scene.activeThreshold >= 0.f && scene.dimensions == 3;
+		else if (directive == "sparse")
+			ok = (line >> scene.sparseThreshold) && scene.sparseThreshold >= 0.f && scene.dimensions == 3;
+		else if (directive == "slabs")
+			ok = (line >> scene.slabs) && scene.slabs > 0 && scene.dimensions == 3;
+		else if (directive == "threads")
+		{
+			string placement = "first-touch";
+			ok = (line >> scene.threads) && scene.threads > 0 && scene.dimensions == 3;
+			line >> placement;
+			scene.placement = placement == "bind" ? FLUID_PLACEMENT_BIND : placement == "interleave" ? FLUID_PLACEMENT_INTERLEAVE
+				: placement == "none" ? FLUID_PLACEMENT_NONE : FLUID_PLACEMENT_FIRST_TOUCH;
+			ok = ok && (placement == "first-touch" || scene.placement != FLUID_PLACEMENT_FIRST_TOUCH);
+		}
+		else if (directive == "layout")
+		{
+			string layout;
+			ok = (line >> layout) && scene.dimensions == 3 && (layout == "row-major" || layout == "tiled" || layout == "morton");
+			scene.layout = layout == "tiled" ? FLUID_LAYOUT_TILED : layout == "morton" ? FLUID_LAYOUT_MORTON : FLUID_LAYOUT_ROW_MAJOR;
+		}
+		else if (directive == "storage")
+		{
+			string storage;
+			ok = (line >> storage) && scene.dimensions == 3 && (storage == "fp32" || storage == "fp16" || storage == "bf16" || storage == "int16");
+			scene.storage = storage == "fp16" ? FLUID_STORAGE_FP16 : storage == "bf16" ? FLUID_STORAGE_BF16
+				: storage == "int16" ? FLUID_STORAGE_INT16 : FLUID_STORAGE_FP32;
+			line >> scene.dyeRange;
+			ok = ok && scene.dyeRange > 0.f;
+		}
+		else if (directive == "backend")
+			ok = (line >> scene.backend) && scene.dimensions == 3;
+		else if (directive == "conserve")
+		{
+			scene.conserveEvery = 10;
+			line >> scene.conserveEvery;
+			ok = scene.conserveEvery > 0 && scene.dimensions == 3;
+		}
+		else if (directive == "stats")
+			ok = (line >> scene.statsEvery) && scene.statsEvery > 0;
+		else if (directive == "steps")
+			ok = !!(line >> scene.steps);
+		else if (directive == "density" || directive == "velocity")
+		{
+			SceneEmitter emitter;
+			ok = parseEmitter(line, scene.dimensions, directive == "velocity", emitter);
+			if (ok)
+				scene.emitters.push_back(emitter);
+		}
+		else if (directive == "raw")
+		{
+			SceneOutput output;
+			output.kind = SCENE_OUTPUT_RAW;
+			ok = (line >> output.field >> output.pattern >> output.every) && output.every > 0 && stepPattern(output.pattern)
+				&& (output.field == "density" || output.field == "vx" || output.field == "vy" || (output.field == "vz" && scene.dimensions == 3));
+			if (ok)
+				scene.outputs.push_back(output);
+		}
+		else if (directive == "checkpoint")
+		{
+			SceneOutput output;
+			output.kind = SCENE_OUTPUT_CHECKPOINT;
+			ok = (line >> output.pattern >> output.every) && output.every > 0 && stepPattern(output.pattern) && scene.dimensions == 3;
+			if (ok)
+				scene.outputs.push_back(output);
+		}
+		else if (directive == "image")
+		{
+			SceneOutput output;
+			output.kind = SCENE_OUTPUT_IMAGE;
+			output.field = "density";
+			output.colormap = FLUID_COLORMAP_INFERNO;
+			output.slice = -1;
+			ok = (line >> output.pattern >> output.every >> output.minValue >> output.maxValue) && output.every > 0
+				&& stepPattern(output.pattern);
+
+			string option;
+			while (ok && line >> option)
+			{
+				if (option == "gray" || option == "inferno")
+					output.colormap = option == "gray" ? FLUID_COLORMAP_GRAY : FLUID_COLORMAP_INFERNO;
+				else if (option == "projection")
+					output.slice = -1;
+				else if (option == "slice")
+					ok = (line >> output.slice) && output.slice >= 0 && output.slice < scene.sizeZ && scene.dimensions == 3;
+				else
+					ok = false;
+			}
+			if (ok)
+				scene.outputs.push_back(output);
+		}
+		else if (directive == "record")
+		{
+			string fields = "density";
+			ok = !!(line >> scene.recordingPath);
+			line >> fields >> scene.recordingOptions.quantizeBits;
+			scene.recordingOptions.fields = fields == "velocity" ? FLUID_RECORD_VELOCITY
+				: fields == "all" ? FLUID_RECORD_DENSITY | FLUID_RECORD_VELOCITY
+				: FLUID_RECORD_DENSITY;
+		}
+		else
+			ok = false;
+
+		if (!ok)
+		{
+			std::cout << "SCENE_PARSE_FAILED::" << filePath << ":" << lineNumber << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+static string formatPath(const string& pattern, int step)
+{
+	char path[1024];
+	snprintf(path, sizeof(path), pattern.c_str(), step);
+	return path;
+}
+
+static bool writeRaw(const string& path, const float* field, size_t cells)
+{
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file)
+	{
+		std::cout << "FILE_OPEN_FAILED::" << path << std::endl;
+		return false;
+	}
+	bool ok = fwrite(field, sizeof(float), cells, file) == cells;
+	return fclose(file) == 0 && ok;
+}
+
+static bool writeImage(const string& path, const FluidImage& image)
+{
+	bool ppm = path.size() >= 4 && path.compare(path.size() - 4, 4, ".ppm") == 0;
+	return ppm ? FluidImageWritePPM(image, path.c_str()) : FluidImageWritePNG(image, path.c_str());
+}
+
+static void printStats(const Scene& scene, int step, const FluidStats& stats)
+{
+	std::cout << "STATS::" << scene.name << " step " << step << " mass " << stats.mass << " energy " << stats.kineticEnergy
+		<< " speed " << stats.maxSpeed << " divergence " << stats.maxDivergence << std::endl;
+}
+
+static bool emitterActive(const SceneEmitter& emitter, int step)
+{
+	return step >= emitter.start && (emitter.end < 0 || step < emitter.end);
+}
+
+static bool runCube(const Scene& scene)
+{
+	size_t cells = (size_t)scene.sizeX * scene.sizeY * scene.sizeZ;
+
+	FluidCube* cube;
+	if (scene.layout != FLUID_LAYOUT_ROW_MAJOR || scene.storage != FLUID_STORAGE_FP32)
+		cube = FluidCubeCreatePacked(scene.sizeX, scene.sizeY, scene.sizeZ, scene.diffusion, scene.viscosity, scene.dt, scene.layout, scene.storage, scene.dyeRange);
+	else if (scene.threads > 0)
+		cube = FluidCubeCreateThreaded(scene.sizeX, scene.sizeY, scene.sizeZ, scene.diffusion, scene.viscosity, scene.dt, scene.threads, scene.placement);
+	else
+	{
+		cube = FluidCubeCreateBox(scene.sizeX, scene.sizeY, scene.sizeZ, scene.diffusion, scene.viscosity, scene.dt);
+		for (float* field : { cube->s, cube->density, cube->Vx, cube->Vy, cube->Vz, cube->Vx0, cube->Vy0, cube->Vz0 })
+			std::fill(field, field + cells, 0.f);
+	}
+	FluidCubeSetCFL(cube, scene.cfl, scene.maxSubsteps);
+	if (scene.activeThreshold >= 0.f)
+		FluidCubeTrackActiveRegion(cube, scene.activeThreshold);
+	if (!FluidCubeSetBackend(cube, scene.backend.c_str()))
+	{
+		FluidCubeFree(cube);
+		return false;
+	}
+	if (scene.conserveEvery > 0)
+		FluidCubeConserveDye(cube, true);
+	FluidStats stats = {};
+	if (scene.statsEvery > 0)
+		cube->stats = &stats;
+
+	FluidRecorder* recorder = nullptr;
+	if (!scene.recordingPath.empty())
+		recorder = FluidRecorderCreate(scene.recordingPath.c_str(), scene.sizeX, scene.sizeY, scene.sizeZ, scene.recordingOptions);
+
+	FluidImage image;
+	FluidColormap colormap;
+	vector<float> rowMajor;
+
+	bool ok = scene.recordingPath.empty() || recorder;
+	for (int step = 0; ok && step < scene.steps; step++)
+	{
+		for (const SceneEmitter& emitter : scene.emitters)
+		{
+			if (!emitterActive(emitter, step))
+				continue;
+			if (emitter.velocity)
+				FluidCubeAddVelocity(cube, emitter.x, emitter.y, emitter.z, emitter.amount[0], emitter.amount[1], emitter.amount[2]);
+			else
+				FluidCubeAddDensity(cube, emitter.x, emitter.y, emitter.z, emitter.amount[0]);
+		}
+
+		FluidCubeStep(cube);
+		if (scene.conserveEvery > 0 && (step + 1) % scene.conserveEvery == 0)
+			std::cout << "DYE_DRIFT::" << scene.name << " step " << step + 1 << " drift " << cube->dyeDrift << std::endl;
+		if (scene.statsEvery > 0 && (step + 1) % scene.statsEvery == 0)
+			printStats(scene, step + 1, stats);
+
+		for (const SceneOutput& output : scene.outputs)
+		{
+			if ((step + 1) % output.every != 0)
+				continue;
+			string path = formatPath(output.pattern, step + 1);
+			if (output.kind == SCENE_OUTPUT_CHECKPOINT)
+				ok = FluidCubeSaveCheckpoint(cube, path.c_str()) && ok;
+			else if (output.kind == SCENE_OUTPUT_IMAGE)
+			{
+				FluidColormapBuild(colormap, output.colormap);
+				if (output.slice < 0)
+					FluidImageFromCubeProjection(image, cube, output.minValue, output.maxValue, colormap);
+				else
+					FluidImageFromCubeSlice(image, cube, output.slice, output.minValue, output.maxValue, colormap);
+				ok = writeImage(path, image) && ok;
+			}
+			else
+			{
+				const float* field = output.field == "vx" ? cube->Vx : output.field == "vy" ? cube->Vy : output.field == "vz" ? cube->Vz : cube->density;
+				if (cube->layout != FLUID_LAYOUT_ROW_MAJOR || cube->storage != FLUID_STORAGE_FP32)
+				{
+					rowMajor.resize(cells);
+					FluidCubeCopyField(cube, field, rowMajor.data());
+					field = rowMajor.data();
+				}
+				ok = writeRaw(path, field, cells) && ok;
+			}
+		}
+
+		if (recorder)
+			FluidRecorderCaptureCube(recorder, cube);
+	}
+
+	if (recorder)
+		ok = FluidRecorderClose(recorder) && ok;
+	FluidCubeFree(cube);
+	return ok;
+}
+
+static bool writeSparseRaw(const string& path, const FluidSparseCube* cube, FluidSparseField field)
+{
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file)
+	{
+		std::cout << "FILE_OPEN_FAILED::" << path << std::endl;
+		return false;
+	}
+
+	int N = cube->size;
+	size_t cells = (size_t)N * N;
+	vector<float> slice(cells);
+	bool ok = true;
+	for (int z = 0; ok && z < N; z++)
+	{
+		FluidSparseSlice(cube, field, z, slice.data());
+		ok = fwrite(slice.data(), sizeof(float), cells, file) == cells;
+	}
+	return fclose(file) == 0 && ok;
+}
+
+static bool runSparse(const Scene& scene)
+{
+	int N = scene.sizeX;
+	FluidSparseCube* cube = FluidSparseCreate(N, scene.diffusion, scene.viscosity, scene.dt, scene.sparseThreshold);
+	if (!cube)
+		return false;
+
+	FluidImage image;
+	FluidColormap colormap;
+	vector<float> plane((size_t)N * N);
+
+	bool ok = true;
+	for (int step = 0; ok && step < scene.steps; step++)
+	{
+		for (const SceneEmitter& emitter : scene.emitters)
+		{
+			if (!emitterActive(emitter, step))
+				continue;
+			if (emitter.velocity)
+				FluidSparseAddVelocity(cube, emitter.x, emitter.y, emitter.z, emitter.amount[0], emitter.amount[1], emitter.amount[2]);
+			else
+				FluidSparseAddDensity(cube, emitter.x, emitter.y, emitter.z, emitter.amount[0]);
+		}
+
+		FluidSparseStep(cube);
+
+		for (const SceneOutput& output : scene.outputs)
+		{
+			if ((step + 1) % output.every != 0)
+				continue;
+			string path = formatPath(output.pattern, step + 1);
+			if (output.kind == SCENE_OUTPUT_IMAGE)
+			{
+				FluidColormapBuild(colormap, output.colormap);
+				if (output.slice < 0)
+					FluidSparseProjection(cube, FLUID_SPARSE_DENSITY, plane.data());
+				else
+					FluidSparseSlice(cube, FLUID_SPARSE_DENSITY, output.slice, plane.data());
+				FluidImageFromField(image, plane.data(), N, N, output.minValue, output.maxValue, colormap);
+				ok = writeImage(path, image) && ok;
+			}
+			else
+			{
+				FluidSparseField field = output.field == "vx" ? FLUID_SPARSE_VX : output.field == "vy" ? FLUID_SPARSE_VY
+					: output.field == "vz" ? FLUID_SPARSE_VZ : FLUID_SPARSE_DENSITY;
+				ok = writeSparseRaw(path, cube, field) && ok;
+			}
+		}
+	}
+
+	FluidSparseFree(cube);
+	return ok;
+}
+
+static bool runSquare(const Scene& scene)
+{
+	size_t cells = (size_t)scene.sizeX * scene.sizeY;
+
+	FluidSquare* square = FluidSquareCreateRect(scene.sizeX, scene.sizeY, scene.diffusion, scene.viscosity, scene.dt);
+	for (float* field : { square->s, square->density, square->Vx, square->Vy, square->Vx0, square->Vy0 })
+		std::fill(field, field + cells, 0.f);
+	FluidStats stats = {};
+	if (scene.statsEvery > 0)
+		square->stats = &stats;
+
+	FluidRecorder* recorder = nullptr;
+	if (!scene.recordingPath.empty())
+		recorder = FluidRecorderCreate(scene.recordingPath.c_str(), scene.sizeX, scene.sizeY, 1, scene.recordingOptions);
+
+	FluidImage image;
+	FluidColormap colormap;
+
+	bool ok = scene.recordingPath.empty() || recorder;
+	for (int step = 0; ok && step < scene.steps; step++)
+	{
+		for (const SceneEmitter& emitter : scene.emitters)
+		{
+			if (!emitterActive(emitter, step))
+				continue;
+			if (emitter.velocity)
+				FluidSquareAddVelocity(square, emitter.x, emitter.y, emitter.amount[0], emitter.amount[1]);
+			else
+				FluidSquareAddDensity(square, emitter.x, emitter.y, emitter.amount[0]);
+		}
+
+		FluidSquareStep(square);
+		if (scene.statsEvery > 0 && (step + 1) % scene.statsEvery == 0)
+			printStats(scene, step + 1, stats);
+
+		for (const SceneOutput& output : scene.outputs)
+		{
+			if ((step + 1) % output.every != 0)
+				continue;
+			string path = formatPath(output.pattern, step + 1);
+			if (output.kind == SCENE_OUTPUT_IMAGE)
+			{
+				FluidColormapBuild(colormap, output.colormap);
+				FluidImageFromSquare(image, square, output.minValue, output.maxValue, colormap);
+				ok = writeImage(path, image) && ok;
+			}
+			else
+			{
+				const float* field = output.field == "vx" ? square->Vx : output.field == "vy" ? square->Vy : square->density;
+				ok = writeRaw(path, field, cells) && ok;
+			}
+		}
+
+		if (recorder)
+			FluidRecorderCaptureSquare(recorder, square);
+	}
+
+	if (recorder)
+		ok = FluidRecorderClose(recorder) && ok;
+	FluidSquareFree(square);
+	return ok;
+}
+
+#ifndef _WIN32
+// Each rank writes its own planes into a file rank 0 has sized, so the result matches a FluidCube raw output.
+static bool writeSlabRaw(const string& path, FluidSlab* slab, float* field)
+{
+	if (slab->rank == 0)
+	{
+		int file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (file < 0 || ftruncate(file, (off_t)slab->sizeX * slab->sizeY * slab->sizeZ * sizeof(float)) != 0)
+			std::cout << "FILE_OPEN_FAILED::" << path << std::endl;
+		if (file >= 0)
+			close(file);
+	}
+	FluidSlabBarrier(slab);
+
+	int file = open(path.c_str(), O_WRONLY);
+	if (file < 0)
+		return false;
+	size_t planeBytes = (size_t)slab->sizeX * slab->sizeY * sizeof(float);
+	size_t bytes = planeBytes * (slab->zEnd - slab->zBegin);
+	bool ok = pwrite(file, FluidSlabPlane(slab, field, slab->zBegin), bytes, (off_t)(planeBytes * slab->zBegin)) == (ssize_t)bytes;
+	return close(file) == 0 && ok;
+}
+#endif
+
+// Every rank goes through every step even after a failed write so none is left waiting.
+bool SceneRunSlabRank(const Scene& scene, const char* name, int rank)
+{
+#ifdef _WIN32
+	std::cout << "SLAB_UNSUPPORTED_PLATFORM::" << scene.name << std::endl;
+	return false;
+#else
+	FluidSlab* slab = FluidSlabAttach(name, rank, scene.diffusion, scene.viscosity, scene.dt);
+	if (!slab)
+		return false;
+	FluidSlabSetCFL(slab, scene.cfl, scene.maxSubsteps);
+
+	bool ok = true;
+	for (int step = 0; step < scene.steps; step++)
+	{
+		for (const SceneEmitter& emitter : scene.emitters)
+		{
+			if (!emitterActive(emitter, step))
+				continue;
+			if (emitter.velocity)
+				FluidSlabAddVelocity(slab, emitter.x, emitter.y, emitter.z, emitter.amount[0], emitter.amount[1], emitter.amount[2]);
+			else
+				FluidSlabAddDensity(slab, emitter.x, emitter.y, emitter.z, emitter.amount[0]);
+		}
+
+		FluidSlabStep(slab);
+
+		for (const SceneOutput& output : scene.outputs)
+		{
+			if ((step + 1) % output.every != 0)
+				continue;
+			float* field = output.field == "vx" ? slab->Vx : output.field == "vy" ? slab->Vy : output.field == "vz" ? slab->Vz : slab->density;
+			ok = writeSlabRaw(formatPath(output.pattern, step + 1), slab, field) && ok;
+		}
+	}
+
+	FluidSlabFree(slab);
+	return ok;
+#endif
+}
+
+static string executable;
+
+void SceneSetExecutable(const char* path)
+{
+	executable = path;
+}
+
+static bool runSlabs(const Scene& scene)
+{
+#ifdef _WIN32
+	std::cout << "SLAB_UNSUPPORTED_PLATFORM::" << scene.name << std::endl;
+	return false;
+#else
+	// The runner may have several slab scenes going at once, each with a segment of its own.
+	static std::atomic<int> runs(0);
+	string name = "/fluid_slab_" + std::to_string(getpid()) + "_" + std::to_string(runs++);
+	if (!FluidSlabCreateShared(name.c_str(), scene.slabs, scene.sizeX, scene.sizeY, scene.sizeZ))
+		return false;
+
+	/*
+	Other runner threads may hold locks inside the allocator or iostreams, so the forked child only execs the runner
+	again, which loads the scene from its file and steps one rank. The arguments are built before the fork.
+	*/
+	vector<string> ranks;
+	for (int rank = 0; rank < scene.slabs; rank++)
+		ranks.push_back(std::to_string(rank));
+	vector<pid_t> children;
+	for (int rank = 0; rank < scene.slabs; rank++)
+	{
+		char* arguments[] = { (char*)executable.c_str(), (char*)"--slab-rank", (char*)scene.name.c_str(),
+			(char*)name.c_str(), (char*)ranks[rank].c_str(), nullptr };
+		pid_t child = fork();
+		if (child == 0)
+		{
+			execvp(arguments[0], arguments);
+			_exit(127);
+		}
+		if (child < 0)
+		{
+			// The ranks already started would wait forever for the missing one.
+			std::cout << "SLAB_FORK_FAILED::" << rank << std::endl;
+			for (pid_t started : children)
+				kill(started, SIGKILL);
+			break;
+		}
+		children.push_back(child);
+	}
+
+	/*
+	A rank that dies leaves its neighbours waiting, so the first failure takes the others down with it. Other runner
+	threads may have ranks of their own, so only this scene's are reaped, polling since any of them may end first.
+	*/
+	bool ok = (int)children.size() == scene.slabs;
+	while (!children.empty())
+	{
+		bool reaped = false;
+		for (size_t i = 0; i < children.size(); i++)
+		{
+			int status = 0;
+			pid_t child = waitpid(children[i], &status, WNOHANG);
+			if (child == 0)
+				continue;
+			children.erase(children.begin() + i--);
+			reaped = true;
+			if (child < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			{
+				if (ok)
+					std::cout << "SLAB_RANK_FAILED::" << scene.name << std::endl;
+				ok = false;
+				for (pid_t other : children)
+					kill(other, SIGKILL);
+			}
+		}
+		if (!reaped)
+			usleep(10000);
+	}
+	FluidSlabUnlinkShared(name.c_str());
+	return ok;
+#endif
+}
+
+bool SceneRun(const Scene& scene)
+{
+	for (const SceneEmitter& emitter : scene.emitters)
+	{
+		int z = scene.dimensions == 3 ? emitter.z : 1;
+		int sizeZ = scene.dimensions == 3 ? scene.sizeZ : 3;
+		if (emitter.x < 1 || emitter.y < 1 || z < 1 || emitter.x > scene.sizeX - 2 || emitter.y > scene.sizeY - 2 || z > sizeZ - 2)
+		{
+			std::cout << "SCENE_EMITTER_OUT_OF_RANGE::" << scene.name << std::endl;
+			return false;
+		}
+	}
+	if (scene.sparseThreshold >= 0.f)
+	{
+		bool supported = scene.recordingPath.empty() && scene.sizeY == scene.sizeX && scene.sizeZ == scene.sizeX;
+		for (const SceneOutput& output : scene.outputs)
+			supported = supported && output.kind != SCENE_OUTPUT_CHECKPOINT;
+		if (!supported)
+		{
+			std::cout << "SCENE_SPARSE_UNSUPPORTED_OUTPUT::" << scene.name << std::endl;
+			return false;
+		}
+		return runSparse(scene);
+	}
+	if ((scene.layout != FLUID_LAYOUT_ROW_MAJOR || scene.storage != FLUID_STORAGE_FP32) && scene.sparseThreshold < 0.f && scene.slabs == 0)
+	{
+		bool supported = scene.recordingPath.empty() && scene.activeThreshold < 0.f && scene.threads == 0;
+		for (const SceneOutput& output : scene.outputs)
+			supported = supported && output.kind == SCENE_OUTPUT_RAW;
+		if (!supported)
+		{
+			std::cout << "SCENE_LAYOUT_UNSUPPORTED_OUTPUT::" << scene.name << std::endl;
+			return false;
+		}
+	}
+	if (scene.slabs > 0)
+	{
+		bool supported = scene.recordingPath.empty();
+		for (const SceneOutput& output : scene.outputs)
+			supported = supported && output.kind == SCENE_OUTPUT_RAW;
+		if (!supported)
+		{
+			std::cout << "SCENE_SLABS_UNSUPPORTED_OUTPUT::" << scene.name << std::endl;
+			return false;
+		}
+		return runSlabs(scene);
+	}
+	return scene.dimensions == 3 ? runCube(scene) : runSquare(scene);
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include "FluidImage.h"
+#include "FluidLayout.h"
+#include "FluidRecorder.h"
+#include "FluidStorage.h"
+#include "FluidWorkers.h"
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+struct SceneEmitter
+{
+	bool velocity;
+	int x;
+	int y;
+	int z;
+	float amount[3];
+	// Active for steps in [start, end); end < 0 keeps it running until the last step.
+	int start;
+	int end;
+};
+
+enum SceneOutputKind
+{
+	SCENE_OUTPUT_RAW,
+	SCENE_OUTPUT_CHECKPOINT,
+	SCENE_OUTPUT_IMAGE
+};
+
+struct SceneOutput
+{
+	SceneOutputKind kind;
+	string field;
+	// printf-style pattern that receives the step number through its one %d, e.g. out/density_%04d.raw
+	string pattern;
+	int every;
+
+	// Images only: density range mapped onto the colormap, and the z slice to draw (-1 projects the maximum).
+	float minValue;
+	float maxValue;
+	FluidColormapKind colormap;
+	int slice;
+};
+
+struct Scene
+{
+	string name;
+	int dimensions = 3;
+	// Cells per axis, walls included; sizeZ is ignored in 2D.
+	int sizeX = 64;
+	int sizeY = 64;
+	int sizeZ = 64;
+	float dt = .1f;
+	float diffusion = 0.f;
+	float viscosity = 0.f;
+	float cfl = 0.f;
+	int maxSubsteps = 1;
+	// Negative keeps every kernel on the whole grid; see FluidCubeTrackActiveRegion.
+	float activeThreshold = -1.f;
+	// Non-negative runs a 3D scene on FluidSparseCube with this brick retirement threshold.
+	float sparseThreshold = -1.f;
+	// Above zero splits a 3D scene along z over this many processes; see FluidSlab.
+	int slabs = 0;
+	// Above zero runs a 3D scene on FluidCubeCreateThreaded with this many workers.
+	int threads = 0;
+	FluidPlacement placement = FLUID_PLACEMENT_FIRST_TOUCH;
+	FluidLayoutKind layout = FLUID_LAYOUT_ROW_MAJOR;
+	FluidStorageKind storage = FLUID_STORAGE_FP32;
+	// Density that int16 storage maps onto its largest step; denser cells saturate.
+	float dyeRange = 1024.f;
+	// Empty steps with the default FluidBackend.
+	string backend;
+	// Above zero turns on FluidCubeConserveDye and prints the dye drift every this many steps.
+	int conserveEvery = 0;
+	// Above zero prints the FluidStats every this many steps.
+	int statsEvery = 0;
+	int steps = 100;
+
+	vector<SceneEmitter> emitters;
+	vector<SceneOutput> outputs;
+
+	string recordingPath;
+	FluidRecorderOptions recordingOptions;
+};
+
+bool SceneLoad(const char* filePath, Scene& scene);
+
+bool SceneRun(const Scene& scene);
+
+// The runner, as started; slab scenes start it again with --slab-rank for each of their processes.
+void SceneSetExecutable(const char* path);
+
+// Steps rank of a slab scene whose shared segment name was created by SceneRun.
+bool SceneRunSlabRank(const Scene& scene, const char* name, int rank);
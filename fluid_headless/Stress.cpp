@@ -0,0 +1,126 @@
+#include "Stress.h"
+#include "FluidCube.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+static const int referenceSize = 96;
+// The plume starts this far from the far walls and is compared within window cells of them.
+static const int sourceOffset = 12;
+static const int window = 32;
+static const int activeSteps = 20;
+static const int fieldCount = 8;
+
+static uint64_t physicalMemory()
+{
+#ifdef _WIN32
+	MEMORYSTATUSEX status;
+	status.dwLength = sizeof(status);
+	return GlobalMemoryStatusEx(&status) ? status.ullTotalPhys : 0;
+#else
+	return (uint64_t)sysconf(_SC_PHYS_PAGES) * (uint64_t)sysconf(_SC_PAGE_SIZE);
+#endif
+}
+
+static int largestSize(uint64_t bytes)
+{
+	uint64_t cells = bytes / (fieldCount * sizeof(float));
+	int size = (int)cbrt((double)cells);
+	while ((uint64_t)(size + 1) * (size + 1) * (size + 1) <= cells)
+		size++;
+	while ((uint64_t)size * size * size > cells)
+		size--;
+	return size;
+}
+
+/*
+With no diffusion or viscosity the solver only depends on the grid through dt * (size - 2), so scaling dt keeps
+the plume the same, up to rounding, in any cube large enough to hold it.
+*/
+static FluidCube* createCube(int size, float dt)
+{
+	FluidCube* cube = FluidCubeCreateBox(size, size, size, 0.f, 0.f, dt * (referenceSize - 2) / (size - 2));
+	size_t cells = (size_t)size * size * size;
+	for (float* field : { cube->s, cube->density, cube->Vx, cube->Vy, cube->Vz, cube->Vx0, cube->Vy0, cube->Vz0 })
+		std::fill(field, field + cells, 0.f);
+	FluidCubeSetCFL(cube, 1.f, 8);
+	FluidCubeTrackActiveRegion(cube, 1e-6f);
+	return cube;
+}
+
+static void emit(FluidCube* cube)
+{
+	int c = cube->sizeX - 1 - sourceOffset;
+	FluidCubeAddDensity(cube, c, c, c, 100.f);
+	FluidCubeAddVelocity(cube, c, c, c, -1.f, -2.f, -1.f);
+}
+
+// Largest difference between the far corners of both cubes, relative to the largest reference value.
+static float compareCorners(const FluidCube* cube, const FluidCube* reference)
+{
+	float maxDifference = 0.f, maxValue = 0.f;
+	for (int k = 1; k <= window; k++)
+	{
+		for (int j = 1; j <= window; j++)
+		{
+			for (int i = 1; i <= window; i++)
+			{
+				size_t N = cube->sizeX, M = reference->sizeX;
+				float value = cube->density[(N - i) + ((N - j) + (N - k) * N) * N];
+				float expected = reference->density[(M - i) + ((M - j) + (M - k) * M) * M];
+				if (!std::isfinite(value))
+					return INFINITY;
+				maxDifference = fmaxf(maxDifference, fabsf(value - expected));
+				maxValue = fmaxf(maxValue, fabsf(expected));
+			}
+		}
+	}
+	return maxValue > 0.f ? maxDifference / maxValue : INFINITY;
+}
+
+bool StressRun(int size)
+{
+	if (size <= 0)
+		size = largestSize(physicalMemory() / 10 * 8);
+	uint64_t cells = (uint64_t)size * size * size;
+	std::cout << "STRESS_SIZE::" << size << " cells " << cells << (cells > INT32_MAX ? " (past 2^31)" : " (below 2^31)") << std::endl;
+	if (size < referenceSize)
+	{
+		std::cout << "STRESS_SIZE_TOO_SMALL::" << size << std::endl;
+		return false;
+	}
+
+	float dt = .1f;
+	FluidCube* cube = createCube(size, dt);
+	FluidCube* reference = createCube(referenceSize, dt);
+
+	for (int step = 0; step < activeSteps; step++)
+	{
+		emit(cube);
+		emit(reference);
+		FluidCubeStep(cube);
+		FluidCubeStep(reference);
+	}
+	float activeError = compareCorners(cube, reference);
+
+	// One step over every cell of both cubes.
+	FluidCubeTrackActiveRegion(cube, -1.f);
+	FluidCubeTrackActiveRegion(reference, -1.f);
+	FluidCubeStep(cube);
+	FluidCubeStep(reference);
+	float fullError = compareCorners(cube, reference);
+
+	bool ok = activeError < 1e-3f && fullError < 1e-3f;
+	std::cout << (ok ? "STRESS_PASSED::" : "STRESS_FAILED::") << "active error " << activeError << " full error " << fullError << std::endl;
+
+	FluidCubeFree(cube);
+	FluidCubeFree(reference);
+	return ok;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+/*
+Runs a plume in the far corner of a size^3 cube, first with active region tracking and then with a full-domain
+step, and compares the corner cell by cell with the same plume in a small reference cube. The corner's indices
+are the largest in the cube, so a size past 1290 checks that indexing does not wrap at 2^31 cells. size 0 picks
+the largest cube whose fields fit in 80% of physical memory.
+*/
+bool StressRun(int size);
@@ -0,0 +1,112 @@
+#include "Determinism.h"
+#include "FluidIsa.h"
+#include "GoldenSuite.h"
+#include "LayoutBench.h"
+#include "PrecisionReport.h"
+#include "Scene.h"
+#include "Stress.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+/*
+Runs scene files without a window or GL context:
+
+	fluid_headless [--isa name] [-j threads] scene...
+	fluid_headless [--isa name] --stress [size]
+	fluid_headless [--isa name] --layouts [size [steps]]
+	fluid_headless [--isa name] --precision [size [steps]]
+	fluid_headless [--isa name] --golden record dir
+	fluid_headless [--isa name] --golden check dir [ulps [relative]]
+	fluid_headless [--isa name] --determinism [size [steps]]
+
+Scenes are independent, so each worker thread picks the next unclaimed scene until all have run. --stress runs
+the large-grid check in Stress.h instead, --layouts the layout benchmark in LayoutBench.h and --precision the
+storage accuracy report in PrecisionReport.h. --golden writes or checks the reference fields of GoldenSuite.h, and
+--determinism compares runs on different numbers of threads as described in Determinism.h.
+Slab scenes start the runner again with --slab-rank scene segment rank for each of their processes.
+--isa runs the FluidCube kernels compiled for baseline, sse4.2, avx2 or avx512 instead of the widest this machine
+supports, like the FLUID_ISA environment variable.
+*/
+int main(int argc, char** argv)
+{
+	SceneSetExecutable(argv[0]);
+	unsigned int threads = std::thread::hardware_concurrency();
+	vector<const char*> scenePaths;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--isa") == 0 && i + 1 < argc)
+		{
+			FluidIsa isa;
+			if (!FluidIsaParse(argv[++i], isa))
+			{
+				std::cout << "ISA_UNKNOWN::" << argv[i] << std::endl;
+				return 2;
+			}
+			if (!FluidIsaSelect(isa))
+				return 1;
+		}
+		else if (strcmp(argv[i], "--slab-rank") == 0 && i + 3 < argc)
+		{
+			Scene scene;
+			return SceneLoad(argv[i + 1], scene) && SceneRunSlabRank(scene, argv[i + 2], atoi(argv[i + 3])) ? 0 : 1;
+		}
+		else if (strcmp(argv[i], "--stress") == 0)
+			return StressRun(i + 1 < argc ? atoi(argv[i + 1]) : 0) ? 0 : 1;
+		else if (strcmp(argv[i], "--layouts") == 0)
+			return LayoutBenchRun(i + 1 < argc ? atoi(argv[i + 1]) : 0, i + 2 < argc ? atoi(argv[i + 2]) : 0) ? 0 : 1;
+		else if (strcmp(argv[i], "--precision") == 0)
+			return PrecisionReportRun(i + 1 < argc ? atoi(argv[i + 1]) : 0, i + 2 < argc ? atoi(argv[i + 2]) : 0) ? 0 : 1;
+		else if (strcmp(argv[i], "--determinism") == 0)
+			return DeterminismRun(i + 1 < argc ? atoi(argv[i + 1]) : 0, i + 2 < argc ? atoi(argv[i + 2]) : 0) ? 0 : 1;
+		else if (strcmp(argv[i], "--golden") == 0 && i + 2 < argc && strcmp(argv[i + 1], "record") == 0)
+			return GoldenRecord(argv[i + 2]) ? 0 : 1;
+		else if (strcmp(argv[i], "--golden") == 0 && i + 2 < argc && strcmp(argv[i + 1], "check") == 0)
+			return GoldenCheck(argv[i + 2], i + 3 < argc ? atoi(argv[i + 3]) : GOLDEN_DEFAULT_ULPS,
+				i + 4 < argc ? (float)atof(argv[i + 4]) : GOLDEN_DEFAULT_RELATIVE) ? 0 : 1;
+		else
+			scenePaths.push_back(argv[i]);
+	}
+
+	if (scenePaths.empty())
+	{
+		std::cout << "usage: fluid_headless [--isa name] [-j threads] scene... | --stress [size] | --layouts [size [steps]] | --precision [size [steps]] | --golden record|check dir | --determinism [size [steps]]" << std::endl;
+		return 2;
+	}
+	if (threads < 1)
+		threads = 1;
+	if (threads > scenePaths.size())
+		threads = (unsigned int)scenePaths.size();
+
+	std::atomic<size_t> next(0);
+	std::atomic<int> failures(0);
+	std::mutex logMutex;
+
+	auto worker = [&]()
+	{
+		for (size_t i = next++; i < scenePaths.size(); i = next++)
+		{
+			Scene scene;
+			bool ok = SceneLoad(scenePaths[i], scene) && SceneRun(scene);
+			if (!ok)
+				failures++;
+
+			std::lock_guard<std::mutex> lock(logMutex);
+			std::cout << (ok ? "DONE::" : "FAILED::") << scenePaths[i] << std::endl;
+		}
+	};
+
+	vector<std::thread> pool;
+	for (unsigned int i = 1; i < threads; i++)
+		pool.emplace_back(worker);
+	worker();
+	for (std::thread& thread : pool)
+		thread.join();
+
+	return failures == 0 ? 0 : 1;
+}
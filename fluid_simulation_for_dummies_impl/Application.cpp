@@ -1,11 +1,18 @@
 #include "Application.h"
+#include "DensityRenderer.h"
+#include "FluidSquare.h"
+#include "ShaderVariants.h"
 #include <glew.h>
 #include <GLFW/glfw3.h>
+#include <algorithm>
 
 
 void Application::run()
 {
     initSystem();
+    if (!window)
+        return;
+    initSquare();
     mainLoop();
     terminateSystem();
 }
@@ -14,6 +21,8 @@ void Application::initSystem()
 {
     if (!glfwInit())
         return;
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
     window = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Fluid Simulation", NULL, NULL);
@@ -25,8 +34,14 @@ void Application::initSystem()
 
     glfwMakeContextCurrent(window);
 
-    if (!glewInit())
+    glewExperimental = GL_TRUE;
+    if (glewInit() != GLEW_OK)
+    {
+        glfwDestroyWindow(window);
+        window = nullptr;
+        glfwTerminate();
         return;
+    }
 
     glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
 
@@ -35,15 +50,31 @@ void Application::initSystem()
 
 void Application::initSquare()
 {
+    square = FluidSquareCreateRect(SCREEN_WIDTH, SCREEN_HEIGHT, 0.f, .0000001f, .1f);
+    for (float* field : { square->s, square->density, square->Vx, square->Vy, square->Vx0, square->Vy0 })
+        std::fill(field, field + SCREEN_WIDTH * SCREEN_HEIGHT, 0.f);
+    squareDensity = square->density;
+
+    densityRenderer = new DensityRenderer();
+    densityRenderer->create(SCREEN_WIDTH, SCREEN_HEIGHT);
+    fieldShaders = new ShaderVariants("shaders/fullscreen.vert", "shaders/field.frag");
 }
 
 void Application::mainLoop()
 {
     while (!glfwWindowShouldClose(window))
     {
-        glClear(GL_COLOR_BUFFER_BIT);
+        int centerX = square->sizeX / 2;
+        int centerY = square->sizeY / 2;
 
+        FluidSquareStepInto(square, densityRenderer->map());
+        FluidSquareAddDensity(square, centerX, centerY, 100.f);
+        FluidSquareAddVelocity(square, centerX, centerY, 0.f, 2.f);
+        densityRenderer->commit(square->dirtyTiles, square->tilesX, square->tilesY, FLUID_SQUARE_TILE_SIZE);
+        FluidSquareClearDirtyTiles(square);
 
+        glClear(GL_COLOR_BUFFER_BIT);
+        densityRenderer->draw(fieldShaders->get({ "COLORMAP_INFERNO" }), 0.f, 5.f);
 
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -52,6 +83,13 @@ void Application::mainLoop()
 
 void Application::terminateSystem()
 {
+    if (square)
+    {
+        square->density = squareDensity;
+        FluidSquareFree(square);
+    }
+    delete fieldShaders;
+    delete densityRenderer;
     glfwTerminate();
 }
 
@@ -1,6 +1,8 @@
 #pragma once
 class GLFWwindow;
 class FluidSquare;
+class DensityRenderer;
+class ShaderVariants;
 
 class Application
 {
@@ -17,5 +19,9 @@ private:
 	GLFWwindow* window = nullptr;
 private:
 	FluidSquare* square = nullptr;
+	// The square steps its density into the renderer's mapped slots; its own array is kept here for FluidSquareFree.
+	float* squareDensity = nullptr;
+	DensityRenderer* densityRenderer = nullptr;
+	ShaderVariants* fieldShaders = nullptr;
 };
 
@@ -0,0 +1,160 @@
+#include "DensityRenderer.h"
+#include "Shader.h"
+#include <cstring>
+#include <iostream>
+
+static const GLuint64 fenceTimeout = 1000000000ull;
+
+DensityRenderer::DensityRenderer()
+	:buffer(0), texture(0), vertexArray(0), fences(), mapped(nullptr), persistent(false), slot(0), width(0), height(0), slotBytes(0)
+{
+}
+
+DensityRenderer::~DensityRenderer()
+{
+	for (GLsync& fence : fences)
+		if (fence)
+			glDeleteSync(fence);
+	if (buffer && mapped)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	glDeleteBuffers(1, &buffer);
+	glDeleteTextures(1, &texture);
+	glDeleteVertexArrays(1, &vertexArray);
+}
+
+bool DensityRenderer::create(int width, int height, GLenum internalFormat)
+{
+	this->width = width;
+	this->height = height;
+	// Keep slots 256-byte aligned; glTexSubImage2D offsets into the buffer must be a multiple of the texel size anyway.
+	slotBytes = ((GLsizeiptr)width * height * sizeof(float) + 255) / 256 * 256;
+
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	// Immutable storage is core only from GL 4.2; on the 3.3 context GLEW leaves glTexStorage2D null without the extension.
+	if (GLEW_ARB_texture_storage)
+		glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, width, height);
+	else
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, GL_RED, GL_FLOAT, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// The core profile draws nothing without a vertex array, even though the triangle comes from gl_VertexID.
+	glGenVertexArrays(1, &vertexArray);
+
+	persistent = GLEW_ARB_buffer_storage;
+	if (!persistent)
+	{
+		staging.assign(slotBytes * ringSize, 0);
+		mapped = staging.data();
+		return texture != 0;
+	}
+
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+	// Client storage asks for cached system memory: the solver reads the previous frame's slot back.
+	glBufferStorage(GL_PIXEL_UNPACK_BUFFER, slotBytes * ringSize, nullptr, flags | GL_CLIENT_STORAGE_BIT);
+	mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slotBytes * ringSize, flags);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	if (!mapped)
+	{
+		std::cout << "PIXEL_BUFFER_MAP_FAILED" << std::endl;
+		return false;
+	}
+	memset(mapped, 0, slotBytes * ringSize);
+	return texture != 0;
+}
+
+float* DensityRenderer::map()
+{
+	GLsync& fence = fences[slot];
+	if (fence)
+	{
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, fenceTimeout) == GL_TIMEOUT_EXPIRED)
+			;
+		glDeleteSync(fence);
+		fence = 0;
+	}
+
+	return (float*)(mapped + slot * slotBytes);
+}
+
+void DensityRenderer::commit()
+{
+	// With a pixel buffer bound the last argument is an offset into it, otherwise a client pointer.
+	const unsigned char* source = persistent ? nullptr : mapped;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RED, GL_FLOAT, source + slot * slotBytes);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot = (slot + 1) % ringSize;
+}
+
+void DensityRenderer::commit(const unsigned char* dirtyTiles, int tilesX, int tilesY, int tileSize)
+{
+	const unsigned char* source = (persistent ? nullptr : mapped) + slot * slotBytes;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+
+	for (int ty = 0; ty < tilesY; ty++)
+	{
+		for (int tx = 0; tx < tilesX; tx++)
+		{
+			if (!dirtyTiles[ty * tilesX + tx])
+				continue;
+			int runEnd = tx + 1;
+			while (runEnd < tilesX && dirtyTiles[ty * tilesX + runEnd])
+				runEnd++;
+
+			int x = tx * tileSize;
+			int y = ty * tileSize;
+			int w = (runEnd * tileSize < width ? runEnd * tileSize : width) - x;
+			int h = (y + tileSize < height ? y + tileSize : height) - y;
+			glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RED, GL_FLOAT, source + ((size_t)y * width + x) * sizeof(float));
+			tx = runEnd;
+		}
+	}
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot = (slot + 1) % ringSize;
+}
+
+void DensityRenderer::upload(const float* field)
+{
+	memcpy(map(), field, (size_t)width * height * sizeof(float));
+	commit();
+}
+
+void DensityRenderer::draw(Shader& shader, float minValue, float maxValue) const
+{
+	shader.use();
+	shader.setInt("field", 0);
+	shader.setFloat("minValue", minValue);
+	shader.setFloat("maxValue", maxValue);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glBindVertexArray(vertexArray);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
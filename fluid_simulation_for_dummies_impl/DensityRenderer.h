@@ -0,0 +1,51 @@
+#pragma once
+#include <glew.h>
+#include <vector>
+
+class Shader;
+
+/*
+Streams a single-channel field into a texture and draws it with a fullscreen triangle. Uploads go through a
+ring of pixel buffer slots that stay mapped for the renderer's lifetime, each guarded by a fence, so writing a
+frame never waits on the GPU reading the one before it:
+
+	float* field = renderer.map();		// write width * height floats here, e.g. with FluidSquareStepInto
+	renderer.commit();					// texture update from the slot, then the slot is fenced
+	renderer.draw(shader, 0.f, 5.f);
+
+Without ARB_buffer_storage (persistent mapping) the slots are ordinary memory and commit() uploads from there.
+*/
+class DensityRenderer
+{
+private:
+	static const int ringSize = 3;
+
+	GLuint buffer;
+	GLuint texture;
+	GLuint vertexArray;
+	GLsync fences[ringSize];
+	unsigned char* mapped;
+	std::vector<unsigned char> staging;
+	bool persistent;
+	int slot;
+	int width;
+	int height;
+	GLsizeiptr slotBytes;
+public:
+	DensityRenderer();
+	~DensityRenderer();
+
+	// internalFormat is GL_R32F or GL_R16F; the slots always hold 32-bit floats.
+	bool create(int width, int height, GLenum internalFormat = GL_R32F);
+
+	float* map();
+	void commit();
+	// Updates only the texture tiles flagged in dirtyTiles (row-major, tilesX * tilesY bytes, tileSize cells wide),
+	// e.g. FluidSquare::dirtyTiles. Runs of neighbouring dirty tiles in a row go up as one rectangle.
+	void commit(const unsigned char* dirtyTiles, int tilesX, int tilesY, int tileSize);
+	// Convenience for fields that live elsewhere: one copy into the mapped slot.
+	void upload(const float* field);
+
+	// Binds the texture to unit 0 as "field" and sets "minValue"/"maxValue"; see shaders/field.frag.
+	void draw(Shader& shader, float minValue, float maxValue) const;
+};
@@ -0,0 +1,61 @@
+#include "FluidBackend.h"
+#include "FluidIsa.h"
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+static std::mutex registryLock;
+
+// Built lazily, so backends registered by static initializers elsewhere find the built-ins in place.
+static std::vector<const FluidBackend*>& registry()
+{
+	static std::vector<const FluidBackend*> backends = []
+	{
+		std::vector<const FluidBackend*> builtIn;
+		FluidIsa best = FluidIsaDetect();
+		for (FluidIsa isa : { FLUID_ISA_BASELINE, FLUID_ISA_SSE42, FLUID_ISA_AVX2, FLUID_ISA_AVX512 })
+			if (isa <= best)
+				builtIn.push_back(FluidIsaBackend(isa));
+		return builtIn;
+	}();
+	return backends;
+}
+
+static const FluidBackend* findLocked(const char* name)
+{
+	for (const FluidBackend* backend : registry())
+		if (strcmp(backend->name, name) == 0)
+			return backend;
+	return nullptr;
+}
+
+bool FluidBackendRegister(const FluidBackend* backend)
+{
+	std::lock_guard<std::mutex> guard(registryLock);
+	if (findLocked(backend->name))
+	{
+		std::cout << "BACKEND_ALREADY_REGISTERED::" << backend->name << std::endl;
+		return false;
+	}
+	registry().push_back(backend);
+	return true;
+}
+
+const FluidBackend* FluidBackendFind(const char* name)
+{
+	std::lock_guard<std::mutex> guard(registryLock);
+	return findLocked(name);
+}
+
+int FluidBackendCount()
+{
+	std::lock_guard<std::mutex> guard(registryLock);
+	return (int)registry().size();
+}
+
+const FluidBackend* FluidBackendAt(int index)
+{
+	std::lock_guard<std::mutex> guard(registryLock);
+	return registry()[index];
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+struct FluidCube;
+struct FluidRegion;
+
+// What advect and gradient gather for one z plane when asked; FluidCubeSubstep combines the planes in order, so
+// the result does not depend on how many workers there are.
+struct FluidPlaneStats
+{
+	double mass;
+	double kineticEnergy;
+	float maxSpeed;
+	float maxDivergence;
+};
+
+/*
+The swappable parts of a FluidCube substep. Every function works on the cells of r in fields of cube, in whatever
+layout and storage cube has, and leaves the walls alone: FluidCubeSubstep calls boundary on each field it has
+written, and keeps the order of the calls and the arithmetic in between.
+*/
+struct FluidBackend
+{
+	const char* name;
+	// Sets the walls next to r from the cells inside; b is the axis whose velocity component flips, or 0.
+	void (*boundary)(FluidCube* cube, int b, float* x, const FluidRegion& r);
+	// iter sweeps of x = (x0 + ax * x neighbours + ay * y neighbours + az * z neighbours) / c.
+	void (*linearSolve)(FluidCube* cube, float* x, float* x0, float ax, float ay, float az, float c, int iter, const FluidRegion& r);
+	// Sets d to scale times d0 sampled where the velocity carries each cell from over dt. Unless planes is nullptr,
+	// also adds what it stored in each z plane k of r to planes[k].mass and raises planes[k].maxDivergence to the
+	// largest divergence of the velocity there.
+	void (*advect)(FluidCube* cube, float* d, float* d0, float* velocX, float* velocY, float* velocZ, float dt, float scale, FluidPlaneStats* planes, const FluidRegion& r);
+	// Sets div to the divergence of the velocity and p to zero, ahead of the pressure solve.
+	void (*divergence)(FluidCube* cube, float* velocX, float* velocY, float* velocZ, float* p, float* div, const FluidRegion& r);
+	// Subtracts the gradient of p from the velocity and returns the largest component left. Unless planes is
+	// nullptr, also adds the kinetic energy of each z plane k of r to planes[k] and raises its maxSpeed.
+	float (*gradient)(FluidCube* cube, float* velocX, float* velocY, float* velocZ, float* p, FluidPlaneStats* planes, const FluidRegion& r);
+};
+
+// The built-in kernels compiled for each FluidIsa; the reference is the baseline build and the ground truth.
+extern const FluidBackend FluidBackendReference;
+extern const FluidBackend FluidBackendSse42;
+extern const FluidBackend FluidBackendAvx2;
+extern const FluidBackend FluidBackendAvx512;
+
+/*
+Makes backend selectable by name with FluidCubeSetBackend. The built-in backends this machine can run are
+registered from the start. Fails if the name is taken; backend must stay alive while any cube uses it.
+*/
+bool FluidBackendRegister(const FluidBackend* backend);
+
+// nullptr if no backend of that name is registered.
+const FluidBackend* FluidBackendFind(const char* name);
+
+int FluidBackendCount();
+
+const FluidBackend* FluidBackendAt(int index);
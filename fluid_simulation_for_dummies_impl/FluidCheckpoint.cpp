@@ -0,0 +1,236 @@
+#include "FluidCheckpoint.h"
+#include "FluidCube.h"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char checkpointMagic[8] = { 'F', 'L', 'U', 'I', 'D', 'C', 'K', '\0' };
+
+struct FluidCheckpointMapping
+{
+	void* data;
+	uint64_t length;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int file;
+#endif
+};
+
+static uint64_t alignUp(uint64_t offset)
+{
+	return (offset + FLUID_CHECKPOINT_ALIGNMENT - 1) & ~(FLUID_CHECKPOINT_ALIGNMENT - 1);
+}
+
+static float** cubeFields(FluidCube* cube, float** fields)
+{
+	fields[0] = cube->s;
+	fields[1] = cube->density;
+	fields[2] = cube->Vx;
+	fields[3] = cube->Vy;
+	fields[4] = cube->Vz;
+	fields[5] = cube->Vx0;
+	fields[6] = cube->Vy0;
+	fields[7] = cube->Vz0;
+	return fields;
+}
+
+bool FluidCubeSaveCheckpoint(const FluidCube* cube, const char* filePath)
+{
+	// The fields are written and mapped back as they are, so they must be row-major floats.
+	if (cube->layout != FLUID_LAYOUT_ROW_MAJOR || cube->storage != FLUID_STORAGE_FP32)
+	{
+		std::cout << "CHECKPOINT_LAYOUT_UNSUPPORTED::" << filePath << " " << FluidLayoutName(cube->layout) << " " << FluidStorageName(cube->storage) << std::endl;
+		return false;
+	}
+
+	FluidCheckpointHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, checkpointMagic, sizeof(checkpointMagic));
+	header.version = FLUID_CHECKPOINT_VERSION;
+	header.headerSize = sizeof(FluidCheckpointHeader);
+	header.sizeX = cube->sizeX;
+	header.sizeY = cube->sizeY;
+	header.sizeZ = cube->sizeZ;
+	header.dt = cube->dt;
+	header.diff = cube->diff;
+	header.visc = cube->visc;
+	header.cfl = cube->cfl;
+	header.maxSubsteps = cube->maxSubsteps;
+	header.maxSpeed = cube->maxSpeed;
+	header.fieldCount = FLUID_CHECKPOINT_FIELD_COUNT;
+	header.fieldBytes = (uint64_t)cube->sizeX * cube->sizeY * cube->sizeZ * sizeof(float);
+
+	uint64_t offset = alignUp(sizeof(FluidCheckpointHeader));
+	for (uint32_t i = 0; i < FLUID_CHECKPOINT_FIELD_COUNT; i++)
+	{
+		header.fieldOffsets[i] = offset;
+		offset = alignUp(offset + header.fieldBytes);
+	}
+
+	FILE* file = fopen(filePath, "wb");
+	if (!file)
+	{
+		std::cout << "CHECKPOINT_OPEN_FAILED::" << filePath << std::endl;
+		return false;
+	}
+
+	float* fields[FLUID_CHECKPOINT_FIELD_COUNT];
+	cubeFields(const_cast<FluidCube*>(cube), fields);
+
+	std::vector<char> padding(FLUID_CHECKPOINT_ALIGNMENT, 0);
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	uint64_t written = sizeof(header);
+	for (uint32_t i = 0; ok && i < FLUID_CHECKPOINT_FIELD_COUNT; i++)
+	{
+		ok = fwrite(padding.data(), 1, header.fieldOffsets[i] - written, file) == header.fieldOffsets[i] - written
+			&& fwrite(fields[i], 1, header.fieldBytes, file) == header.fieldBytes;
+		written = header.fieldOffsets[i] + header.fieldBytes;
+	}
+	// Pad the tail so the last field also ends on a page boundary and the file maps cleanly.
+	if (ok)
+		ok = fwrite(padding.data(), 1, offset - written, file) == offset - written;
+
+	if (fclose(file) != 0)
+		ok = false;
+	if (!ok)
+		std::cout << "CHECKPOINT_WRITE_FAILED::" << filePath << std::endl;
+	return ok;
+}
+
+static bool mapFile(FluidCheckpointMapping* mapping, const char* filePath, FluidCheckpointMode mode)
+{
+#ifdef _WIN32
+	DWORD access = mode == FLUID_CHECKPOINT_SHARED ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ;
+	mapping->file = CreateFileA(filePath, access, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (mapping->file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER length;
+	GetFileSizeEx(mapping->file, &length);
+	mapping->length = length.QuadPart;
+
+	mapping->mapping = CreateFileMappingA(mapping->file, nullptr, mode == FLUID_CHECKPOINT_SHARED ? PAGE_READWRITE : PAGE_WRITECOPY, 0, 0, nullptr);
+	if (!mapping->mapping)
+	{
+		CloseHandle(mapping->file);
+		return false;
+	}
+	mapping->data = MapViewOfFile(mapping->mapping, mode == FLUID_CHECKPOINT_SHARED ? FILE_MAP_WRITE : FILE_MAP_COPY, 0, 0, 0);
+	if (!mapping->data)
+	{
+		CloseHandle(mapping->mapping);
+		CloseHandle(mapping->file);
+		return false;
+	}
+#else
+	mapping->file = open(filePath, mode == FLUID_CHECKPOINT_SHARED ? O_RDWR : O_RDONLY);
+	if (mapping->file < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(mapping->file, &info) != 0)
+	{
+		close(mapping->file);
+		return false;
+	}
+	mapping->length = info.st_size;
+
+	// PROT_WRITE on a read-only descriptor is allowed for private mappings: pages are copied on first write.
+	mapping->data = mmap(nullptr, mapping->length, PROT_READ | PROT_WRITE, mode == FLUID_CHECKPOINT_SHARED ? MAP_SHARED : MAP_PRIVATE, mapping->file, 0);
+	if (mapping->data == MAP_FAILED)
+	{
+		close(mapping->file);
+		return false;
+	}
+	madvise(mapping->data, mapping->length, MADV_WILLNEED);
+#endif
+	return true;
+}
+
+static bool validHeader(const FluidCheckpointHeader& header, uint64_t fileLength)
+{
+	if (memcmp(header.magic, checkpointMagic, sizeof(checkpointMagic)) != 0
+		|| header.version != FLUID_CHECKPOINT_VERSION
+		|| header.headerSize != sizeof(FluidCheckpointHeader)
+		|| header.fieldCount != FLUID_CHECKPOINT_FIELD_COUNT
+		|| header.sizeX < 3 || header.sizeY < 3 || header.sizeZ < 3
+		|| header.fieldBytes != (uint64_t)header.sizeX * header.sizeY * header.sizeZ * sizeof(float))
+		return false;
+
+	for (uint32_t i = 0; i < FLUID_CHECKPOINT_FIELD_COUNT; i++)
+	{
+		if (header.fieldOffsets[i] % FLUID_CHECKPOINT_ALIGNMENT != 0
+			|| header.fieldOffsets[i] + header.fieldBytes > fileLength)
+			return false;
+	}
+	return true;
+}
+
+FluidCube* FluidCubeLoadCheckpoint(const char* filePath, FluidCheckpointMode mode)
+{
+	FluidCheckpointMapping* mapping = new FluidCheckpointMapping;
+	if (!mapFile(mapping, filePath, mode))
+	{
+		std::cout << "CHECKPOINT_OPEN_FAILED::" << filePath << std::endl;
+		delete mapping;
+		return nullptr;
+	}
+
+	const FluidCheckpointHeader& header = *(const FluidCheckpointHeader*)mapping->data;
+	if (mapping->length < sizeof(FluidCheckpointHeader) || !validHeader(header, mapping->length))
+	{
+		std::cout << "CHECKPOINT_INVALID::" << filePath << std::endl;
+		FluidCheckpointRelease(mapping);
+		return nullptr;
+	}
+
+	FluidCube* cube = new FluidCube;
+	cube->sizeX = header.sizeX;
+	cube->sizeY = header.sizeY;
+	cube->sizeZ = header.sizeZ;
+	cube->dt = header.dt;
+	cube->diff = header.diff;
+	cube->visc = header.visc;
+	cube->cfl = header.cfl;
+	cube->maxSubsteps = header.maxSubsteps;
+	cube->maxSpeed = header.maxSpeed;
+	cube->active = FluidRegion{ { 1, 1, 1 }, { header.sizeX - 2, header.sizeY - 2, header.sizeZ - 2 } };
+	cube->mapping = mapping;
+
+	char* base = (char*)mapping->data;
+	float** fields[FLUID_CHECKPOINT_FIELD_COUNT] = {
+		&cube->s, &cube->density,
+		&cube->Vx, &cube->Vy, &cube->Vz,
+		&cube->Vx0, &cube->Vy0, &cube->Vz0
+	};
+	for (uint32_t i = 0; i < FLUID_CHECKPOINT_FIELD_COUNT; i++)
+		*fields[i] = (float*)(base + header.fieldOffsets[i]);
+
+	return cube;
+}
+
+void FluidCheckpointRelease(FluidCheckpointMapping* mapping)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(mapping->data);
+	CloseHandle(mapping->mapping);
+	CloseHandle(mapping->file);
+#else
+	munmap(mapping->data, mapping->length);
+	close(mapping->file);
+#endif
+	delete mapping;
+}
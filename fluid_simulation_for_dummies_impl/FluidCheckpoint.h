@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+struct FluidCube;
+
+/*
+Checkpoint file layout (version 2):
+
+	FluidCheckpointHeader
+	padding up to FLUID_CHECKPOINT_ALIGNMENT
+	field 0 (s), field 1 (density), Vx, Vy, Vz, Vx0, Vy0, Vz0
+
+Every field payload starts on a FLUID_CHECKPOINT_ALIGNMENT boundary so a mapped file can be used by the
+solver without copying. The scratch fields are stored too because lin_solve uses them as its initial guess,
+which makes a restarted run bitwise identical to an uninterrupted one. Version 1 files only stored a single
+side length and are no longer read.
+*/
+const uint32_t FLUID_CHECKPOINT_VERSION = 2;
+const uint32_t FLUID_CHECKPOINT_FIELD_COUNT = 8;
+const uint64_t FLUID_CHECKPOINT_ALIGNMENT = 4096;
+
+struct FluidCheckpointHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+
+	int32_t sizeX;
+	int32_t sizeY;
+	int32_t sizeZ;
+	float dt;
+
+	float diff;
+	float visc;
+	float cfl;
+	int32_t maxSubsteps;
+
+	float maxSpeed;
+	uint32_t fieldCount;
+
+	uint64_t fieldBytes;
+	uint64_t fieldOffsets[FLUID_CHECKPOINT_FIELD_COUNT];
+};
+
+enum FluidCheckpointMode
+{
+	// Writes made by the solver go straight back to the checkpoint file.
+	FLUID_CHECKPOINT_SHARED,
+	// Pages are copied on first write; the checkpoint file is never modified.
+	FLUID_CHECKPOINT_PRIVATE
+};
+
+struct FluidCheckpointMapping;
+
+bool FluidCubeSaveCheckpoint(const FluidCube* cube, const char* filePath);
+
+FluidCube* FluidCubeLoadCheckpoint(const char* filePath, FluidCheckpointMode mode = FLUID_CHECKPOINT_PRIVATE);
+
+void FluidCheckpointRelease(FluidCheckpointMapping* mapping);
@@ -1,300 +1,623 @@
 #include "FluidCube.h"
+#include "FluidCheckpoint.h"
+#include "FluidBackend.h"
+#include "FluidIsa.h"
+#include <chrono>
 #include <malloc.h>
 #include <iostream> 
-#define IX(x,y,z) ((x) + (y) * N + (z) * N * N)
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <tuple>
+#include <vector>
+// Indices are 64-bit: a 1291^3 grid already has more cells than an int can count.
+#define IX(x,y,z) ((size_t)(x) + ((size_t)(y) + (size_t)(z) * Ny) * Nx)
+
+static bool regionEmpty(const FluidRegion& r)
+{
+	return r.min[0] > r.max[0] || r.min[1] > r.max[1] || r.min[2] > r.max[2];
+}
+
+static FluidRegion regionDilate(const FluidRegion& r, const int margin[3], const FluidRegion& bounds)
+{
+	if (regionEmpty(r))
+		return r;
+	FluidRegion dilated;
+	for (int a = 0; a < 3; a++)
+	{
+		dilated.min[a] = r.min[a] - margin[a] < bounds.min[a] ? bounds.min[a] : r.min[a] - margin[a];
+		dilated.max[a] = r.max[a] + margin[a] > bounds.max[a] ? bounds.max[a] : r.max[a] + margin[a];
+	}
+	return dilated;
+}
+
+static void regionInclude(FluidRegion& r, int x, int y, int z)
+{
+	if (regionEmpty(r))
+	{
+		r = FluidRegion{ { x, y, z }, { x, y, z } };
+		return;
+	}
+	int cell[3] = { x, y, z };
+	for (int a = 0; a < 3; a++)
+	{
+		r.min[a] = cell[a] < r.min[a] ? cell[a] : r.min[a];
+		r.max[a] = cell[a] > r.max[a] ? cell[a] : r.max[a];
+	}
+}
+
+static const FluidRegion emptyRegion = { { 1, 1, 1 }, { 0, 0, 0 } };
+static const int oneCell[3] = { 1, 1, 1 };
+
+static FluidRegion interiorRegion(const FluidCube* cube)
+{
+	return FluidRegion{ { 1, 1, 1 }, { cube->sizeX - 2, cube->sizeY - 2, cube->sizeZ - 2 } };
+}
+
+static FluidRegion wholeRegion(const FluidCube* cube)
+{
+	return FluidRegion{ { 0, 0, 0 }, { cube->sizeX - 1, cube->sizeY - 1, cube->sizeZ - 1 } };
+}
 
 FluidCube* FluidCubeCreate(int size, int diffusion, int viscosity, float dt)
+{
+	return FluidCubeCreateBox(size, size, size, diffusion, viscosity, dt);
+}
+
+FluidCube* FluidCubeCreateBox(int sizeX, int sizeY, int sizeZ, float diffusion, float viscosity, float dt)
 {
 	FluidCube* cube = new FluidCube;
-	int N = size;
+	size_t cells = (size_t)sizeX * sizeY * sizeZ;
 
-	cube->size = size;
+	cube->sizeX = sizeX;
+	cube->sizeY = sizeY;
+	cube->sizeZ = sizeZ;
 	cube->dt = dt;
 	cube->diff = diffusion;
 	cube->visc = viscosity;
 
-	cube->s = new float[N * N * N];
-	cube->density = new float[N * N * N];
+	cube->active = interiorRegion(cube);
 
-	cube->Vx = new float[N * N * N];
-	cube->Vy = new float[N * N * N];
-	cube->Vz = new float[N * N * N];
+	cube->s = new float[cells];
+	cube->density = new float[cells];
 
-	cube->Vx0 = new float[N * N * N];
-	cube->Vy0 = new float[N * N * N];
-	cube->Vz0 = new float[N * N * N];
+	cube->Vx = new float[cells];
+	cube->Vy = new float[cells];
+	cube->Vz = new float[cells];
+
+	cube->Vx0 = new float[cells];
+	cube->Vy0 = new float[cells];
+	cube->Vz0 = new float[cells];
 
 	return cube;
 }
 
+FluidCube* FluidCubeCreateThreaded(int sizeX, int sizeY, int sizeZ, float diffusion, float viscosity, float dt, int threads, FluidPlacement placement)
+{
+	FluidCube* cube = new FluidCube;
+	size_t plane = (size_t)sizeX * sizeY;
+
+	cube->sizeX = sizeX;
+	cube->sizeY = sizeY;
+	cube->sizeZ = sizeZ;
+	cube->dt = dt;
+	cube->diff = diffusion;
+	cube->visc = viscosity;
+
+	cube->active = interiorRegion(cube);
+	cube->workers = FluidWorkersCreate(threads, placement);
+
+	for (float** field : { &cube->s, &cube->density, &cube->Vx, &cube->Vy, &cube->Vz, &cube->Vx0, &cube->Vy0, &cube->Vz0 })
+		*field = FluidWorkersAllocField(cube->workers, plane, sizeZ);
+	return cube;
+}
+
+FluidCube* FluidCubeCreatePacked(int sizeX, int sizeY, int sizeZ, float diffusion, float viscosity, float dt, FluidLayoutKind layout, FluidStorageKind storage, float dyeRange)
+{
+	FluidCube* cube = FluidCubeCreateBox(sizeX, sizeY, sizeZ, diffusion, viscosity, dt);
+	size_t cells = FluidLayoutCells(layout, sizeX, sizeY, sizeZ);
+	cube->layout = layout;
+	if (layout == FLUID_LAYOUT_MORTON)
+	{
+		cube->mortonTable = new uint64_t[(size_t)sizeX + sizeY + sizeZ];
+		FluidLayoutBuildMorton(cube->mortonTable, sizeX, sizeY, sizeZ);
+	}
+	cube->storage = storage;
+	cube->dyeScale = 32767.f / dyeRange;
+
+	for (float** field : { &cube->s, &cube->density, &cube->Vx, &cube->Vy, &cube->Vz, &cube->Vx0, &cube->Vy0, &cube->Vz0 })
+	{
+		bool single = FluidCubeFieldStorage(cube, *field) == FLUID_STORAGE_FP32;
+		delete[] *field;
+		if (single)
+		{
+			*field = new float[cells];
+			std::fill(*field, *field + cells, 0.f);
+		}
+		else
+		{
+			// Zero bits are zero in every 16-bit format.
+			uint16_t* narrow = new uint16_t[cells];
+			std::fill(narrow, narrow + cells, (uint16_t)0);
+			*field = (float*)narrow;
+		}
+	}
+	return cube;
+}
+
+FluidCube* FluidCubeCreateLayout(int sizeX, int sizeY, int sizeZ, float diffusion, float viscosity, float dt, FluidLayoutKind layout)
+{
+	return FluidCubeCreatePacked(sizeX, sizeY, sizeZ, diffusion, viscosity, dt, layout, FLUID_STORAGE_FP32, 1.f);
+}
+
+static size_t cellIndex(const FluidCube* cube, int x, int y, int z)
+{
+	switch (cube->layout)
+	{
+	case FLUID_LAYOUT_TILED:
+		return FluidLayoutTiled(cube->sizeX, cube->sizeY)(x, y, z);
+	case FLUID_LAYOUT_MORTON:
+		return FluidLayoutMorton(cube->mortonTable, cube->sizeX, cube->sizeY)(x, y, z);
+	default:
+		return FluidLayoutRowMajor(cube->sizeX, cube->sizeY)(x, y, z);
+	}
+}
+
+FluidStorageKind FluidCubeFieldStorage(const FluidCube* cube, const float* field)
+{
+	if (field == cube->density)
+		return cube->storage;
+	if (field == cube->Vx || field == cube->Vy || field == cube->Vz)
+		return cube->storage == FLUID_STORAGE_INT16 ? FLUID_STORAGE_FP16 : cube->storage;
+	return FLUID_STORAGE_FP32;
+}
+
+static FluidStoredField storedField(const FluidCube* cube, const float* field)
+{
+	return FluidStoredField{ (void*)field, FluidCubeFieldStorage(cube, field), cube->dyeScale };
+}
+
+static float loadCell(const FluidCube* cube, const float* field, size_t index)
+{
+	return storedField(cube, field)[index];
+}
+
+static void storeCell(const FluidCube* cube, float* field, size_t index, float value)
+{
+	storedField(cube, field)[index] = value;
+}
+
+void FluidCubeCopyField(const FluidCube* cube, const float* field, float* rowMajor)
+{
+	int Nx = cube->sizeX, Ny = cube->sizeY, Nz = cube->sizeZ;
+	for (int k = 0; k < Nz; k++)
+		for (int j = 0; j < Ny; j++)
+			for (int i = 0; i < Nx; i++)
+				rowMajor[IX(i, j, k)] = loadCell(cube, field, cellIndex(cube, i, j, k));
+}
+
+struct FluidSource
+{
+	int order;
+	int x;
+	int y;
+	int z;
+	bool velocity;
+	float amount[3];
+};
+
+struct FluidSourceQueue
+{
+	std::vector<FluidSource> sources;
+};
+
+// Guards every cube's queue; emitters queue a handful of sources per step, so one lock is plenty.
+static std::mutex queueLock;
+
 void FluidCubeFree(FluidCube* cube)
 {
-	delete[] cube->s;
-	delete[] cube->density;
+	delete cube->queued;
+	if (cube->workers)
+	{
+		size_t cells = (size_t)cube->sizeX * cube->sizeY * cube->sizeZ;
+		for (float* field : { cube->s, cube->density, cube->Vx, cube->Vy, cube->Vz, cube->Vx0, cube->Vy0, cube->Vz0 })
+			FluidWorkersFreeField(field, cells);
+		FluidWorkersFree(cube->workers);
+		free(cube);
+		return;
+	}
 
-	delete[] cube->Vx;
-	delete[] cube->Vy;
-	delete[] cube->Vz;
+	if (cube->mapping)
+	{
+		FluidCheckpointRelease(cube->mapping);
+		free(cube);
+		return;
+	}
 
-	delete[] cube->Vx0;
-	delete[] cube->Vy0;
-	delete[] cube->Vz0;
+	for (float* field : { cube->s, cube->density, cube->Vx, cube->Vy, cube->Vz, cube->Vx0, cube->Vy0, cube->Vz0 })
+	{
+		if (FluidCubeFieldStorage(cube, field) == FLUID_STORAGE_FP32)
+			delete[] field;
+		else
+			delete[] (uint16_t*)field;
+	}
 
+	delete[] cube->mortonTable;
 	free(cube);
 }
 
 void FluidCubeAddDensity(FluidCube* cube, int x, int y, int z, float amount)
 {
-	int N = cube->size;
-	cube->density[IX(x, y, z)] += amount;
+	size_t index = cellIndex(cube, x, y, z);
+	storeCell(cube, cube->density, index, loadCell(cube, cube->density, index) + amount);
+	if (cube->trackActive)
+		regionInclude(cube->active, x, y, z);
+	// Dye on a wall is overwritten by the next set_bnd.
+	if (cube->conserveDye && x > 0 && y > 0 && z > 0 && x < cube->sizeX - 1 && y < cube->sizeY - 1 && z < cube->sizeZ - 1)
+		cube->dyeTarget += amount;
 }
 
 void FluidCubeAddVelocity(FluidCube* cube, int x, int y, int z, float amountX, float amountY, float amountZ)
 {
-	int N = cube->size;
-	int index = IX(x, y, z);
-
-	cube->Vx[index] += amountX;
-	cube->Vy[index] += amountY;
-	cube->Vz[index] += amountZ;
+	size_t index = cellIndex(cube, x, y, z);
+
+	storeCell(cube, cube->Vx, index, loadCell(cube, cube->Vx, index) + amountX);
+	storeCell(cube, cube->Vy, index, loadCell(cube, cube->Vy, index) + amountY);
+	storeCell(cube, cube->Vz, index, loadCell(cube, cube->Vz, index) + amountZ);
+	if (cube->trackActive)
+		regionInclude(cube->active, x, y, z);
+
+	// Keep the CFL estimate conservative until the next projection measures it again.
+	float speedX = fabsf(loadCell(cube, cube->Vx, index));
+	float speedY = fabsf(loadCell(cube, cube->Vy, index));
+	float speedZ = fabsf(loadCell(cube, cube->Vz, index));
+	cube->maxSpeed = fmaxf(cube->maxSpeed, fmaxf(speedX, fmaxf(speedY, speedZ)));
 }
 
-void FluidCubeStep(FluidCube* cube)
+static void queue(FluidCube* cube, const FluidSource& source)
 {
-	int N = cube->size;
-	float visc = cube->visc;
-	float diff = cube->diff;
-	float dt = cube->dt;
-	float* Vx = cube->Vx;
-	float* Vy = cube->Vy;
-	float* Vz = cube->Vz;
-	float* Vx0 = cube->Vx0;
-	float* Vy0 = cube->Vy0;
-	float* Vz0 = cube->Vz0;
-	float* s = cube->s;
-	float* density = cube->density;
-
-	/*
-	diffuse - Put a drop of soy sauce in some water, and you'll notice that it doesn't stay still, but it spreads out. This happens even if the water and sauce are both perfectly still. This is called diffusion. We use diffusion both in the obvious case of making the dye spread out, and also in the less obvious case of making the velocities of the fluid spread out.
-	*/
-	diffuse(1, Vx0, Vx, visc, dt, 4, N);
-	diffuse(2, Vy0, Vy, visc, dt, 4, N);
-	diffuse(3, Vz0, Vz, visc, dt, 4, N);
-
-	/*
-	project - Remember when I said that we're only simulating incompressible fluids? This means that the amount of fluid in each box has to stay constant. That means that the amount of fluid going in has to be exactly equal to the amount of fluid going out. The other operations tend to screw things up so that you get some boxes with a net outflow, and some with a net inflow. This operation runs through all the cells and fixes them up so everything is in equilibrium.
-	*/
-	project(Vx0, Vy0, Vz0, Vx, Vy, 4, N);
+	std::lock_guard<std::mutex> guard(queueLock);
+	if (!cube->queued)
+		cube->queued = new FluidSourceQueue;
+	cube->queued->sources.push_back(source);
+}
 
-	/*
-	advect - Every cell has a set of velocities, and these velocities make things move. This is called advection. As with diffusion, advection applies both to the dye and to the velocities themselves.
-	*/
-	advect(1, Vx, Vx0, Vx0, Vy0, Vz0, dt, N);
-	advect(2, Vy, Vy0, Vx0, Vy0, Vz0, dt, N);
-	advect(3, Vz, Vz0, Vx0, Vy0, Vz0, dt, N);
+void FluidCubeQueueDensity(FluidCube* cube, int order, int x, int y, int z, float amount)
+{
+	queue(cube, FluidSource{ order, x, y, z, false, { amount, 0.f, 0.f } });
+}
 
-	project(Vx, Vy, Vz, Vx0, Vy0, 4, N);
+void FluidCubeQueueVelocity(FluidCube* cube, int order, int x, int y, int z, float amountX, float amountY, float amountZ)
+{
+	queue(cube, FluidSource{ order, x, y, z, true, { amountX, amountY, amountZ } });
+}
 
-	diffuse(0, s, density, diff, dt, 4, N);
-	advect(0, density, s, Vx, Vy, Vz, dt, N);
+// Sources with equal keys are interchangeable, so sorting on every member fixes the order of the additions.
+static bool sourceBefore(const FluidSource& a, const FluidSource& b)
+{
+	return std::make_tuple(a.order, a.z, a.y, a.x, a.velocity, FluidAsBits(a.amount[0]), FluidAsBits(a.amount[1]), FluidAsBits(a.amount[2]))
+		< std::make_tuple(b.order, b.z, b.y, b.x, b.velocity, FluidAsBits(b.amount[0]), FluidAsBits(b.amount[1]), FluidAsBits(b.amount[2]));
 }
 
-static void set_bnd(int b, float* x, int N)
+static void applyQueued(FluidCube* cube)
 {
-	for (int j = 1; j < N - 1; j++)
+	std::vector<FluidSource> sources;
 	{
-		for (int i = 1; i < N - 1; i++)
-		{
-			x[IX(i, j, 0)] = b == 3 ? -x[IX(i, j, 1)] : x[IX(i, j, 1)];
-			x[IX(i, j, N - 1)] = b == 3 ? -x[IX(i, j, N - 2)] : x[IX(i, j, N - 2)];
-		}
+		std::lock_guard<std::mutex> guard(queueLock);
+		if (!cube->queued || cube->queued->sources.empty())
+			return;
+		sources.swap(cube->queued->sources);
 	}
-	for (int k = 1; k < N - 1; k++)
+	std::sort(sources.begin(), sources.end(), sourceBefore);
+	for (const FluidSource& source : sources)
 	{
-		for (int i = 1; i < N - 1; i++)
-		{
-			x[IX(i, 0, k)] = b == 2 ? -x[IX(i, 1, k)] : x[IX(i, 1, k)];
-			x[IX(i, N - 1, k)] = b == 2 ? -x[IX(i, N - 2, k)] : x[IX(i, N - 2, k)];
-		}
+		if (source.velocity)
+			FluidCubeAddVelocity(cube, source.x, source.y, source.z, source.amount[0], source.amount[1], source.amount[2]);
+		else
+			FluidCubeAddDensity(cube, source.x, source.y, source.z, source.amount[0]);
 	}
-	for (int k = 1; k < N - 1; k++)
+}
+
+void FluidCubeSetCFL(FluidCube* cube, float cfl, int maxSubsteps)
+{
+	cube->cfl = cfl;
+	cube->maxSubsteps = maxSubsteps < 1 ? 1 : maxSubsteps;
+}
+
+static FluidRegion measureActive(const FluidCube* cube, const FluidRegion& r)
+{
+	int Nx = cube->sizeX, Ny = cube->sizeY;
+	float threshold = cube->activeThreshold;
+	FluidRegion measured = emptyRegion;
+
+	for (int k = r.min[2]; k <= r.max[2]; k++)
 	{
-		for (int j = 1; j < N - 1; j++)
+		for (int j = r.min[1]; j <= r.max[1]; j++)
 		{
-			x[IX(0, j, k)] = b == 1 ? -x[IX(1, j, k)] : x[IX(1, j, k)];
-			x[IX(N - 1, j, k)] = b == 1 ? -x[IX(N - 2, j, k)] : x[IX(N - 2, j, k)];
+			int first = -1, last = -1;
+			for (int i = r.min[0]; i <= r.max[0]; i++)
+			{
+				size_t index = IX(i, j, k);
+				if (fabsf(cube->density[index]) > threshold || fabsf(cube->Vx[index]) > threshold
+					|| fabsf(cube->Vy[index]) > threshold || fabsf(cube->Vz[index]) > threshold)
+				{
+					first = first < 0 ? i : first;
+					last = i;
+				}
+			}
+			if (first >= 0)
+			{
+				regionInclude(measured, first, j, k);
+				regionInclude(measured, last, j, k);
+			}
 		}
 	}
+	return measured;
+}
+
+// Zeroes every field in area outside keep; keep must lie inside area.
+static void clearOutside(FluidCube* cube, const FluidRegion& area, const FluidRegion& keep)
+{
+	int Nx = cube->sizeX, Ny = cube->sizeY;
+	float* fields[] = { cube->s, cube->density, cube->Vx, cube->Vy, cube->Vz, cube->Vx0, cube->Vy0, cube->Vz0 };
+	bool keepEmpty = regionEmpty(keep);
 
-	x[IX(0, 0, 0)] = .33f * (x[IX(1, 0, 0)]
-		+ x[IX(0, 1, 0)]
-		+ x[IX(0, 0, 1)]);
-	x[IX(0, N - 1, 0)] = .33f * (x[IX(1, N - 1, 0)]
-		+ x[IX(0, N - 2, 0)]
-		+ x[IX(0, N - 1, 1)]);
-	x[IX(0, 0, N - 1)] = .33f * (x[IX(1, 0, N - 1)]
-		+ x[IX(0, 1, N - 1)]
-		+ x[IX(0, 0, N - 2)]);
-	x[IX(0, N - 1, N - 1)] = .33f * (x[IX(1, N - 1, N - 1)]
-		+ x[IX(0, N - 2, N - 1)]
-		+ x[IX(0, N - 1, N - 2)]);
-	x[IX(N - 1, 0, 0)] = .33f * (x[IX(N - 2, 0, 0)]
-		+ x[IX(N - 1, 1, 0)]
-		+ x[IX(N - 1, 0, 1)]);
-	x[IX(N - 1, N - 1, 0)] = .33f * (x[IX(N - 2, N - 1, 0)]
-		+ x[IX(N - 1, N - 2, 0)]
-		+ x[IX(N - 1, N - 1, 1)]);
-	x[IX(N - 1, 0, N - 1)] = .33f * (x[IX(N - 2, 0, N - 1)]
-		+ x[IX(N - 1, 1, N - 1)]
-		+ x[IX(N - 1, 0, N - 2)]);
-	x[IX(N - 1, N - 1, N - 1)] = .33f * (x[IX(N - 2, N - 1, N - 1)]
-		+ x[IX(N - 1, N - 2, N - 1)]
-		+ x[IX(N - 1, N - 1, N - 2)]);
-}
-
-static void lin_solve(int b, float* x, float* x0, float a, float c, int iter, int N)
-{
-	float cRecip = 1.0f / c;
-	for (int k = 0; k < iter; k++)
+	for (int k = area.min[2]; k <= area.max[2]; k++)
 	{
-		for (int m = 1; m < N - 2; m++)
+		for (int j = area.min[1]; j <= area.max[1]; j++)
 		{
-			for (int j = 1; j < N - 2; j++)
+			bool kept = !keepEmpty && k >= keep.min[2] && k <= keep.max[2] && j >= keep.min[1] && j <= keep.max[1];
+			for (float* field : fields)
 			{
-				for (int i = 1; i < N - 2; i++)
+				float* row = field + IX(0, j, k);
+				if (!kept)
+					std::fill(row + area.min[0], row + area.max[0] + 1, 0.f);
+				else
 				{
-					x[IX(i, j, m)] = (x0[IX(i, j, m)]
-						+ a * (
-							x[IX(i + 1, j, m)]
-							+ x[IX(i - 1, j, m)]
-							+ x[IX(i, j + 1, m)]
-							+ x[IX(i, j - 1, m)]
-							+ x[IX(i, j, m + 1)]
-							+ x[IX(i, j, m - 1)]
-							)) * cRecip;
+					std::fill(row + area.min[0], row + keep.min[0], 0.f);
+					std::fill(row + keep.max[0] + 1, row + area.max[0] + 1, 0.f);
 				}
 			}
 		}
 	}
-	set_bnd(b, x, N);
 }
 
-static void diffuse(int b, float* x, float* x0, float diff, float dt, int iter, int N)
+void FluidCubeTrackActiveRegion(FluidCube* cube, float threshold)
 {
-	float a = dt * diff * (N - 2) * (N - 2);
-	lin_solve(b, x, x0, a, 1 + 6 * a, iter, N);
+	if (cube->layout != FLUID_LAYOUT_ROW_MAJOR || cube->storage != FLUID_STORAGE_FP32)
+	{
+		std::cout << "ACTIVE_REGION_LAYOUT_UNSUPPORTED::" << FluidLayoutName(cube->layout) << " " << FluidStorageName(cube->storage) << std::endl;
+		return;
+	}
+	FluidRegion interior = interiorRegion(cube);
+	cube->trackActive = threshold >= 0.f;
+	if (!cube->trackActive)
+	{
+		cube->active = interior;
+		return;
+	}
+
+	cube->activeThreshold = threshold;
+	cube->active = measureActive(cube, interior);
+	clearOutside(cube, wholeRegion(cube), regionDilate(cube->active, oneCell, wholeRegion(cube)));
 }
 
-static void project(float* velocX, float* velocY, float* velocZ, float* p, float* div, int iter, int N)
+static void FluidCubeSubstep(FluidCube* cube, float dt);
+
+void FluidCubeStep(FluidCube* cube)
 {
-	for (int k = 1; k < N - 1; k++)
+	FluidCubeAdvance(cube, cube->dt);
+}
+
+/*
+Advances the simulation by duration, split into as many equal substeps as the target CFL number requires.
+The substep count only depends on the velocity measured by the previous projection, so replaying the same
+inputs always takes the same steps. A calm scene can be advanced by several frames' worth of time in one call.
+Queued sources are added first.
+*/
+int FluidCubeAdvance(FluidCube* cube, float duration)
+{
+	applyQueued(cube);
+
+	int substeps = 1;
+	if (cube->cfl > 0.f)
 	{
-		for (int j = 1; j < N - 1; j++)
-		{
-			for (int i = 1; i < N - 1; i++)
-			{
-				div[IX(i, j, k)] = -.5f * (
-					velocX[IX(i + 1, j, k)]
-					- velocX[IX(i - 1, j, k)]
-					+ velocY[IX(i, j + 1, k)]
-					- velocY[IX(i, j - 1, k)]
-					+ velocX[IX(i, j, k + 1)]
-					- velocX[IX(i, j, k - 1)]
-					) / N;
-				p[IX(i, j, k)] = 0;
-			}
-		}
+		int finest = std::max(cube->sizeX, std::max(cube->sizeY, cube->sizeZ));
+		float cells = cube->maxSpeed * duration * (finest - 2);
+		float needed = ceilf(cells / cube->cfl);
+		substeps = needed < 1.f ? 1 : needed > cube->maxSubsteps ? cube->maxSubsteps : (int)needed;
 	}
-	set_bnd(0, div, N);
-	set_bnd(0, p, N);
-	lin_solve(0, p, div, 1, 6, iter, N);
 
-	for (int k = 1; k < N - 1; k++)
+	float dt = duration / substeps;
+	for (int i = 0; i < substeps; i++)
+		FluidCubeSubstep(cube, dt);
+	return substeps;
+}
+
+static double seconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Charges the time since started to one kernel and restarts the clock.
+static void lap(FluidKernelTimes* times, double FluidKernelTimes::* kernel, double& started)
+{
+	if (!times)
+		return;
+	double now = seconds();
+	times->*kernel += now - started;
+	started = now;
+}
+
+static void diffuse(FluidCube* cube, const FluidBackend* backend, int b, float* x, float* x0, float diff, float dt, int iter, const FluidRegion& r)
+{
+	int Nx = cube->sizeX, Ny = cube->sizeY, Nz = cube->sizeZ;
+	float ax = dt * diff * (Nx - 2) * (Nx - 2);
+	float ay = dt * diff * (Ny - 2) * (Ny - 2);
+	float az = dt * diff * (Nz - 2) * (Nz - 2);
+	backend->linearSolve(cube, x, x0, ax, ay, az, 1 + 2 * (ax + ay + az), iter, r);
+	backend->boundary(cube, b, x, r);
+}
+
+/*
+The pressure is solved in units of the x spacing: the y and z neighbours are weighted by how much finer those
+axes are. Returns the largest velocity component left.
+*/
+static float project(FluidCube* cube, const FluidBackend* backend, float* velocX, float* velocY, float* velocZ, float* p, float* div, int iter, FluidPlaneStats* planes, const FluidRegion& r)
+{
+	int Nx = cube->sizeX, Ny = cube->sizeY, Nz = cube->sizeZ;
+	float wy = (float)Ny * Ny / ((float)Nx * Nx);
+	float wz = (float)Nz * Nz / ((float)Nx * Nx);
+
+	backend->divergence(cube, velocX, velocY, velocZ, p, div, r);
+	backend->boundary(cube, 0, div, r);
+	backend->boundary(cube, 0, p, r);
+	backend->linearSolve(cube, p, div, 1, wy, wz, 2 * (1 + wy + wz), iter, r);
+	backend->boundary(cube, 0, p, r);
+
+	float maxSpeed = backend->gradient(cube, velocX, velocY, velocZ, p, planes, r);
+	backend->boundary(cube, 1, velocX, r);
+	backend->boundary(cube, 2, velocY, r);
+	backend->boundary(cube, 3, velocZ, r);
+	return maxSpeed;
+}
+
+static void advect(FluidCube* cube, const FluidBackend* backend, int b, float* d, float* d0, float* velocX, float* velocY, float* velocZ, float dt, const FluidRegion& r)
+{
+	backend->advect(cube, d, d0, velocX, velocY, velocZ, dt, 1.f, nullptr, r);
+	backend->boundary(cube, b, d, r);
+}
+
+/*
+Advects the dye, gathering planes unless it is nullptr. A conserving cube scales by the correction the last call
+worked out and works out the next one from the new total. Everything outside r is zero, so the planes of r hold
+the whole interior. Combining them in order keeps the result independent of the number of workers.
+*/
+static void advectDye(FluidCube* cube, const FluidBackend* backend, float dt, FluidPlaneStats* planes, const FluidRegion& r)
+{
+	backend->advect(cube, cube->density, cube->s, cube->Vx, cube->Vy, cube->Vz, dt, cube->conserveDye ? cube->dyeCorrection : 1.f, planes, r);
+	backend->boundary(cube, 0, cube->density, r);
+	if (!planes)
+		return;
+
+	FluidStats totals = {};
+	for (int k = r.min[2]; k <= r.max[2]; k++)
 	{
-		for (int j = 1; j < N - 1; j++)
-		{
-			for (int i = 1; i < N - 1; i++)
-			{
-				velocX[IX(i, j, k)] -= .5f * (p[IX(i + 1, j, k)] - p[IX(i - 1, j, k)]) * N;
-				velocY[IX(i, j, k)] -= .5f * (p[IX(i, j + 1, k)] - p[IX(i, j - 1, k)]) * N;
-				velocZ[IX(i, j, k)] -= .5f * (p[IX(i, j, k + 1)] - p[IX(i, j, k - 1)]) * N;
-			}
-		}
+		totals.mass += planes[k].mass;
+		totals.kineticEnergy += planes[k].kineticEnergy;
+		totals.maxSpeed = std::max(totals.maxSpeed, planes[k].maxSpeed);
+		totals.maxDivergence = std::max(totals.maxDivergence, planes[k].maxDivergence);
+	}
+	if (cube->stats)
+		*cube->stats = totals;
+	if (cube->conserveDye)
+	{
+		double target = cube->dyeTarget;
+		cube->dyeDrift = target != 0. ? (float)((totals.mass - target) / fabs(target)) : (float)totals.mass;
+		cube->dyeCorrection = totals.mass > 0. && target > 0. ? (float)(target / totals.mass) : 1.f;
 	}
-	set_bnd(1, velocX, N);
-	set_bnd(2, velocY, N);
-	set_bnd(3, velocZ, N);
 }
 
-static void advect(int b, float* d, float* d0, float* velocX, float* velocY, float* velocZ, float dt, int N)
+static void FluidCubeSubstep(FluidCube* cube, float dt)
 {
-	float i0, i1, j0, j1, k0, k1;
+	FluidRegion r = interiorRegion(cube);
+	if (cube->trackActive)
+	{
+		if (regionEmpty(cube->active))
+			return;
+		// Advection carries values at most maxSpeed * dt cells; each of the 4 solver iterations reaches one more.
+		int sizes[3] = { cube->sizeX, cube->sizeY, cube->sizeZ };
+		int margin[3];
+		for (int a = 0; a < 3; a++)
+			margin[a] = (int)ceilf(cube->maxSpeed * dt * (sizes[a] - 2)) + 4 + 1;
+		r = regionDilate(cube->active, margin, r);
+	}
+
+	const FluidBackend* backend = cube->backend ? cube->backend : FluidIsaBackend(FluidIsaActive());
+	float visc = cube->visc;
+	float diff = cube->diff;
+	float* Vx = cube->Vx;
+	float* Vy = cube->Vy;
+	float* Vz = cube->Vz;
+	float* Vx0 = cube->Vx0;
+	float* Vy0 = cube->Vy0;
+	float* Vz0 = cube->Vz0;
+	float* s = cube->s;
+	float* density = cube->density;
+	FluidKernelTimes* times = cube->kernelTimes;
+	double started = times ? seconds() : 0.;
+	std::vector<FluidPlaneStats> gathered(cube->stats || cube->conserveDye ? cube->sizeZ : 0, FluidPlaneStats{});
+	FluidPlaneStats* planes = gathered.empty() ? nullptr : gathered.data();
 
-	float dtx = dt * (N - 2);
-	float dty = dt * (N - 2);
-	float dtz = dt * (N - 2);
+	/*
+	diffuse - Put a drop of soy sauce in some water, and you'll notice that it doesn't stay still, but it spreads out. This happens even if the water and sauce are both perfectly still. This is called diffusion. We use diffusion both in the obvious case of making the dye spread out, and also in the less obvious case of making the velocities of the fluid spread out.
+	*/
+	diffuse(cube, backend, 1, Vx0, Vx, visc, dt, 4, r);
+	diffuse(cube, backend, 2, Vy0, Vy, visc, dt, 4, r);
+	diffuse(cube, backend, 3, Vz0, Vz, visc, dt, 4, r);
+	lap(times, &FluidKernelTimes::diffuse, started);
 
-	float s0, s1, t0, t1, u0, u1;
-	float tmp1, tmp2, tmp3, x, y, z;
+	/*
+	project - Remember when I said that we're only simulating incompressible fluids? This means that the amount of fluid in each box has to stay constant. That means that the amount of fluid going in has to be exactly equal to the amount of fluid going out. The other operations tend to screw things up so that you get some boxes with a net outflow, and some with a net inflow. This operation runs through all the cells and fixes them up so everything is in equilibrium.
+	*/
+	// Narrow cubes keep only s and the Vx0 fields in FP32, so there the pressure goes in s, and the divergence,
+	// which the solve only reads, in Vx.
+	bool single = cube->storage == FLUID_STORAGE_FP32;
+	project(cube, backend, Vx0, Vy0, Vz0, single ? Vx : s, single ? Vy : Vx, 4, nullptr, r);
+	lap(times, &FluidKernelTimes::project, started);
 
-	float Nfloat = N;
-	float ifloat = 0.f, jfloat = 0.f, kfloat = 0.f;
-	int i, j, k;
+	/*
+	advect - Every cell has a set of velocities, and these velocities make things move. This is called advection. As with diffusion, advection applies both to the dye and to the velocities themselves.
+	*/
+	advect(cube, backend, 1, Vx, Vx0, Vx0, Vy0, Vz0, dt, r);
+	advect(cube, backend, 2, Vy, Vy0, Vx0, Vy0, Vz0, dt, r);
+	advect(cube, backend, 3, Vz, Vz0, Vx0, Vy0, Vz0, dt, r);
+	lap(times, &FluidKernelTimes::advect, started);
 
-	for (k = 1; k < N - 1; k++, kfloat++)
+	cube->maxSpeed = project(cube, backend, Vx, Vy, Vz, Vx0, Vy0, 4, cube->stats ? planes : nullptr, r);
+	lap(times, &FluidKernelTimes::project, started);
+
+	diffuse(cube, backend, 0, s, density, diff, dt, 4, r);
+	lap(times, &FluidKernelTimes::diffuse, started);
+	advectDye(cube, backend, dt, planes, r);
+	lap(times, &FluidKernelTimes::advect, started);
+
+	if (cube->trackActive)
 	{
-		for (j = 1; j < N - 1; j++, jfloat++)
-		{
-			for (i = 1; i < N - 1; i++, ifloat)
-			{
-				tmp1 = dtx * velocX[IX(i, j, k)];
-				tmp2 = dty * velocY[IX(i, j, k)];
-				tmp3 = dtz * velocZ[IX(i, j, k)];
-
-				x = ifloat - tmp1;
-				y = jfloat - tmp2;
-				z = kfloat - tmp3;
-
-				if (x < .5f) x = .5f;
-				if (x > Nfloat + .5f) x = Nfloat + .5f;
-				i0 = floorf(x);
-				i1 = i0 + 1.0f;
-
-				if (y < .5f) y = .5f;
-				if (y > Nfloat + .5f) y = Nfloat + .5f;
-				j0 = floorf(y);
-				j1 = j0 + 1.0f;
-
-				if (z < .5f) z = .5f;
-				if (z > Nfloat + .5f) z = Nfloat + .5f;
-				k0 = floorf(z);
-				k1 = k0 + 1.0f;
-
-				s1 = x - i0;
-				s0 = 1.0f - s1;
-				t1 = y - j0;
-				t0 = 1.0f - t1;
-				u1 = z - k0;
-				u0 = 1.0f - u1;
-
-				int i0i = i0;
-				int i1i = i1;
-				int j0i = j0;
-				int j1i = j1;
-				int k0i = k0;
-				int k1i = k1;
-
-				d[IX(i, j, k)] =
-					s0 * (t0 * (u0 * d0[IX(i0i, j0i, k0i)]
-						+ u1 * d0[IX(i0i, j0i, k1i)])
-						+ (t1 * (u0 * d0[IX(i0i, j1i, k0i)]
-							+ u1 * d0[IX(i0i, j1i, k1i)])))
-					+ s1 * (t0 * (u0 * d0[IX(i1i, j0i, k0i)]
-						+ u1 * d0[IX(i1i, j0i, k1i)])
-						+ (t1 * (u0 * d0[IX(i1i, j1i, k0i)]
-							+ u1 * d0[IX(i1i, j1i, k1i)])));
-			}
-		}
+		cube->active = measureActive(cube, r);
+		clearOutside(cube, regionDilate(r, oneCell, wholeRegion(cube)), regionDilate(cube->active, oneCell, wholeRegion(cube)));
 	}
-	set_bnd(b, d, N);
+}
+
+bool FluidCubeSetBackend(FluidCube* cube, const char* name)
+{
+	if (!name || !*name)
+	{
+		cube->backend = nullptr;
+		return true;
+	}
+	const FluidBackend* backend = FluidBackendFind(name);
+	if (!backend)
+	{
+		std::cout << "BACKEND_UNKNOWN::" << name << std::endl;
+		return false;
+	}
+	cube->backend = backend;
+	return true;
+}
+
+void FluidCubeConserveDye(FluidCube* cube, bool enabled)
+{
+	cube->conserveDye = enabled;
+	cube->dyeCorrection = 1.f;
+	cube->dyeDrift = 0.f;
+	if (!enabled)
+		return;
+
+	double total = 0.;
+	for (int k = 1; k < cube->sizeZ - 1; k++)
+		for (int j = 1; j < cube->sizeY - 1; j++)
+			for (int i = 1; i < cube->sizeX - 1; i++)
+				total += loadCell(cube, cube->density, cellIndex(cube, i, j, k));
+	cube->dyeTarget = total;
 }
@@ -1,42 +1,162 @@
 #pragma once
+#include "FluidLayout.h"
+#include "FluidStats.h"
+#include "FluidStorage.h"
+#include "FluidWorkers.h"
 
+struct FluidBackend;
+struct FluidCheckpointMapping;
+struct FluidSourceQueue;
+
+// Inclusive cell bounds per axis; empty when any min > max.
+struct FluidRegion
+{
+	int min[3];
+	int max[3];
+};
+
+// Seconds spent in each part of FluidCubeSubstep, set_bnd included, summed over every substep.
+struct FluidKernelTimes
+{
+	double diffuse;
+	double project;
+	double advect;
+};
+
+// Members default to a plain FP32 row-major cube with nothing attached, so creators only set what differs.
 struct FluidCube
 {
-	int size;
-	float dt;
-	float diff;
-	float visc;
+	// Cells per axis, walls included. Every axis spans the same unit length, so cells stretch along the shorter ones.
+	int sizeX = 0;
+	int sizeY = 0;
+	int sizeZ = 0;
+	float dt = 0.f;
+	float diff = 0.f;
+	float visc = 0.f;
+
+	float* s = nullptr;
+	float* density = nullptr;
+
+	float* Vx = nullptr;
+	float* Vy = nullptr;
+	float* Vz = nullptr;
+
+	float* Vx0 = nullptr;
+	float* Vy0 = nullptr;
+	float* Vz0 = nullptr;
+
+	// Target CFL number for substepping; 0 disables it and every step uses dt as is.
+	float cfl = 0.f;
+	int maxSubsteps = 1;
+	// Largest velocity component seen by the last projection, in grid units per time.
+	float maxSpeed = 0.f;
+
+	// When trackActive is set, every field is zero outside active (grown by one cell onto the walls), and each
+	// substep only works on active dilated by how far anything can travel in it.
+	bool trackActive = false;
+	float activeThreshold = 0.f;
+	FluidRegion active = { { 1, 1, 1 }, { 0, 0, 0 } };
+
+	// Set when the fields live in a memory-mapped checkpoint instead of separate allocations.
+	FluidCheckpointMapping* mapping = nullptr;
+	// Set for cubes from FluidCubeCreateThreaded; each worker owns a slab of z planes in every field.
+	FluidWorkers* workers = nullptr;
 
-	float* s;
-	float* density;
+	// Anything but FLUID_LAYOUT_ROW_MAJOR and FLUID_STORAGE_FP32 only comes from FluidCubeCreatePacked; read such
+	// fields through FluidCubeCopyField. storage applies to density and the velocity only, see
+	// FluidCubeFieldStorage. mortonTable holds the FluidLayoutMorton spreads, and dyeScale the steps per unit of
+	// FLUID_STORAGE_INT16 density.
+	FluidLayoutKind layout = FLUID_LAYOUT_ROW_MAJOR;
+	uint64_t* mortonTable = nullptr;
+	FluidStorageKind storage = FLUID_STORAGE_FP32;
+	float dyeScale = 1.f;
 
-	float* Vx;
-	float* Vy;
-	float* Vz;
+	// Kernels the cube steps with; nullptr follows FluidIsaActive.
+	const FluidBackend* backend = nullptr;
 
-	float* Vx0;
-	float* Vy0;
-	float* Vz0;
+	// Set by FluidCubeConserveDye. dyeTarget is the density the interior should hold, dyeCorrection the factor the
+	// next density advection scales by, and dyeDrift the relative error the last one left before correcting it.
+	bool conserveDye = false;
+	double dyeTarget = 0.;
+	float dyeCorrection = 1.f;
+	float dyeDrift = 0.f;
+
+	// When set, every substep overwrites it with the FluidStats of the fields it leaves.
+	FluidStats* stats = nullptr;
+
+	// When set, FluidCubeSubstep adds the time of each kernel to it.
+	FluidKernelTimes* kernelTimes = nullptr;
+
+	// Sources from FluidCubeQueueDensity and FluidCubeQueueVelocity waiting for the next step; created on first use.
+	FluidSourceQueue* queued = nullptr;
 
 	FluidCube() = default;
 };
 
 FluidCube* FluidCubeCreate(int size, int diffusion, int viscosity, float dt);
 
+FluidCube* FluidCubeCreateBox(int sizeX, int sizeY, int sizeZ, float diffusion, float viscosity, float dt);
+
+/*
+Splits every kernel across threads workers (0 uses every CPU), each owning one slab of z planes. The fields are
+zeroed by the worker that owns each slab, so with pinning the pages end up on that worker's NUMA node. lin_solve
+sweeps the slabs as a wavefront in the serial order, sums are gathered per plane and added in plane order, and
+maxima do not depend on the order they are taken in, so every field comes out bitwise the same for any threads.
+*/
+FluidCube* FluidCubeCreateThreaded(int sizeX, int sizeY, int sizeZ, float diffusion, float viscosity, float dt, int threads, FluidPlacement placement);
+
+/*
+Stores every field in layout, and density and the velocity in storage; the fields are zeroed. FLUID_STORAGE_INT16
+represents density in [-dyeRange, dyeRange]. Such cubes run the same arithmetic as FluidCubeCreateBox, rounding
+the values they store, but do not support checkpoints, active region tracking or threads.
+*/
+FluidCube* FluidCubeCreatePacked(int sizeX, int sizeY, int sizeZ, float diffusion, float viscosity, float dt, FluidLayoutKind layout, FluidStorageKind storage, float dyeRange);
+
+FluidCube* FluidCubeCreateLayout(int sizeX, int sizeY, int sizeZ, float diffusion, float viscosity, float dt, FluidLayoutKind layout);
+
+// The format one of cube's fields is kept in: cube->storage for density, Vx, Vy and Vz, except that INT16 cubes keep
+// the velocity in FP16, and FP32 for the scratch fields s, Vx0, Vy0 and Vz0.
+FluidStorageKind FluidCubeFieldStorage(const FluidCube* cube, const float* field);
+
+// Copies one of cube's fields into rowMajor as floats, which holds sizeX * sizeY * sizeZ cells, whatever the cube's
+// layout and storage.
+void FluidCubeCopyField(const FluidCube* cube, const float* field, float* rowMajor);
+
 void FluidCubeFree(FluidCube* cube);
 
 void FluidCubeAddDensity(FluidCube* cube, int x, int y, int z, float amount);
 
 void FluidCubeAddVelocity(FluidCube* cube, int x, int y, int z, float amountX, float amountY, float amountZ);
 
-void FluidCubeStep(FluidCube* cube);
+/*
+Like FluidCubeAddDensity and FluidCubeAddVelocity, but safe to call from any thread while the cube is not stepping.
+The sources are added at the start of the next step sorted by order, then cell, then amount, so emitters running
+on several threads give the same result whichever call arrives first. Give each emitter its own order to fix
+which of them adds to a shared cell first.
+*/
+void FluidCubeQueueDensity(FluidCube* cube, int order, int x, int y, int z, float amount);
 
-static void set_bnd(int b, float* x, int N);
+void FluidCubeQueueVelocity(FluidCube* cube, int order, int x, int y, int z, float amountX, float amountY, float amountZ);
 
-static void lin_solve(int b, float* x, float* x0, float a, float c, int iter, int N);
+void FluidCubeSetCFL(FluidCube* cube, float cfl, int maxSubsteps);
+
+/*
+Restricts the kernels to a box around the cells whose density or velocity magnitude exceeds threshold. Cells
+that fall out of the box are set to zero, so threshold bounds the error. Scans the whole cube once to find the
+starting box; a negative threshold turns tracking off again.
+*/
+void FluidCubeTrackActiveRegion(FluidCube* cube, float threshold);
+
+void FluidCubeStep(FluidCube* cube);
 
-static void diffuse(int b, float* x, float* x0, float diff, float dt, int iter, int N);
+int FluidCubeAdvance(FluidCube* cube, float duration);
 
-static void project(float* velocX, float* velocY, float* velocZ, float* p, float* div, int iter, int N);
+/*
+Semi-Lagrangian advection gains or loses dye. With enabled, the density advection sums the interior as it writes
+it, and the next one scales every cell by the ratio of the target to that sum, so the error never builds up
+beyond one substep's worth. The target starts as the current total and follows FluidCubeAddDensity.
+*/
+void FluidCubeConserveDye(FluidCube* cube, bool enabled);
 
-static void advect(int b, float* d, float* d0, float* velocX, float* velocY, float* velocZ, float dt, int N);
+// Steps cube with the registered FluidBackend of that name from now on; nullptr or "" goes back to the default.
+bool FluidCubeSetBackend(FluidCube* cube, const char* name);
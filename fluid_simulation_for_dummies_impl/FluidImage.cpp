@@ -0,0 +1,289 @@
+#include "FluidImage.h"
+#include "FluidCube.h"
+#include "FluidSquare.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+// Rows are only split across threads once each thread gets at least this many cells to map.
+static const size_t minCellsPerThread = 1 << 16;
+static const int mapChunk = 256;
+
+template <class RowFunction>
+static void parallelRows(int rows, size_t cellsPerRow, RowFunction rowFunction)
+{
+	size_t threads = std::thread::hardware_concurrency();
+	size_t maxThreads = rows * cellsPerRow / minCellsPerThread;
+	threads = threads < maxThreads ? threads : maxThreads;
+	threads = threads < (size_t)rows ? threads : rows;
+	if (threads <= 1)
+	{
+		rowFunction(0, rows);
+		return;
+	}
+
+	std::vector<std::thread> pool;
+	for (size_t t = 0; t < threads; t++)
+	{
+		int begin = (int)(rows * t / threads);
+		int end = (int)(rows * (t + 1) / threads);
+		pool.emplace_back(rowFunction, begin, end);
+	}
+	for (std::thread& thread : pool)
+		thread.join();
+}
+
+/*
+Values are turned into lookup indices in a separate pass over a small chunk so the compiler can
+vectorize the scale/clamp/convert loop; the gather from the table follows.
+*/
+static void mapRow(const float* field, int count, float minValue, float scale, const FluidColormap& colormap, unsigned char* rgb)
+{
+	unsigned char index[mapChunk];
+	for (int begin = 0; begin < count; begin += mapChunk)
+	{
+		int length = count - begin < mapChunk ? count - begin : mapChunk;
+		for (int i = 0; i < length; i++)
+		{
+			float t = (field[begin + i] - minValue) * scale;
+			t = t > 0.f ? t : 0.f;
+			t = t < 255.f ? t : 255.f;
+			index[i] = (unsigned char)t;
+		}
+		for (int i = 0; i < length; i++)
+			memcpy(rgb + 3 * (begin + i), colormap.rgb[index[i]], 3);
+	}
+}
+
+static float mapScale(float minValue, float maxValue)
+{
+	return maxValue > minValue ? 255.f / (maxValue - minValue) : 0.f;
+}
+
+void FluidColormapBuild(FluidColormap& colormap, FluidColormapKind kind)
+{
+	// Inferno sampled at nine evenly spaced points and interpolated in between.
+	static const float inferno[9][3] = {
+		{ 0.001f, 0.000f, 0.014f }, { 0.122f, 0.047f, 0.282f }, { 0.335f, 0.060f, 0.430f },
+		{ 0.530f, 0.134f, 0.416f }, { 0.729f, 0.212f, 0.333f }, { 0.894f, 0.351f, 0.196f },
+		{ 0.978f, 0.557f, 0.035f }, { 0.976f, 0.789f, 0.197f }, { 0.988f, 0.998f, 0.645f }
+	};
+
+	for (int i = 0; i < 256; i++)
+	{
+		if (kind == FLUID_COLORMAP_GRAY)
+		{
+			colormap.rgb[i][0] = colormap.rgb[i][1] = colormap.rgb[i][2] = (unsigned char)i;
+			continue;
+		}
+
+		float position = i / 255.f * 8.f;
+		int segment = position >= 8.f ? 7 : (int)position;
+		float t = position - segment;
+		for (int c = 0; c < 3; c++)
+			colormap.rgb[i][c] = (unsigned char)(255.f * (inferno[segment][c] * (1.f - t) + inferno[segment + 1][c] * t) + .5f);
+	}
+}
+
+void FluidImageFromField(FluidImage& image, const float* field, int width, int height, float minValue, float maxValue, const FluidColormap& colormap)
+{
+	image.width = width;
+	image.height = height;
+	image.rgb.resize((size_t)width * height * 3);
+
+	float scale = mapScale(minValue, maxValue);
+	unsigned char* rgb = image.rgb.data();
+	parallelRows(height, width, [=, &colormap](int begin, int end)
+	{
+		for (int y = begin; y < end; y++)
+			mapRow(field + (size_t)y * width, width, minValue, scale, colormap, rgb + (size_t)y * width * 3);
+	});
+}
+
+void FluidImageFromSquare(FluidImage& image, const FluidSquare* square, float minValue, float maxValue, const FluidColormap& colormap)
+{
+	FluidImageFromField(image, square->density, square->sizeX, square->sizeY, minValue, maxValue, colormap);
+}
+
+// The density as row-major floats: the field itself, or a copy in converted for other layouts and storages.
+static const float* cubeDensity(const FluidCube* cube, std::vector<float>& converted)
+{
+	if (cube->layout == FLUID_LAYOUT_ROW_MAJOR && cube->storage == FLUID_STORAGE_FP32)
+		return cube->density;
+	converted.resize((size_t)cube->sizeX * cube->sizeY * cube->sizeZ);
+	FluidCubeCopyField(cube, cube->density, converted.data());
+	return converted.data();
+}
+
+void FluidImageFromCubeSlice(FluidImage& image, const FluidCube* cube, int z, float minValue, float maxValue, const FluidColormap& colormap)
+{
+	size_t sliceCells = (size_t)cube->sizeX * cube->sizeY;
+	std::vector<float> converted;
+	FluidImageFromField(image, cubeDensity(cube, converted) + z * sliceCells, cube->sizeX, cube->sizeY, minValue, maxValue, colormap);
+}
+
+void FluidImageFromCubeProjection(FluidImage& image, const FluidCube* cube, float minValue, float maxValue, const FluidColormap& colormap)
+{
+	int Nx = cube->sizeX, Ny = cube->sizeY, Nz = cube->sizeZ;
+	std::vector<float> projection((size_t)Nx * Ny), converted;
+	const float* density = cubeDensity(cube, converted);
+	float* maxima = projection.data();
+
+	// Maximum intensity projection along z; each row keeps its running maxima in cache.
+	parallelRows(Ny, (size_t)Nx * Nz, [=](int begin, int end)
+	{
+		for (int y = begin; y < end; y++)
+		{
+			float* row = maxima + (size_t)y * Nx;
+			memcpy(row, density + (size_t)y * Nx, Nx * sizeof(float));
+			for (int z = 1; z < Nz; z++)
+			{
+				const float* source = density + (size_t)y * Nx + (size_t)z * Nx * Ny;
+				for (int x = 0; x < Nx; x++)
+					row[x] = source[x] > row[x] ? source[x] : row[x];
+			}
+		}
+	});
+
+	FluidImageFromField(image, maxima, Nx, Ny, minValue, maxValue, colormap);
+}
+
+bool FluidImageWritePPM(const FluidImage& image, const char* filePath)
+{
+	FILE* file = fopen(filePath, "wb");
+	if (!file)
+	{
+		std::cout << "FILE_OPEN_FAILED::" << filePath << std::endl;
+		return false;
+	}
+
+	// Images are stored top row first while y grows upwards in the simulation, so flip rows.
+	bool ok = fprintf(file, "P6\n%d %d\n255\n", image.width, image.height) > 0;
+	size_t rowBytes = (size_t)image.width * 3;
+	for (int y = image.height - 1; ok && y >= 0; y--)
+		ok = fwrite(image.rgb.data() + y * rowBytes, 1, rowBytes, file) == rowBytes;
+	return fclose(file) == 0 && ok;
+}
+
+static uint32_t crcTable[256];
+
+static void buildCrcTable()
+{
+	for (uint32_t n = 0; n < 256; n++)
+	{
+		uint32_t c = n;
+		for (int k = 0; k < 8; k++)
+			c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+		crcTable[n] = c;
+	}
+}
+
+static uint32_t crc32(uint32_t crc, const unsigned char* data, size_t length)
+{
+	crc = ~crc;
+	for (size_t i = 0; i < length; i++)
+		crc = crcTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static uint32_t adler32(const unsigned char* data, size_t length)
+{
+	uint32_t a = 1, b = 0;
+	while (length > 0)
+	{
+		// 5552 is the largest block whose sums cannot overflow before the modulo.
+		size_t block = length < 5552 ? length : 5552;
+		length -= block;
+		while (block--)
+		{
+			a += *data++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+static void putBigEndian(std::vector<unsigned char>& out, uint32_t value)
+{
+	out.push_back((unsigned char)(value >> 24));
+	out.push_back((unsigned char)(value >> 16));
+	out.push_back((unsigned char)(value >> 8));
+	out.push_back((unsigned char)value);
+}
+
+static bool writeChunk(FILE* file, const char* type, const std::vector<unsigned char>& data)
+{
+	std::vector<unsigned char> chunk;
+	putBigEndian(chunk, (uint32_t)data.size());
+	chunk.insert(chunk.end(), type, type + 4);
+	chunk.insert(chunk.end(), data.begin(), data.end());
+	putBigEndian(chunk, crc32(0, chunk.data() + 4, chunk.size() - 4));
+	return fwrite(chunk.data(), 1, chunk.size(), file) == chunk.size();
+}
+
+/*
+The pixel data is wrapped in stored (uncompressed) deflate blocks: writing costs little more than a
+memcpy and needs no zlib, which keeps a frame per step affordable. Use the recorder for compact output.
+*/
+bool FluidImageWritePNG(const FluidImage& image, const char* filePath)
+{
+	static std::once_flag crcOnce;
+	std::call_once(crcOnce, buildCrcTable);
+
+	FILE* file = fopen(filePath, "wb");
+	if (!file)
+	{
+		std::cout << "FILE_OPEN_FAILED::" << filePath << std::endl;
+		return false;
+	}
+
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	bool ok = fwrite(signature, 1, sizeof(signature), file) == sizeof(signature);
+
+	std::vector<unsigned char> header;
+	putBigEndian(header, image.width);
+	putBigEndian(header, image.height);
+	header.push_back(8);
+	header.push_back(2);
+	header.push_back(0);
+	header.push_back(0);
+	header.push_back(0);
+	ok = ok && writeChunk(file, "IHDR", header);
+
+	size_t rowBytes = (size_t)image.width * 3;
+	std::vector<unsigned char> raw;
+	raw.reserve((rowBytes + 1) * image.height);
+	for (int y = image.height - 1; y >= 0; y--)
+	{
+		raw.push_back(0);
+		raw.insert(raw.end(), image.rgb.begin() + y * rowBytes, image.rgb.begin() + (y + 1) * rowBytes);
+	}
+
+	std::vector<unsigned char> data;
+	data.reserve(raw.size() + raw.size() / 65535 * 5 + 11);
+	data.push_back(0x78);
+	data.push_back(0x01);
+	for (size_t offset = 0; offset < raw.size() || offset == 0; )
+	{
+		size_t length = raw.size() - offset < 65535 ? raw.size() - offset : 65535;
+		data.push_back(offset + length == raw.size() ? 1 : 0);
+		data.push_back((unsigned char)length);
+		data.push_back((unsigned char)(length >> 8));
+		data.push_back((unsigned char)~length);
+		data.push_back((unsigned char)(~length >> 8));
+		data.insert(data.end(), raw.begin() + offset, raw.begin() + offset + length);
+		offset += length;
+		if (length == 0)
+			break;
+	}
+	putBigEndian(data, adler32(raw.data(), raw.size()));
+	ok = ok && writeChunk(file, "IDAT", data);
+	ok = ok && writeChunk(file, "IEND", std::vector<unsigned char>());
+
+	return fclose(file) == 0 && ok;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <vector>
+
+struct FluidCube;
+struct FluidSquare;
+
+enum FluidColormapKind
+{
+	FLUID_COLORMAP_GRAY,
+	FLUID_COLORMAP_INFERNO
+};
+
+struct FluidColormap
+{
+	unsigned char rgb[256][3];
+};
+
+struct FluidImage
+{
+	int width = 0;
+	int height = 0;
+	std::vector<unsigned char> rgb;
+};
+
+void FluidColormapBuild(FluidColormap& colormap, FluidColormapKind kind);
+
+void FluidImageFromField(FluidImage& image, const float* field, int width, int height, float minValue, float maxValue, const FluidColormap& colormap);
+
+void FluidImageFromSquare(FluidImage& image, const FluidSquare* square, float minValue, float maxValue, const FluidColormap& colormap);
+
+void FluidImageFromCubeSlice(FluidImage& image, const FluidCube* cube, int z, float minValue, float maxValue, const FluidColormap& colormap);
+
+void FluidImageFromCubeProjection(FluidImage& image, const FluidCube* cube, float minValue, float maxValue, const FluidColormap& colormap);
+
+bool FluidImageWritePPM(const FluidImage& image, const char* filePath);
+
+bool FluidImageWritePNG(const FluidImage& image, const char* filePath);
@@ -0,0 +1,152 @@
+#include "FluidIsa.h"
+#include "FluidBackend.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define FLUID_ISA_X86 1
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#define FLUID_ISA_X86 1
+#endif
+
+// -1 until the first FluidIsaActive call.
+static std::atomic<int> active(-1);
+
+#ifdef FLUID_ISA_X86
+static void cpuid(int leaf, int subleaf, uint32_t registers[4])
+{
+#ifdef _MSC_VER
+	int values[4];
+	__cpuidex(values, leaf, subleaf);
+	for (int i = 0; i < 4; i++)
+		registers[i] = (uint32_t)values[i];
+#else
+	__cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+// Register state the operating system saves on a context switch; wide registers are only usable when it does.
+static uint64_t enabledState()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t low, high;
+	__asm__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+	return ((uint64_t)high << 32) | low;
+#endif
+}
+#endif
+
+FluidIsa FluidIsaDetect()
+{
+#ifdef FLUID_ISA_X86
+	uint32_t basic[4], extended[4] = {};
+	cpuid(0, 0, basic);
+	uint32_t maxLeaf = basic[0];
+	cpuid(1, 0, basic);
+	if (maxLeaf >= 7)
+		cpuid(7, 0, extended);
+
+	bool sse42 = (basic[2] >> 20) & 1;
+	bool osxsave = (basic[2] >> 27) & 1;
+	bool avx = (basic[2] >> 28) & 1;
+	bool f16c = (basic[2] >> 29) & 1;
+	uint64_t state = osxsave ? enabledState() : 0;
+	// SSE and AVX halves of the vector registers, then the AVX-512 masks and upper halves as well.
+	bool ymm = (state & 0x6) == 0x6;
+	bool zmm = (state & 0xE6) == 0xE6;
+	bool avx2 = avx && f16c && ymm && ((extended[1] >> 5) & 1);
+	bool avx512 = avx2 && zmm && ((extended[1] >> 16) & 1);
+
+	if (avx512)
+		return FLUID_ISA_AVX512;
+	if (avx2)
+		return FLUID_ISA_AVX2;
+	if (sse42)
+		return FLUID_ISA_SSE42;
+#endif
+	return FLUID_ISA_BASELINE;
+}
+
+FluidIsa FluidIsaActive()
+{
+	int isa = active.load(std::memory_order_relaxed);
+	if (isa >= 0)
+		return (FluidIsa)isa;
+
+	FluidIsa chosen = FluidIsaDetect();
+	const char* name = getenv("FLUID_ISA");
+	FluidIsa requested;
+	if (name && *name)
+	{
+		if (!FluidIsaParse(name, requested))
+			std::cout << "ISA_UNKNOWN::" << name << std::endl;
+		else if (requested > chosen)
+			std::cout << "ISA_UNSUPPORTED::" << name << std::endl;
+		else
+			chosen = requested;
+	}
+	// Racing first calls all arrive at the same answer.
+	active.store(chosen, std::memory_order_relaxed);
+	return chosen;
+}
+
+bool FluidIsaSelect(FluidIsa isa)
+{
+	if (isa > FluidIsaDetect())
+	{
+		std::cout << "ISA_UNSUPPORTED::" << FluidIsaName(isa) << std::endl;
+		return false;
+	}
+	active.store(isa, std::memory_order_relaxed);
+	return true;
+}
+
+bool FluidIsaParse(const char* name, FluidIsa& isa)
+{
+	for (FluidIsa candidate : { FLUID_ISA_BASELINE, FLUID_ISA_SSE42, FLUID_ISA_AVX2, FLUID_ISA_AVX512 })
+	{
+		if (strcmp(name, FluidIsaName(candidate)) == 0)
+		{
+			isa = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* FluidIsaName(FluidIsa isa)
+{
+	switch (isa)
+	{
+	case FLUID_ISA_SSE42:
+		return "sse4.2";
+	case FLUID_ISA_AVX2:
+		return "avx2";
+	case FLUID_ISA_AVX512:
+		return "avx512";
+	default:
+		return "baseline";
+	}
+}
+
+const FluidBackend* FluidIsaBackend(FluidIsa isa)
+{
+	switch (isa)
+	{
+	case FLUID_ISA_SSE42:
+		return &FluidBackendSse42;
+	case FLUID_ISA_AVX2:
+		return &FluidBackendAvx2;
+	case FLUID_ISA_AVX512:
+		return &FluidBackendAvx512;
+	default:
+		return &FluidBackendReference;
+	}
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+struct FluidBackend;
+
+// Instruction sets the built-in FluidBackend kernels are compiled for, each a superset of the one before.
+enum FluidIsa
+{
+	// Whatever the build targets by default; the only variant on processors other than x86.
+	FLUID_ISA_BASELINE,
+	FLUID_ISA_SSE42,
+	// With F16C, which converts the rows of FP16 fields; every processor with AVX2 has it.
+	FLUID_ISA_AVX2,
+	FLUID_ISA_AVX512
+};
+
+// The widest instruction set both the processor and the operating system support, read with cpuid.
+FluidIsa FluidIsaDetect();
+
+/*
+The variant every FluidCube without a backend of its own steps with. The first call picks the one named by the
+FLUID_ISA environment variable (baseline, sse4.2, avx2 or avx512), or FluidIsaDetect when it is unset or names
+one this machine cannot run.
+*/
+FluidIsa FluidIsaActive();
+
+// Switches every cube to isa from the next substep on; fails if the machine cannot run it.
+bool FluidIsaSelect(FluidIsa isa);
+
+bool FluidIsaParse(const char* name, FluidIsa& isa);
+
+const char* FluidIsaName(FluidIsa isa);
+
+// The built-in backend compiled for isa.
+const FluidBackend* FluidIsaBackend(FluidIsa isa);
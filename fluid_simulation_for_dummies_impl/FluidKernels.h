@@ -0,0 +1,1061 @@
+#pragma once
+#include "FluidBackend.h"
+#include "FluidCube.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/*
+The built-in FluidBackend kernels. Every FluidKernels*.cpp includes this once and compiles it for its own
+instruction set; everything here is static, so each of them gets its own copies and none can be merged with
+another's at link time. Include it nowhere else.
+
+Row-major cubes run the row kernels, which see each row of a field as a float array: the cells themselves for
+FP32 fields, or a copy converted in one pass and written back in another for narrow ones. Other layouts address
+every cell through the indexer their kernels are instantiated with.
+*/
+#define IX(x,y,z) at(x, y, z)
+
+template <typename Layout, typename Field>
+static void set_bnd(int b, Field x, int Nx, int Ny, int Nz, const FluidRegion& r, const Layout& at);
+
+template <typename Layout, typename Field>
+static void lin_solve(Field x, Field x0, float ax, float ay, float az, float c, int iter, int Nz, const FluidRegion& r, FluidWorkers* workers, const Layout& at);
+
+template <typename Layout, typename Field>
+static void divergence(Field velocX, Field velocY, Field velocZ, Field p, Field div, int Nx, int Ny, int Nz, const FluidRegion& r, FluidWorkers* workers, const Layout& at);
+
+template <bool Stats, typename Layout, typename Field>
+static float gradient(Field velocX, Field velocY, Field velocZ, Field p, FluidPlaneStats* planes, int Nx, int Ny, int Nz, const FluidRegion& r, FluidWorkers* workers, const Layout& at);
+
+template <bool Stats, typename Layout, typename Field>
+static void advect(Field d, Field d0, Field velocX, Field velocY, Field velocZ, float dt, float scale, FluidPlaneStats* planes, int Nx, int Ny, int Nz, const FluidRegion& r, FluidWorkers* workers, const Layout& at);
+
+// A field of a row-major cube as the row kernels see it; scale is the steps per unit of FLUID_STORAGE_INT16.
+struct RowField
+{
+	float* cells;
+	FluidStorageKind storage;
+	float scale;
+};
+
+static void lin_solve_rows(RowField x, RowField x0, float ax, float ay, float az, float c, int iter, int Nx, int Ny, int Nz, const FluidRegion& r, FluidWorkers* workers);
+
+static void divergence_rows(RowField velocX, RowField velocY, RowField velocZ, RowField p, RowField div, int Nx, int Ny, int Nz, const FluidRegion& r, FluidWorkers* workers);
+
+template <bool Stats>
+static float gradient_rows(RowField velocX, RowField velocY, RowField velocZ, RowField p, FluidPlaneStats* planes, int Nx, int Ny, int Nz, const FluidRegion& r, FluidWorkers* workers);
+
+template <bool Stats, typename Source>
+static void advect_rows(RowField d, Source d0, RowField velocX, RowField velocY, RowField velocZ, float dt, float scale, FluidPlaneStats* planes, int Nx, int Ny, int Nz, const FluidRegion& r, FluidWorkers* workers);
+
+static RowField rowField(const FluidCube* cube, float* field)
+{
+	return RowField{ field, FluidCubeFieldStorage(cube, field), cube->dyeScale };
+}
+
+static FluidStoredField storedField(const FluidCube* cube, float* field)
+{
+	return FluidStoredField{ field, FluidCubeFieldStorage(cube, field), cube->dyeScale };
+}
+
+/*
+Calls kernel(at, field) with the indexer for cube's layout and a function that turns a field pointer of cube into
+what the kernels index: the pointer itself for FP32 cubes, otherwise a FluidStoredField.
+*/
+template <typename Layout, typename Kernel>
+static void withStorage(const FluidCube* cube, const Layout& at, Kernel kernel)
+{
+	if (cube->storage == FLUID_STORAGE_FP32)
+		kernel(at, [](float* field) { return field; });
+	else
+		kernel(at, [cube](float* field) { return storedField(cube, field); });
+}
+
+template <typename Kernel>
+static void withFields(const FluidCube* cube, Kernel kernel)
+{
+	switch (cube->layout)
+	{
+	case FLUID_LAYOUT_TILED:
+		withStorage(cube, FluidLayoutTiled(cube->sizeX, cube->sizeY), kernel);
+		break;
+	case FLUID_LAYOUT_MORTON:
+		withStorage(cube, FluidLayoutMorton(cube->mortonTable, cube->sizeX, cube->sizeY), kernel);
+		break;
+	default:
+		withStorage(cube, FluidLayoutRowMajor(cube->sizeX, cube->sizeY), kernel);
+		break;
+	}
+}
+
+static void kernelsBoundary(FluidCube* cube, int b, float* x, const FluidRegion& r)
+{
+	withFields(cube, [&](const auto& at, auto field)
+	{
+		set_bnd(b, field(x), cube->sizeX, cube->sizeY, cube->sizeZ, r, at);
+	});
+}
+
+static void kernelsLinearSolve(FluidCube* cube, float* x, float* x0, float ax, float ay, float az, float c, int iter, const FluidRegion& r)
+{
+	if (cube->layout == FLUID_LAYOUT_ROW_MAJOR)
+	{
+		lin_solve_rows(rowField(cube, x), rowField(cube, x0), ax, ay, az, c, iter, cube->sizeX, cube->sizeY, cube->sizeZ, r, cube->workers);
+		return;
+	}
+	withFields(cube, [&](const auto& at, auto field)
+	{
+		lin_solve(field(x), field(x0), ax, ay, az, c, iter, cube->sizeZ, r, cube->workers, at);
+	});
+}
+
+// The source is gathered from anywhere in the field, so a narrow one is read a cell at a time.
+template <bool Stats>
+static void kernelsAdvectRows(FluidCube* cube, float* d, float* d0, float* velocX, float* velocY, float* velocZ, float dt, float scale, FluidPlaneStats* planes, const FluidRegion& r)
+{
+	if (FluidCubeFieldStorage(cube, d0) == FLUID_STORAGE_FP32)
+		advect_rows<Stats>(rowField(cube, d), d0, rowField(cube, velocX), rowField(cube, velocY), rowField(cube, velocZ), dt, scale, planes, cube->sizeX, cube->sizeY, cube->sizeZ, r, cube->workers);
+	else
+		advect_rows<Stats>(rowField(cube, d), storedField(cube, d0), rowField(cube, velocX), rowField(cube, velocY), rowField(cube, velocZ), dt, scale, planes, cube->sizeX, cube->sizeY, cube->sizeZ, r, cube->workers);
+}
+
+static void kernelsAdvect(FluidCube* cube, float* d, float* d0, float* velocX, float* velocY, float* velocZ, float dt, float scale, FluidPlaneStats* planes, const FluidRegion& r)
+{
+	if (cube->layout == FLUID_LAYOUT_ROW_MAJOR)
+	{
+		if (planes)
+			kernelsAdvectRows<true>(cube, d, d0, velocX, velocY, velocZ, dt, scale, planes, r);
+		else
+			kernelsAdvectRows<false>(cube, d, d0, velocX, velocY, velocZ, dt, scale, planes, r);
+		return;
+	}
+	withFields(cube, [&](const auto& at, auto field)
+	{
+		if (planes)
+			advect<true>(field(d), field(d0), field(velocX), field(velocY), field(velocZ), dt, scale, planes, cube->sizeX, cube->sizeY, cube->sizeZ, r, cube->workers, at);
+		else
+			advect<false>(field(d), field(d0), field(velocX), field(velocY), field(velocZ), dt, scale, planes, cube->sizeX, cube->sizeY, cube->sizeZ, r, cube->workers, at);
+	});
+}
+
+static void kernelsDivergence(FluidCube* cube, float* velocX, float* velocY, float* velocZ, float* p, float* div, const FluidRegion& r)
+{
+	if (cube->layout == FLUID_LAYOUT_ROW_MAJOR)
+	{
+		divergence_rows(rowField(cube, velocX), rowField(cube, velocY), rowField(cube, velocZ), rowField(cube, p), rowField(cube, div), cube->sizeX, cube->sizeY, cube->sizeZ, r, cube->workers);
+		return;
+	}
+	withFields(cube, [&](const auto& at, auto field)
+	{
+		divergence(field(velocX), field(velocY), field(velocZ), field(p), field(div), cube->sizeX, cube->sizeY, cube->sizeZ, r, cube->workers, at);
+	});
+}
+
+static float kernelsGradient(FluidCube* cube, float* velocX, float* velocY, float* velocZ, float* p, FluidPlaneStats* planes, const FluidRegion& r)
+{
+	if (cube->layout == FLUID_LAYOUT_ROW_MAJOR)
+	{
+		if (planes)
+			return gradient_rows<true>(rowField(cube, velocX), rowField(cube, velocY), rowField(cube, velocZ), rowField(cube, p), planes, cube->sizeX, cube->sizeY, cube->sizeZ, r, cube->workers);
+		return gradient_rows<false>(rowField(cube, velocX), rowField(cube, velocY), rowField(cube, velocZ), rowField(cube, p), planes, cube->sizeX, cube->sizeY, cube->sizeZ, r, cube->workers);
+	}
+	float maxSpeed = 0.f;
+	withFields(cube, [&](const auto& at, auto field)
+	{
+		if (planes)
+			maxSpeed = gradient<true>(field(velocX), field(velocY), field(velocZ), field(p), planes, cube->sizeX, cube->sizeY, cube->sizeZ, r, cube->workers, at);
+		else
+			maxSpeed = gradient<false>(field(velocX), field(velocY), field(velocZ), field(p), planes, cube->sizeX, cube->sizeY, cube->sizeZ, r, cube->workers, at);
+	});
+	return maxSpeed;
+}
+
+/*
+Only the parts of the walls next to r are touched; with r covering the interior this is the full boundary.
+The corners are cheap enough to always average.
+*/
+template <typename Layout, typename Field>
+static void set_bnd(int b, Field x, int Nx, int Ny, int Nz, const FluidRegion& r, const Layout& at)
+{
+	for (int j = r.min[1]; j <= r.max[1]; j++)
+	{
+		for (int i = r.min[0]; i <= r.max[0]; i++)
+		{
+			if (r.min[2] == 1) x[IX(i, j, 0)] = b == 3 ? -x[IX(i, j, 1)] : x[IX(i, j, 1)];
+			if (r.max[2] == Nz - 2) x[IX(i, j, Nz - 1)] = b == 3 ? -x[IX(i, j, Nz - 2)] : x[IX(i, j, Nz - 2)];
+		}
+	}
+	for (int k = r.min[2]; k <= r.max[2]; k++)
+	{
+		for (int i = r.min[0]; i <= r.max[0]; i++)
+		{
+			if (r.min[1] == 1) x[IX(i, 0, k)] = b == 2 ? -x[IX(i, 1, k)] : x[IX(i, 1, k)];
+			if (r.max[1] == Ny - 2) x[IX(i, Ny - 1, k)] = b == 2 ? -x[IX(i, Ny - 2, k)] : x[IX(i, Ny - 2, k)];
+		}
+	}
+	for (int k = r.min[2]; k <= r.max[2]; k++)
+	{
+		for (int j = r.min[1]; j <= r.max[1]; j++)
+		{
+			if (r.min[0] == 1) x[IX(0, j, k)] = b == 1 ? -x[IX(1, j, k)] : x[IX(1, j, k)];
+			if (r.max[0] == Nx - 2) x[IX(Nx - 1, j, k)] = b == 1 ? -x[IX(Nx - 2, j, k)] : x[IX(Nx - 2, j, k)];
+		}
+	}
+
+	x[IX(0, 0, 0)] = .33f * (x[IX(1, 0, 0)]
+		+ x[IX(0, 1, 0)]
+		+ x[IX(0, 0, 1)]);
+	x[IX(0, Ny - 1, 0)] = .33f * (x[IX(1, Ny - 1, 0)]
+		+ x[IX(0, Ny - 2, 0)]
+		+ x[IX(0, Ny - 1, 1)]);
+	x[IX(0, 0, Nz - 1)] = .33f * (x[IX(1, 0, Nz - 1)]
+		+ x[IX(0, 1, Nz - 1)]
+		+ x[IX(0, 0, Nz - 2)]);
+	x[IX(0, Ny - 1, Nz - 1)] = .33f * (x[IX(1, Ny - 1, Nz - 1)]
+		+ x[IX(0, Ny - 2, Nz - 1)]
+		+ x[IX(0, Ny - 1, Nz - 2)]);
+	x[IX(Nx - 1, 0, 0)] = .33f * (x[IX(Nx - 2, 0, 0)]
+		+ x[IX(Nx - 1, 1, 0)]
+		+ x[IX(Nx - 1, 0, 1)]);
+	x[IX(Nx - 1, Ny - 1, 0)] = .33f * (x[IX(Nx - 2, Ny - 1, 0)]
+		+ x[IX(Nx - 1, Ny - 2, 0)]
+		+ x[IX(Nx - 1, Ny - 1, 1)]);
+	x[IX(Nx - 1, 0, Nz - 1)] = .33f * (x[IX(Nx - 2, 0, Nz - 1)]
+		+ x[IX(Nx - 1, 1, Nz - 1)]
+		+ x[IX(Nx - 1, 0, Nz - 2)]);
+	x[IX(Nx - 1, Ny - 1, Nz - 1)] = .33f * (x[IX(Nx - 2, Ny - 1, Nz - 1)]
+		+ x[IX(Nx - 1, Ny - 2, Nz - 1)]
+		+ x[IX(Nx - 1, Ny - 1, Nz - 2)]);
+}
+
+// Calls planes(worker, kBegin, kEnd) for the z planes of r, each worker taking the part of its own slab inside r.
+template <typename Planes>
+static void forPlanes(FluidWorkers* workers, int Nz, const FluidRegion& r, Planes planes)
+{
+	if (!workers)
+	{
+		planes(0, r.min[2], r.max[2] + 1);
+		return;
+	}
+	FluidWorkersRun(workers, Nz, [&](int worker, int begin, int end)
+	{
+		begin = std::max(begin, r.min[2]);
+		end = std::min(end, r.max[2] + 1);
+		if (begin < end)
+			planes(worker, begin, end);
+	});
+}
+
+/*
+ax, ay and az weight the neighbours along each axis, which differ once the cells are not cubes.
+
+Threaded cubes keep the exact Gauss-Seidel order by sweeping rows on diagonals of (j, z): a row only waits for
+the rows below and behind it, which lie on the previous diagonal, so all rows of one diagonal can be updated at
+once. Sweep k runs two diagonals behind sweep k - 1, so the sweeps overlap and each only needs one barrier per
+diagonal. Every cell sees the same neighbour values as in the serial loop, whatever the number of workers.
+*/
+template <typename Layout, typename Field>
+static void lin_solve(Field x, Field x0, float ax, float ay, float az, float c, int iter, int Nz, const FluidRegion& r, FluidWorkers* workers, const Layout& at)
+{
+	float cRecip = 1.0f / c;
+	auto row = [=](int j, int m)
+	{
+		for (int i = r.min[0]; i <= r.max[0]; i++)
+		{
+			x[IX(i, j, m)] = (x0[IX(i, j, m)]
+				+ ax * (x[IX(i + 1, j, m)] + x[IX(i - 1, j, m)])
+				+ ay * (x[IX(i, j + 1, m)] + x[IX(i, j - 1, m)])
+				+ az * (x[IX(i, j, m + 1)] + x[IX(i, j, m - 1)])
+				) * cRecip;
+		}
+	};
+
+	if (!workers)
+	{
+		for (int k = 0; k < iter; k++)
+			for (int m = r.min[2]; m <= r.max[2]; m++)
+				for (int j = r.min[1]; j <= r.max[1]; j++)
+					row(j, m);
+	}
+	else
+	{
+		int first = r.min[1] + r.min[2], last = r.max[1] + r.max[2];
+		// Workers with no planes in r still have to meet every barrier.
+		FluidWorkersRun(workers, Nz, [&](int, int kBegin, int kEnd)
+		{
+			kBegin = std::max(kBegin, r.min[2]);
+			kEnd = std::min(kEnd, r.max[2] + 1);
+			for (int step = first; step <= last + 2 * (iter - 1); step++)
+			{
+				for (int k = 0; k < iter; k++)
+				{
+					int diagonal = step - 2 * k;
+					if (diagonal < first || diagonal > last)
+						continue;
+					for (int m = std::max(kBegin, diagonal - r.max[1]); m < kEnd && m <= diagonal - r.min[1]; m++)
+						row(diagonal - m, m);
+				}
+				FluidWorkersBarrier(workers);
+			}
+		});
+	}
+}
+
+/*
+The pressure is solved in units of the x spacing: the y and z neighbours are weighted by how much finer those
+axes are, and each velocity difference is scaled by its own axis before it enters the divergence.
+*/
+template <typename Layout, typename Field>
+static void divergence(Field velocX, Field velocY, Field velocZ, Field p, Field div, int Nx, int Ny, int Nz, const FluidRegion& r, FluidWorkers* workers, const Layout& at)
+{
+	float scaleY = (float)Ny / Nx;
+	float scaleZ = (float)Nz / Nx;
+
+	forPlanes(workers, Nz, r, [=](int, int kBegin, int kEnd)
+	{
+		for (int k = kBegin; k < kEnd; k++)
+		{
+			for (int j = r.min[1]; j <= r.max[1]; j++)
+			{
+				for (int i = r.min[0]; i <= r.max[0]; i++)
+				{
+					div[IX(i, j, k)] = -.5f * (
+						velocX[IX(i + 1, j, k)]
+						- velocX[IX(i - 1, j, k)]
+						+ scaleY * (velocY[IX(i, j + 1, k)]
+							- velocY[IX(i, j - 1, k)])
+						+ scaleZ * (velocZ[IX(i, j, k + 1)]
+							- velocZ[IX(i, j, k - 1)])
+						) / Nx;
+					p[IX(i, j, k)] = 0;
+				}
+			}
+		}
+	});
+}
+
+// Returns the largest velocity component left. With Stats it also measures each plane of the new velocity.
+template <bool Stats, typename Layout, typename Field>
+static float gradient(Field velocX, Field velocY, Field velocZ, Field p, FluidPlaneStats* planes, int Nx, int Ny, int Nz, const FluidRegion& r, FluidWorkers* workers, const Layout& at)
+{
+	// One slot per worker; the maximum does not depend on the order they are combined in.
+	std::vector<float> maxSpeeds(workers ? FluidWorkersCount(workers) : 1, 0.f);
+	float* speeds = maxSpeeds.data();
+	forPlanes(workers, Nz, r, [=](int worker, int kBegin, int kEnd)
+	{
+		float maxSpeed = 0.f;
+		for (int k = kBegin; k < kEnd; k++)
+		{
+			double energy = 0.;
+			float squaredSpeed = 0.f;
+			for (int j = r.min[1]; j <= r.max[1]; j++)
+			{
+				for (int i = r.min[0]; i <= r.max[0]; i++)
+				{
+					velocX[IX(i, j, k)] -= .5f * (p[IX(i + 1, j, k)] - p[IX(i - 1, j, k)]) * Nx;
+					velocY[IX(i, j, k)] -= .5f * (p[IX(i, j + 1, k)] - p[IX(i, j - 1, k)]) * Ny;
+					velocZ[IX(i, j, k)] -= .5f * (p[IX(i, j, k + 1)] - p[IX(i, j, k - 1)]) * Nz;
+
+					maxSpeed = std::max(maxSpeed, std::max(fabsf(velocX[IX(i, j, k)]), std::max(fabsf(velocY[IX(i, j, k)]), fabsf(velocZ[IX(i, j, k)]))));
+					if (Stats)
+					{
+						float x = velocX[IX(i, j, k)], y = velocY[IX(i, j, k)], z = velocZ[IX(i, j, k)];
+						float squared = x * x + y * y + z * z;
+						energy += squared;
+						squaredSpeed = std::max(squaredSpeed, squared);
+					}
+				}
+			}
+			if (Stats)
+			{
+				planes[k].kineticEnergy += .5 * energy;
+				planes[k].maxSpeed = std::max(planes[k].maxSpeed, sqrtf(squaredSpeed));
+			}
+		}
+		speeds[worker] = maxSpeed;
+	});
+	return *std::max_element(maxSpeeds.begin(), maxSpeeds.end());
+}
+
+/*
+Traces each cell back along its velocity and samples the source field there. The sample point is clamped half a
+cell inside the walls so the trilinear footprint never leaves the grid. With Stats every sample is scaled, and
+each plane's stored values are summed and the divergence of the velocity it reads is measured in the same loop.
+The sums are per plane, so they come out the same however the planes are split between workers.
+*/
+template <bool Stats, typename Layout, typename Field>
+static void advect(Field d, Field d0, Field velocX, Field velocY, Field velocZ, float dt, float scale, FluidPlaneStats* planes, int Nx, int Ny, int Nz, const FluidRegion& r, FluidWorkers* workers, const Layout& at)
+{
+	float dtx = dt * (Nx - 2);
+	float dty = dt * (Ny - 2);
+	float dtz = dt * (Nz - 2);
+
+	float maxX = Nx - 1.5f;
+	float maxY = Ny - 1.5f;
+	float maxZ = Nz - 1.5f;
+
+	// As in divergence.
+	float scaleY = (float)Ny / Nx;
+	float scaleZ = (float)Nz / Nx;
+
+	forPlanes(workers, Nz, r, [=](int, int kBegin, int kEnd)
+	{
+		float i0, i1, j0, j1, k0, k1;
+		float s0, s1, t0, t1, u0, u1;
+		float tmp1, tmp2, tmp3, x, y, z;
+		int i, j, k;
+
+		for (k = kBegin; k < kEnd; k++)
+		{
+			double total = 0.;
+			float maxDivergence = 0.f;
+			for (j = r.min[1]; j <= r.max[1]; j++)
+			{
+				for (i = r.min[0]; i <= r.max[0]; i++)
+				{
+					tmp1 = dtx * velocX[IX(i, j, k)];
+					tmp2 = dty * velocY[IX(i, j, k)];
+					tmp3 = dtz * velocZ[IX(i, j, k)];
+
+					x = i - tmp1;
+					y = j - tmp2;
+					z = k - tmp3;
+
+					if (x < .5f) x = .5f;
+					if (x > maxX) x = maxX;
+					i0 = floorf(x);
+					i1 = i0 + 1.0f;
+
+					if (y < .5f) y = .5f;
+					if (y > maxY) y = maxY;
+					j0 = floorf(y);
+					j1 = j0 + 1.0f;
+
+					if (z < .5f) z = .5f;
+					if (z > maxZ) z = maxZ;
+					k0 = floorf(z);
+					k1 = k0 + 1.0f;
+					s1 = x - i0;
+					s0 = 1.0f - s1;
+					t1 = y - j0;
+					t0 = 1.0f - t1;
+					u1 = z - k0;
+					u0 = 1.0f - u1;
+
+					int i0i = i0;
+					int i1i = i1;
+					int j0i = j0;
+					int j1i = j1;
+					int k0i = k0;
+					int k1i = k1;
+
+					float sample =
+						s0 * (t0 * (u0 * d0[IX(i0i, j0i, k0i)]
+							+ u1 * d0[IX(i0i, j0i, k1i)])
+							+ (t1 * (u0 * d0[IX(i0i, j1i, k0i)]
+								+ u1 * d0[IX(i0i, j1i, k1i)])))
+						+ s1 * (t0 * (u0 * d0[IX(i1i, j0i, k0i)]
+							+ u1 * d0[IX(i1i, j0i, k1i)])
+							+ (t1 * (u0 * d0[IX(i1i, j1i, k0i)]
+								+ u1 * d0[IX(i1i, j1i, k1i)])));
+					if (Stats)
+					{
+						// Read back, so narrow storage counts the value after rounding.
+						d[IX(i, j, k)] = scale * sample;
+						float stored = d[IX(i, j, k)];
+						total += stored;
+						float divergence = .5f * (
+							velocX[IX(i + 1, j, k)]
+							- velocX[IX(i - 1, j, k)]
+							+ scaleY * (velocY[IX(i, j + 1, k)]
+								- velocY[IX(i, j - 1, k)])
+							+ scaleZ * (velocZ[IX(i, j, k + 1)]
+								- velocZ[IX(i, j, k - 1)])
+							) / Nx;
+						maxDivergence = std::max(maxDivergence, fabsf(divergence));
+					}
+					else
+						d[IX(i, j, k)] = sample;
+				}
+			}
+			if (Stats)
+			{
+				planes[k].mass += total;
+				planes[k].maxDivergence = std::max(planes[k].maxDivergence, maxDivergence);
+			}
+		}
+	});
+}
+
+// Room for count rows of Nx floats per worker, which the rows of narrow fields are converted into.
+static std::vector<float> rowBuffers(FluidWorkers* workers, int count, int Nx)
+{
+	return std::vector<float>((size_t)(workers ? FluidWorkersCount(workers) : 1) * count * Nx);
+}
+
+/*
+The files built for AVX2 and AVX-512 include immintrin.h and define FLUID_KERNELS_AVX2, and convert rows eight cells
+at a time with AVX2 and F16C, whose FP16 rounding is the same round to nearest even as FluidFloatToHalf. The cells
+left over, and every cell in the other builds, go one at a time.
+*/
+// The row of f starting at cell row as floats: the cells themselves for FP32, otherwise converted into buffer.
+static float* loadRow(const RowField& f, size_t row, int Nx, float* buffer)
+{
+	int i = 0;
+	switch (f.storage)
+	{
+	case FLUID_STORAGE_FP16:
+	{
+		const uint16_t* cells = (const uint16_t*)f.cells + row;
+#ifdef FLUID_KERNELS_AVX2
+		for (; i + 8 <= Nx; i += 8)
+			_mm256_storeu_ps(buffer + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(cells + i))));
+#endif
+		for (; i < Nx; i++)
+			buffer[i] = FluidHalfToFloat(cells[i]);
+		return buffer;
+	}
+	case FLUID_STORAGE_BF16:
+	{
+		const uint16_t* cells = (const uint16_t*)f.cells + row;
+#ifdef FLUID_KERNELS_AVX2
+		for (; i + 8 <= Nx; i += 8)
+		{
+			__m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(cells + i)));
+			_mm256_storeu_ps(buffer + i, _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16)));
+		}
+#endif
+		for (; i < Nx; i++)
+			buffer[i] = FluidBfloatToFloat(cells[i]);
+		return buffer;
+	}
+	case FLUID_STORAGE_INT16:
+	{
+		const int16_t* cells = (const int16_t*)f.cells + row;
+#ifdef FLUID_KERNELS_AVX2
+		__m256 scale = _mm256_set1_ps(f.scale);
+		for (; i + 8 <= Nx; i += 8)
+		{
+			__m256i wide = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(cells + i)));
+			_mm256_storeu_ps(buffer + i, _mm256_div_ps(_mm256_cvtepi32_ps(wide), scale));
+		}
+#endif
+		for (; i < Nx; i++)
+			buffer[i] = FluidFixedToFloat(cells[i], f.scale);
+		return buffer;
+	}
+	default:
+		return f.cells + row;
+	}
+}
+
+// Where a row of f that is only written goes: the cells for FP32, otherwise buffer until storeRow.
+static float* outputRow(const RowField& f, size_t row, float* buffer)
+{
+	return f.storage == FLUID_STORAGE_FP32 ? f.cells + row : buffer;
+}
+
+#ifdef FLUID_KERNELS_AVX2
+// The low 16 bits of each lane, in order; the lanes must already fit.
+static __m128i narrowLanes(__m256i wide, bool signedLanes)
+{
+	__m256i packed = signedLanes ? _mm256_packs_epi32(wide, wide) : _mm256_packus_epi32(wide, wide);
+	return _mm256_castsi256_si128(_mm256_permute4x64_epi64(packed, 0x08));
+}
+#endif
+
+// Converts cells begin to end of a row from loadRow or outputRow back into f; FP32 rows are the cells already.
+static void storeRow(const RowField& f, size_t row, const float* values, int begin, int end)
+{
+	int i = begin;
+	switch (f.storage)
+	{
+	case FLUID_STORAGE_FP16:
+	{
+		uint16_t* cells = (uint16_t*)f.cells + row;
+#ifdef FLUID_KERNELS_AVX2
+		for (; i + 8 <= end; i += 8)
+			_mm_storeu_si128((__m128i*)(cells + i), _mm256_cvtps_ph(_mm256_loadu_ps(values + i), _MM_FROUND_TO_NEAREST_INT));
+#endif
+		for (; i < end; i++)
+			cells[i] = FluidFloatToHalf(values[i]);
+		break;
+	}
+	case FLUID_STORAGE_BF16:
+	{
+		uint16_t* cells = (uint16_t*)f.cells + row;
+#ifdef FLUID_KERNELS_AVX2
+		// As FluidFloatToBfloat: round to nearest even, and keep NaNs NaN.
+		__m256i one = _mm256_set1_epi32(1), bias = _mm256_set1_epi32(0x7FFF);
+		__m256i magnitude = _mm256_set1_epi32(0x7FFFFFFF), infinity = _mm256_set1_epi32(0x7F800000), quiet = _mm256_set1_epi32(0x40);
+		for (; i + 8 <= end; i += 8)
+		{
+			__m256i bits = _mm256_castps_si256(_mm256_loadu_ps(values + i));
+			__m256i upper = _mm256_srli_epi32(bits, 16);
+			__m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(bits, bias), _mm256_and_si256(upper, one)), 16);
+			__m256i nan = _mm256_cmpgt_epi32(_mm256_and_si256(bits, magnitude), infinity);
+			rounded = _mm256_blendv_epi8(rounded, _mm256_or_si256(upper, quiet), nan);
+			_mm_storeu_si128((__m128i*)(cells + i), narrowLanes(rounded, false));
+		}
+#endif
+		for (; i < end; i++)
+			cells[i] = FluidFloatToBfloat(values[i]);
+		break;
+	}
+	case FLUID_STORAGE_INT16:
+	{
+		int16_t* cells = (int16_t*)f.cells + row;
+#ifdef FLUID_KERNELS_AVX2
+		// As FluidFloatToFixed: clamp, then round halves away from zero.
+		__m256 scale = _mm256_set1_ps(f.scale), top = _mm256_set1_ps(32767.f), bottom = _mm256_set1_ps(-32767.f);
+		__m256 half = _mm256_set1_ps(.5f), sign = _mm256_set1_ps(-0.f);
+		for (; i + 8 <= end; i += 8)
+		{
+			__m256 scaled = _mm256_mul_ps(_mm256_loadu_ps(values + i), scale);
+			scaled = _mm256_min_ps(_mm256_max_ps(scaled, bottom), top);
+			scaled = _mm256_add_ps(scaled, _mm256_or_ps(half, _mm256_and_ps(scaled, sign)));
+			_mm_storeu_si128((__m128i*)(cells + i), narrowLanes(_mm256_cvttps_epi32(scaled), true));
+		}
+#endif
+		for (; i < end; i++)
+			cells[i] = FluidFloatToFixed(values[i], f.scale);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+/*
+The SSE4.2, AVX2 and AVX-512 files also define FLUID_KERNELS_SSE42 or FLUID_KERNELS_AVX512, and divergence_rows,
+gradient_rows and advect_rows then run FLUID_LANES cells at a time in the widest vector the file has. The lanes do
+the operations of the scalar loops in the same order and never fuse a multiply and an add, so every build rounds like
+the baseline. lin_solve_rows stays scalar: each cell waits on the one before it.
+*/
+#if defined(FLUID_KERNELS_AVX512)
+#define FLUID_LANES 16
+typedef __m512 Lanes;
+static Lanes lanesSet(float value) { return _mm512_set1_ps(value); }
+static Lanes lanesLoad(const float* values) { return _mm512_loadu_ps(values); }
+static void lanesStore(float* values, Lanes lanes) { _mm512_storeu_ps(values, lanes); }
+static Lanes lanesAdd(Lanes a, Lanes b) { return _mm512_add_ps(a, b); }
+static Lanes lanesSub(Lanes a, Lanes b) { return _mm512_sub_ps(a, b); }
+static Lanes lanesMul(Lanes a, Lanes b) { return _mm512_mul_ps(a, b); }
+static Lanes lanesDiv(Lanes a, Lanes b) { return _mm512_div_ps(a, b); }
+static Lanes lanesMin(Lanes a, Lanes b) { return _mm512_min_ps(a, b); }
+static Lanes lanesMax(Lanes a, Lanes b) { return _mm512_max_ps(a, b); }
+static Lanes lanesAbs(Lanes a) { return _mm512_abs_ps(a); }
+static Lanes lanesFloor(Lanes a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+static void lanesStoreInts(int* values, Lanes a) { _mm512_storeu_si512(values, _mm512_cvttps_epi32(a)); }
+#elif defined(FLUID_KERNELS_AVX2)
+#define FLUID_LANES 8
+typedef __m256 Lanes;
+static Lanes lanesSet(float value) { return _mm256_set1_ps(value); }
+static Lanes lanesLoad(const float* values) { return _mm256_loadu_ps(values); }
+static void lanesStore(float* values, Lanes lanes) { _mm256_storeu_ps(values, lanes); }
+static Lanes lanesAdd(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+static Lanes lanesSub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+static Lanes lanesMul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+static Lanes lanesDiv(Lanes a, Lanes b) { return _mm256_div_ps(a, b); }
+static Lanes lanesMin(Lanes a, Lanes b) { return _mm256_min_ps(a, b); }
+static Lanes lanesMax(Lanes a, Lanes b) { return _mm256_max_ps(a, b); }
+static Lanes lanesAbs(Lanes a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+static Lanes lanesFloor(Lanes a) { return _mm256_floor_ps(a); }
+static void lanesStoreInts(int* values, Lanes a) { _mm256_storeu_si256((__m256i*)values, _mm256_cvttps_epi32(a)); }
+#elif defined(FLUID_KERNELS_SSE42)
+#define FLUID_LANES 4
+typedef __m128 Lanes;
+static Lanes lanesSet(float value) { return _mm_set1_ps(value); }
+static Lanes lanesLoad(const float* values) { return _mm_loadu_ps(values); }
+static void lanesStore(float* values, Lanes lanes) { _mm_storeu_ps(values, lanes); }
+static Lanes lanesAdd(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+static Lanes lanesSub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+static Lanes lanesMul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+static Lanes lanesDiv(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+static Lanes lanesMin(Lanes a, Lanes b) { return _mm_min_ps(a, b); }
+static Lanes lanesMax(Lanes a, Lanes b) { return _mm_max_ps(a, b); }
+static Lanes lanesAbs(Lanes a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+static Lanes lanesFloor(Lanes a) { return _mm_floor_ps(a); }
+static void lanesStoreInts(int* values, Lanes a) { _mm_storeu_si128((__m128i*)values, _mm_cvttps_epi32(a)); }
+#endif
+
+#ifdef FLUID_LANES
+// The lanes of i, i + 1, ... as floats.
+static Lanes lanesCount(int i)
+{
+	static const float steps[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+	return lanesAdd(lanesSet((float)i), lanesLoad(steps));
+}
+
+static float lanesLargest(Lanes a)
+{
+	float values[FLUID_LANES];
+	lanesStore(values, a);
+	return *std::max_element(values, values + FLUID_LANES);
+}
+#endif
+
+/*
+lin_solve over rows, in the same order and with the same arithmetic. A narrow x is rounded as each row is stored,
+so the rows after it see the rounded values while the cells further along its own row do not.
+*/
+static void lin_solve_rows(RowField x, RowField x0, float ax, float ay, float az, float c, int iter, int Nx, int Ny, int Nz, const FluidRegion& r, FluidWorkers* workers)
+{
+	float cRecip = 1.0f / c;
+	size_t strideY = Nx, strideZ = (size_t)Nx * Ny;
+	std::vector<float> buffers = rowBuffers(workers, 6, Nx);
+	float* scratch = buffers.data();
+	auto row = [=](int worker, int j, int m)
+	{
+		float* buffer = scratch + (size_t)worker * 6 * Nx;
+		size_t at = j * strideY + m * strideZ;
+		float* center = loadRow(x, at, Nx, buffer);
+		const float* down = loadRow(x, at - strideY, Nx, buffer + Nx);
+		const float* up = loadRow(x, at + strideY, Nx, buffer + 2 * Nx);
+		const float* back = loadRow(x, at - strideZ, Nx, buffer + 3 * Nx);
+		const float* front = loadRow(x, at + strideZ, Nx, buffer + 4 * Nx);
+		const float* source = loadRow(x0, at, Nx, buffer + 5 * Nx);
+		for (int i = r.min[0]; i <= r.max[0]; i++)
+		{
+			center[i] = (source[i]
+				+ ax * (center[i + 1] + center[i - 1])
+				+ ay * (up[i] + down[i])
+				+ az * (front[i] + back[i])
+				) * cRecip;
+		}
+		storeRow(x, at, center, r.min[0], r.max[0] + 1);
+	};
+
+	if (!workers)
+	{
+		for (int k = 0; k < iter; k++)
+			for (int m = r.min[2]; m <= r.max[2]; m++)
+				for (int j = r.min[1]; j <= r.max[1]; j++)
+					row(0, j, m);
+	}
+	else
+	{
+		// The same wavefront as lin_solve.
+		int first = r.min[1] + r.min[2], last = r.max[1] + r.max[2];
+		FluidWorkersRun(workers, Nz, [&](int worker, int kBegin, int kEnd)
+		{
+			kBegin = std::max(kBegin, r.min[2]);
+			kEnd = std::min(kEnd, r.max[2] + 1);
+			for (int step = first; step <= last + 2 * (iter - 1); step++)
+			{
+				for (int k = 0; k < iter; k++)
+				{
+					int diagonal = step - 2 * k;
+					if (diagonal < first || diagonal > last)
+						continue;
+					for (int m = std::max(kBegin, diagonal - r.max[1]); m < kEnd && m <= diagonal - r.min[1]; m++)
+						row(worker, diagonal - m, m);
+				}
+				FluidWorkersBarrier(workers);
+			}
+		});
+	}
+}
+
+static void divergence_rows(RowField velocX, RowField velocY, RowField velocZ, RowField p, RowField div, int Nx, int Ny, int Nz, const FluidRegion& r, FluidWorkers* workers)
+{
+	float scaleY = (float)Ny / Nx;
+	float scaleZ = (float)Nz / Nx;
+	size_t strideY = Nx, strideZ = (size_t)Nx * Ny;
+	std::vector<float> buffers = rowBuffers(workers, 7, Nx);
+	float* scratch = buffers.data();
+
+	forPlanes(workers, Nz, r, [=](int worker, int kBegin, int kEnd)
+	{
+		float* buffer = scratch + (size_t)worker * 7 * Nx;
+		for (int k = kBegin; k < kEnd; k++)
+		{
+			for (int j = r.min[1]; j <= r.max[1]; j++)
+			{
+				size_t at = j * strideY + k * strideZ;
+				const float* vx = loadRow(velocX, at, Nx, buffer);
+				const float* vyDown = loadRow(velocY, at - strideY, Nx, buffer + Nx);
+				const float* vyUp = loadRow(velocY, at + strideY, Nx, buffer + 2 * Nx);
+				const float* vzBack = loadRow(velocZ, at - strideZ, Nx, buffer + 3 * Nx);
+				const float* vzFront = loadRow(velocZ, at + strideZ, Nx, buffer + 4 * Nx);
+				float* d = outputRow(div, at, buffer + 5 * Nx);
+				float* pressure = outputRow(p, at, buffer + 6 * Nx);
+				int i = r.min[0];
+#ifdef FLUID_LANES
+				Lanes half = lanesSet(-.5f), width = lanesSet((float)Nx), yScale = lanesSet(scaleY), zScale = lanesSet(scaleZ);
+				for (; i + FLUID_LANES <= r.max[0] + 1; i += FLUID_LANES)
+				{
+					Lanes sum = lanesSub(lanesLoad(vx + i + 1), lanesLoad(vx + i - 1));
+					sum = lanesAdd(sum, lanesMul(yScale, lanesSub(lanesLoad(vyUp + i), lanesLoad(vyDown + i))));
+					sum = lanesAdd(sum, lanesMul(zScale, lanesSub(lanesLoad(vzFront + i), lanesLoad(vzBack + i))));
+					lanesStore(d + i, lanesDiv(lanesMul(half, sum), width));
+					lanesStore(pressure + i, lanesSet(0.f));
+				}
+#endif
+				for (; i <= r.max[0]; i++)
+				{
+					d[i] = -.5f * (
+						vx[i + 1]
+						- vx[i - 1]
+						+ scaleY * (vyUp[i]
+							- vyDown[i])
+						+ scaleZ * (vzFront[i]
+							- vzBack[i])
+						) / Nx;
+					pressure[i] = 0;
+				}
+				storeRow(div, at, d, r.min[0], r.max[0] + 1);
+				storeRow(p, at, pressure, r.min[0], r.max[0] + 1);
+			}
+		}
+	});
+}
+
+// Like gradient; narrow velocities are measured before they are rounded.
+template <bool Stats>
+static float gradient_rows(RowField velocX, RowField velocY, RowField velocZ, RowField p, FluidPlaneStats* planes, int Nx, int Ny, int Nz, const FluidRegion& r, FluidWorkers* workers)
+{
+	size_t strideY = Nx, strideZ = (size_t)Nx * Ny;
+	std::vector<float> maxSpeeds(workers ? FluidWorkersCount(workers) : 1, 0.f);
+	float* speeds = maxSpeeds.data();
+	std::vector<float> buffers = rowBuffers(workers, 8, Nx);
+	float* scratch = buffers.data();
+	forPlanes(workers, Nz, r, [=](int worker, int kBegin, int kEnd)
+	{
+		float* buffer = scratch + (size_t)worker * 8 * Nx;
+		float maxSpeed = 0.f;
+		for (int k = kBegin; k < kEnd; k++)
+		{
+			double energy = 0.;
+			float squaredSpeed = 0.f;
+			for (int j = r.min[1]; j <= r.max[1]; j++)
+			{
+				size_t at = j * strideY + k * strideZ;
+				float* vx = loadRow(velocX, at, Nx, buffer);
+				float* vy = loadRow(velocY, at, Nx, buffer + Nx);
+				float* vz = loadRow(velocZ, at, Nx, buffer + 2 * Nx);
+				const float* pressure = loadRow(p, at, Nx, buffer + 3 * Nx);
+				const float* pDown = loadRow(p, at - strideY, Nx, buffer + 4 * Nx);
+				const float* pUp = loadRow(p, at + strideY, Nx, buffer + 5 * Nx);
+				const float* pBack = loadRow(p, at - strideZ, Nx, buffer + 6 * Nx);
+				const float* pFront = loadRow(p, at + strideZ, Nx, buffer + 7 * Nx);
+				int i = r.min[0], measured = r.min[0];
+#ifdef FLUID_LANES
+				Lanes half = lanesSet(.5f), width = lanesSet((float)Nx), height = lanesSet((float)Ny), depth = lanesSet((float)Nz);
+				Lanes fastest = lanesSet(0.f);
+				for (; i + FLUID_LANES <= r.max[0] + 1; i += FLUID_LANES)
+				{
+					Lanes x = lanesSub(lanesLoad(vx + i), lanesMul(lanesMul(half, lanesSub(lanesLoad(pressure + i + 1), lanesLoad(pressure + i - 1))), width));
+					Lanes y = lanesSub(lanesLoad(vy + i), lanesMul(lanesMul(half, lanesSub(lanesLoad(pUp + i), lanesLoad(pDown + i))), height));
+					Lanes z = lanesSub(lanesLoad(vz + i), lanesMul(lanesMul(half, lanesSub(lanesLoad(pFront + i), lanesLoad(pBack + i))), depth));
+					lanesStore(vx + i, x);
+					lanesStore(vy + i, y);
+					lanesStore(vz + i, z);
+					fastest = lanesMax(fastest, lanesMax(lanesAbs(x), lanesMax(lanesAbs(y), lanesAbs(z))));
+				}
+				maxSpeed = std::max(maxSpeed, lanesLargest(fastest));
+				measured = i;
+#endif
+				for (; i <= r.max[0]; i++)
+				{
+					vx[i] -= .5f * (pressure[i + 1] - pressure[i - 1]) * Nx;
+					vy[i] -= .5f * (pUp[i] - pDown[i]) * Ny;
+					vz[i] -= .5f * (pFront[i] - pBack[i]) * Nz;
+				}
+				storeRow(velocX, at, vx, r.min[0], r.max[0] + 1);
+				storeRow(velocY, at, vy, r.min[0], r.max[0] + 1);
+				storeRow(velocZ, at, vz, r.min[0], r.max[0] + 1);
+
+				// The lanes have measured their cells' speeds already.
+				for (i = Stats ? r.min[0] : measured; i <= r.max[0]; i++)
+				{
+					maxSpeed = std::max(maxSpeed, std::max(fabsf(vx[i]), std::max(fabsf(vy[i]), fabsf(vz[i]))));
+					if (Stats)
+					{
+						float squared = vx[i] * vx[i] + vy[i] * vy[i] + vz[i] * vz[i];
+						energy += squared;
+						squaredSpeed = std::max(squaredSpeed, squared);
+					}
+				}
+			}
+			if (Stats)
+			{
+				planes[k].kineticEnergy += .5 * energy;
+				planes[k].maxSpeed = std::max(planes[k].maxSpeed, sqrtf(squaredSpeed));
+			}
+		}
+		speeds[worker] = maxSpeed;
+	});
+	return *std::max_element(maxSpeeds.begin(), maxSpeeds.end());
+}
+
+// Like advect; the source is a float* or a FluidStoredField, indexed in row-major order.
+template <bool Stats, typename Source>
+static void advect_rows(RowField d, Source d0, RowField velocX, RowField velocY, RowField velocZ, float dt, float scale, FluidPlaneStats* planes, int Nx, int Ny, int Nz, const FluidRegion& r, FluidWorkers* workers)
+{
+	float dtx = dt * (Nx - 2);
+	float dty = dt * (Ny - 2);
+	float dtz = dt * (Nz - 2);
+
+	float maxX = Nx - 1.5f;
+	float maxY = Ny - 1.5f;
+	float maxZ = Nz - 1.5f;
+
+	float scaleY = (float)Ny / Nx;
+	float scaleZ = (float)Nz / Nx;
+
+	FluidLayoutRowMajor at(Nx, Ny);
+	std::vector<float> buffers = rowBuffers(workers, 8, Nx);
+	float* scratch = buffers.data();
+
+	forPlanes(workers, Nz, r, [=](int worker, int kBegin, int kEnd)
+	{
+		float* buffer = scratch + (size_t)worker * 8 * Nx;
+#ifdef FLUID_LANES
+		Lanes stepX = lanesSet(dtx), stepY = lanesSet(dty), stepZ = lanesSet(dtz);
+		Lanes lastX = lanesSet(maxX), lastY = lanesSet(maxY), lastZ = lanesSet(maxZ);
+		Lanes half = lanesSet(.5f), one = lanesSet(1.0f), scaled = lanesSet(scale);
+#endif
+		float i0, i1, j0, j1, k0, k1;
+		float s0, s1, t0, t1, u0, u1;
+		float tmp1, tmp2, tmp3, x, y, z;
+		int i, j, k;
+
+		for (k = kBegin; k < kEnd; k++)
+		{
+			double total = 0.;
+			float maxDivergence = 0.f;
+			for (j = r.min[1]; j <= r.max[1]; j++)
+			{
+				size_t row = IX(0, j, k);
+				const float* vx = loadRow(velocX, row, Nx, buffer);
+				const float* vy = loadRow(velocY, row, Nx, buffer + Nx);
+				const float* vz = loadRow(velocZ, row, Nx, buffer + 2 * Nx);
+				float* out = outputRow(d, row, buffer + 3 * Nx);
+				i = r.min[0];
+#ifdef FLUID_LANES
+				Lanes yRow = lanesSet((float)j), zPlane = lanesSet((float)k);
+				for (; i + FLUID_LANES <= r.max[0] + 1; i += FLUID_LANES)
+				{
+					Lanes xs = lanesSub(lanesCount(i), lanesMul(stepX, lanesLoad(vx + i)));
+					Lanes ys = lanesSub(yRow, lanesMul(stepY, lanesLoad(vy + i)));
+					Lanes zs = lanesSub(zPlane, lanesMul(stepZ, lanesLoad(vz + i)));
+					xs = lanesMin(lastX, lanesMax(half, xs));
+					ys = lanesMin(lastY, lanesMax(half, ys));
+					zs = lanesMin(lastZ, lanesMax(half, zs));
+					Lanes xFloor = lanesFloor(xs), yFloor = lanesFloor(ys), zFloor = lanesFloor(zs);
+					Lanes xs1 = lanesSub(xs, xFloor), ys1 = lanesSub(ys, yFloor), zs1 = lanesSub(zs, zFloor);
+					Lanes xs0 = lanesSub(one, xs1), ys0 = lanesSub(one, ys1), zs0 = lanesSub(one, zs1);
+
+					// The eight corners around each lane's point, gathered one lane at a time.
+					int cellX[FLUID_LANES], cellY[FLUID_LANES], cellZ[FLUID_LANES];
+					float corners[8][FLUID_LANES];
+					lanesStoreInts(cellX, xFloor);
+					lanesStoreInts(cellY, yFloor);
+					lanesStoreInts(cellZ, zFloor);
+					for (int lane = 0; lane < FLUID_LANES; lane++)
+					{
+						int ci = cellX[lane], cj = cellY[lane], ck = cellZ[lane];
+						corners[0][lane] = d0[IX(ci, cj, ck)];
+						corners[1][lane] = d0[IX(ci, cj, ck + 1)];
+						corners[2][lane] = d0[IX(ci, cj + 1, ck)];
+						corners[3][lane] = d0[IX(ci, cj + 1, ck + 1)];
+						corners[4][lane] = d0[IX(ci + 1, cj, ck)];
+						corners[5][lane] = d0[IX(ci + 1, cj, ck + 1)];
+						corners[6][lane] = d0[IX(ci + 1, cj + 1, ck)];
+						corners[7][lane] = d0[IX(ci + 1, cj + 1, ck + 1)];
+					}
+					Lanes c[8];
+					for (int corner = 0; corner < 8; corner++)
+						c[corner] = lanesLoad(corners[corner]);
+
+					Lanes left = lanesAdd(lanesMul(ys0, lanesAdd(lanesMul(zs0, c[0]), lanesMul(zs1, c[1]))),
+						lanesMul(ys1, lanesAdd(lanesMul(zs0, c[2]), lanesMul(zs1, c[3]))));
+					Lanes right = lanesAdd(lanesMul(ys0, lanesAdd(lanesMul(zs0, c[4]), lanesMul(zs1, c[5]))),
+						lanesMul(ys1, lanesAdd(lanesMul(zs0, c[6]), lanesMul(zs1, c[7]))));
+					Lanes sample = lanesAdd(lanesMul(xs0, left), lanesMul(xs1, right));
+					lanesStore(out + i, Stats ? lanesMul(scaled, sample) : sample);
+				}
+#endif
+				for (; i <= r.max[0]; i++)
+				{
+					tmp1 = dtx * vx[i];
+					tmp2 = dty * vy[i];
+					tmp3 = dtz * vz[i];
+
+					x = i - tmp1;
+					y = j - tmp2;
+					z = k - tmp3;
+
+					if (x < .5f) x = .5f;
+					if (x > maxX) x = maxX;
+					i0 = floorf(x);
+					i1 = i0 + 1.0f;
+
+					if (y < .5f) y = .5f;
+					if (y > maxY) y = maxY;
+					j0 = floorf(y);
+					j1 = j0 + 1.0f;
+
+					if (z < .5f) z = .5f;
+					if (z > maxZ) z = maxZ;
+					k0 = floorf(z);
+					k1 = k0 + 1.0f;
+					s1 = x - i0;
+					s0 = 1.0f - s1;
+					t1 = y - j0;
+					t0 = 1.0f - t1;
+					u1 = z - k0;
+					u0 = 1.0f - u1;
+
+					int i0i = i0;
+					int i1i = i1;
+					int j0i = j0;
+					int j1i = j1;
+					int k0i = k0;
+					int k1i = k1;
+
+					float sample =
+						s0 * (t0 * (u0 * d0[IX(i0i, j0i, k0i)]
+							+ u1 * d0[IX(i0i, j0i, k1i)])
+							+ (t1 * (u0 * d0[IX(i0i, j1i, k0i)]
+								+ u1 * d0[IX(i0i, j1i, k1i)])))
+						+ s1 * (t0 * (u0 * d0[IX(i1i, j0i, k0i)]
+							+ u1 * d0[IX(i1i, j0i, k1i)])
+							+ (t1 * (u0 * d0[IX(i1i, j1i, k0i)]
+								+ u1 * d0[IX(i1i, j1i, k1i)])));
+					out[i] = Stats ? scale * sample : sample;
+				}
+				storeRow(d, row, out, r.min[0], r.max[0] + 1);
+				if (!Stats)
+					continue;
+
+				// Read back, so narrow storage counts the value after rounding.
+				const float* stored = loadRow(d, row, Nx, buffer + 3 * Nx);
+				const float* vyDown = loadRow(velocY, row - Nx, Nx, buffer + 4 * Nx);
+				const float* vyUp = loadRow(velocY, row + Nx, Nx, buffer + 5 * Nx);
+				const float* vzBack = loadRow(velocZ, row - at.strideZ, Nx, buffer + 6 * Nx);
+				const float* vzFront = loadRow(velocZ, row + at.strideZ, Nx, buffer + 7 * Nx);
+				for (i = r.min[0]; i <= r.max[0]; i++)
+				{
+					total += stored[i];
+					float divergence = .5f * (
+						vx[i + 1]
+						- vx[i - 1]
+						+ scaleY * (vyUp[i]
+							- vyDown[i])
+						+ scaleZ * (vzFront[i]
+							- vzBack[i])
+						) / Nx;
+					maxDivergence = std::max(maxDivergence, fabsf(divergence));
+				}
+			}
+			if (Stats)
+			{
+				planes[k].mass += total;
+				planes[k].maxDivergence = std::max(planes[k].maxDivergence, maxDivergence);
+			}
+		}
+	});
+}
@@ -0,0 +1,33 @@
+// The headers come first, so that only the kernels below are compiled for AVX2. MSVC ignores the pragmas and
+// compiles the plain code for the baseline, so nothing inline from a shared header differs between the kernel files;
+// the intrinsics FluidKernels.h uses for these lanes work without a switch.
+#include "FluidCube.h"
+#include "FluidBackend.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define FLUID_KERNELS_AVX2 1
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,f16c"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,f16c")
+#endif
+#endif
+
+#include "FluidKernels.h"
+
+const FluidBackend FluidBackendAvx2 = { "avx2", kernelsBoundary, kernelsLinearSolve, kernelsAdvect, kernelsDivergence, kernelsGradient };
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+#endif
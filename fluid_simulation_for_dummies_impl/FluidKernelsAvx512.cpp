@@ -0,0 +1,40 @@
+// The headers come first, so that only the kernels below are compiled for AVX-512. MSVC ignores the pragmas and
+// compiles the plain code for the baseline; the intrinsics FluidKernels.h uses for these lanes work without a switch.
+#include "FluidCube.h"
+#include "FluidBackend.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define FLUID_KERNELS_AVX2 1
+#define FLUID_KERNELS_AVX512 1
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+// AVX-512 brings fused multiply-add, which would round differently from the other variants.
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f,f16c"))), apply_to = function)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f,f16c")
+#pragma GCC optimize("fp-contract=off")
+// GCC 12 warns about the undefined vectors inside its own AVX-512 intrinsics.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#endif
+
+#include "FluidKernels.h"
+
+const FluidBackend FluidBackendAvx512 = { "avx512", kernelsBoundary, kernelsLinearSolve, kernelsAdvect, kernelsDivergence, kernelsGradient };
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+#endif
+#endif
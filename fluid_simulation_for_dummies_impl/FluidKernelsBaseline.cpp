@@ -0,0 +1,3 @@
+#include "FluidKernels.h"
+
+const FluidBackend FluidBackendReference = { "reference", kernelsBoundary, kernelsLinearSolve, kernelsAdvect, kernelsDivergence, kernelsGradient };
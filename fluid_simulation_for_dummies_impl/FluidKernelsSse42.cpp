@@ -0,0 +1,32 @@
+// The headers come first, so that only the kernels below are compiled for SSE4.2. MSVC ignores the pragmas and
+// compiles the plain code for the baseline; the intrinsics FluidKernels.h uses for these lanes work without a switch.
+#include "FluidCube.h"
+#include "FluidBackend.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define FLUID_KERNELS_SSE42 1
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse4.2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse4.2")
+#endif
+#endif
+
+#include "FluidKernels.h"
+
+const FluidBackend FluidBackendSse42 = { "sse4.2", kernelsBoundary, kernelsLinearSolve, kernelsAdvect, kernelsDivergence, kernelsGradient };
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+#endif
@@ -0,0 +1,67 @@
+#include "FluidLayout.h"
+
+static int bitsFor(int size)
+{
+	int bits = 0;
+	while ((1 << bits) < size)
+		bits++;
+	return bits;
+}
+
+static size_t roundUp(int size, int multiple)
+{
+	return (size_t)(size + multiple - 1) / multiple * multiple;
+}
+
+size_t FluidLayoutCells(FluidLayoutKind layout, int sizeX, int sizeY, int sizeZ)
+{
+	switch (layout)
+	{
+	case FLUID_LAYOUT_TILED:
+		return roundUp(sizeX, FLUID_LAYOUT_TILE) * roundUp(sizeY, FLUID_LAYOUT_TILE) * roundUp(sizeZ, FLUID_LAYOUT_TILE);
+	case FLUID_LAYOUT_MORTON:
+		return (size_t)1 << (bitsFor(sizeX) + bitsFor(sizeY) + bitsFor(sizeZ));
+	default:
+		return (size_t)sizeX * sizeY * sizeZ;
+	}
+}
+
+void FluidLayoutBuildMorton(uint64_t* table, int sizeX, int sizeY, int sizeZ)
+{
+	int sizes[3] = { sizeX, sizeY, sizeZ };
+	int bits[3] = { bitsFor(sizeX), bitsFor(sizeY), bitsFor(sizeZ) };
+
+	// Where bit b of each axis ends up in the index.
+	int position[3][32];
+	int next = 0;
+	for (int b = 0; b < 32; b++)
+		for (int a = 0; a < 3; a++)
+			if (b < bits[a])
+				position[a][b] = next++;
+
+	uint64_t* spread = table;
+	for (int a = 0; a < 3; a++)
+	{
+		for (int v = 0; v < sizes[a]; v++)
+		{
+			uint64_t index = 0;
+			for (int b = 0; b < bits[a]; b++)
+				index |= (uint64_t)((v >> b) & 1) << position[a][b];
+			spread[v] = index;
+		}
+		spread += sizes[a];
+	}
+}
+
+const char* FluidLayoutName(FluidLayoutKind layout)
+{
+	switch (layout)
+	{
+	case FLUID_LAYOUT_TILED:
+		return "tiled";
+	case FLUID_LAYOUT_MORTON:
+		return "morton";
+	default:
+		return "row-major";
+	}
+}
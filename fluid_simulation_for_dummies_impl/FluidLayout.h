@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/*
+Orders in which a FluidCube stores its cells. The kernels are templates over one of the indexers below, so the
+layout only changes which address a cell lives at, never the arithmetic: every layout gives the same results.
+*/
+enum FluidLayoutKind
+{
+	// x fastest, then y, then z; the only layout code outside FluidCube.cpp reads.
+	FLUID_LAYOUT_ROW_MAJOR,
+	// 4x4x4 bricks stored whole, bricks in row-major order; a 7-point stencil stays within one or two bricks.
+	FLUID_LAYOUT_TILED,
+	// Cells in Z-order, with each axis padded to a power of two.
+	FLUID_LAYOUT_MORTON
+};
+
+#define FLUID_LAYOUT_TILE 4
+
+struct FluidLayoutRowMajor
+{
+	size_t strideY;
+	size_t strideZ;
+
+	FluidLayoutRowMajor(int sizeX, int sizeY) : strideY(sizeX), strideZ((size_t)sizeX * sizeY) {}
+
+	size_t operator()(int x, int y, int z) const
+	{
+		return (size_t)x + (size_t)y * strideY + (size_t)z * strideZ;
+	}
+};
+
+struct FluidLayoutTiled
+{
+	// Distance between neighbouring bricks along y and z; bricks along x are 64 cells apart.
+	size_t tileStrideY;
+	size_t tileStrideZ;
+
+	FluidLayoutTiled(int sizeX, int sizeY)
+	{
+		size_t tilesX = (sizeX + FLUID_LAYOUT_TILE - 1) / FLUID_LAYOUT_TILE;
+		size_t tilesY = (sizeY + FLUID_LAYOUT_TILE - 1) / FLUID_LAYOUT_TILE;
+		tileStrideY = tilesX * 64;
+		tileStrideZ = tileStrideY * tilesY;
+	}
+
+	size_t operator()(int x, int y, int z) const
+	{
+		return ((size_t)(x >> 2) << 6) + (size_t)(y >> 2) * tileStrideY + (size_t)(z >> 2) * tileStrideZ
+			+ (x & 3) + ((y & 3) << 2) + ((z & 3) << 4);
+	}
+};
+
+struct FluidLayoutMorton
+{
+	// Each coordinate's bits already moved to their place in the Z-order index; see FluidLayoutBuildMorton.
+	const uint64_t* spreadX;
+	const uint64_t* spreadY;
+	const uint64_t* spreadZ;
+
+	FluidLayoutMorton(const uint64_t* table, int sizeX, int sizeY) : spreadX(table), spreadY(table + sizeX), spreadZ(table + sizeX + sizeY) {}
+
+	size_t operator()(int x, int y, int z) const
+	{
+		return (size_t)(spreadX[x] | spreadY[y] | spreadZ[z]);
+	}
+};
+
+// Cells to allocate per field, padding included.
+size_t FluidLayoutCells(FluidLayoutKind layout, int sizeX, int sizeY, int sizeZ);
+
+/*
+Fills table with sizeX + sizeY + sizeZ entries for FluidLayoutMorton. Bits are interleaved x, y, z from the
+lowest up; once an axis runs out of bits the remaining axes take its turns, so a long axis costs no padding
+along the short ones.
+*/
+void FluidLayoutBuildMorton(uint64_t* table, int sizeX, int sizeY, int sizeZ);
+
+const char* FluidLayoutName(FluidLayoutKind layout);
@@ -0,0 +1,563 @@
+#include "FluidRecorder.h"
+#include "FluidCube.h"
+#include "FluidSquare.h"
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static const char recordingMagic[8] = { 'F', 'L', 'U', 'I', 'D', 'R', 'C', '\0' };
+
+static const int lzHashBits = 16;
+static const size_t lzMinMatch = 4;
+static const size_t lzMaxOffset = 65535;
+
+struct FluidRecorder
+{
+	FILE* file;
+	FluidRecordingHeader header;
+	size_t cells;
+
+	// Double-buffered snapshots: the solver fills one while the worker encodes the other.
+	std::vector<float> slots[2];
+	bool slotFull[2];
+	int captureSlot;
+	int writeSlot;
+	bool closing;
+	bool failed;
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::thread worker;
+
+	uint32_t frameIndex;
+	std::vector<uint32_t> previous;
+	std::vector<uint32_t> words;
+	std::vector<uint8_t> planes;
+	std::vector<uint8_t> compressed;
+	std::vector<uint32_t> hashTable;
+
+	// Row-major float copies of the fields of cubes in another layout or storage.
+	std::vector<float> unpacked;
+};
+
+struct FluidRecording
+{
+	FILE* file;
+	FluidRecordingHeader header;
+	size_t cells;
+
+	std::vector<uint32_t> previous;
+	std::vector<uint32_t> words;
+	std::vector<uint8_t> planes;
+	std::vector<uint8_t> compressed;
+};
+
+static int wordBytes(uint32_t quantizeBits)
+{
+	return quantizeBits == 0 ? 4 : (int)quantizeBits / 8;
+}
+
+static uint32_t wordMask(uint32_t quantizeBits)
+{
+	return quantizeBits == 0 ? 0xffffffffu : (1u << quantizeBits) - 1;
+}
+
+static uint32_t recordedFieldCount(uint32_t fields, int sizeZ)
+{
+	return ((fields & FLUID_RECORD_DENSITY) ? 1 : 0) + ((fields & FLUID_RECORD_VELOCITY) ? (sizeZ > 1 ? 3 : 2) : 0);
+}
+
+static uint32_t read32(const uint8_t* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint8_t* emitLength(uint8_t* op, size_t length)
+{
+	while (length >= 255)
+	{
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = (uint8_t)length;
+	return op;
+}
+
+static uint8_t* emitSequence(uint8_t* op, const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength)
+{
+	uint8_t* token = op++;
+	size_t matchCode = matchLength ? matchLength - lzMinMatch : 0;
+	*token = (uint8_t)(((literalLength < 15 ? literalLength : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+	if (literalLength >= 15)
+		op = emitLength(op, literalLength - 15);
+	memcpy(op, literals, literalLength);
+	op += literalLength;
+
+	if (matchLength)
+	{
+		*op++ = (uint8_t)(offset & 0xff);
+		*op++ = (uint8_t)(offset >> 8);
+		if (matchCode >= 15)
+			op = emitLength(op, matchCode - 15);
+	}
+	return op;
+}
+
+static size_t lzCompressBound(size_t length)
+{
+	return length + length / 255 + 16;
+}
+
+/*
+LZ4-style block: every sequence is a token (literal length, match length - 4), the literals and a
+16-bit match offset. The last sequence only carries literals. Delta-encoded fields are mostly zero
+bytes, which collapse into long overlapping matches.
+*/
+static size_t lzCompress(const uint8_t* src, size_t length, uint8_t* dst, uint32_t* table)
+{
+	memset(table, 0, sizeof(uint32_t) << lzHashBits);
+	uint8_t* op = dst;
+	size_t anchor = 0;
+	size_t ip = 0;
+
+	while (ip + lzMinMatch <= length)
+	{
+		uint32_t sequence = read32(src + ip);
+		uint32_t hash = (sequence * 2654435761u) >> (32 - lzHashBits);
+		uint32_t entry = table[hash];
+		table[hash] = (uint32_t)(ip + 1);
+
+		// Positions are kept modulo 2^32; only the distance back is needed, so planes past 4 GB still match.
+		size_t distance = (uint32_t)(ip + 1) - entry;
+		if (entry && distance <= lzMaxOffset && distance <= ip && read32(src + ip - distance) == sequence)
+		{
+			size_t ref = ip - distance;
+			size_t matchLength = lzMinMatch;
+			while (ip + matchLength < length && src[ref + matchLength] == src[ip + matchLength])
+				matchLength++;
+
+			op = emitSequence(op, src + anchor, ip - anchor, ip - ref, matchLength);
+			ip += matchLength;
+			anchor = ip;
+		}
+		else
+		{
+			// Skip faster through data that does not compress.
+			ip += 1 + ((ip - anchor) >> 6);
+		}
+	}
+	op = emitSequence(op, src + anchor, length - anchor, 0, 0);
+	return op - dst;
+}
+
+static bool readLength(const uint8_t*& ip, const uint8_t* end, size_t& length)
+{
+	uint8_t value;
+	do
+	{
+		if (ip >= end)
+			return false;
+		value = *ip++;
+		length += value;
+	} while (value == 255);
+	return true;
+}
+
+static bool lzDecompress(const uint8_t* src, size_t length, uint8_t* dst, size_t dstLength)
+{
+	const uint8_t* ip = src;
+	const uint8_t* end = src + length;
+	size_t op = 0;
+
+	while (ip < end)
+	{
+		uint8_t token = *ip++;
+		size_t literalLength = token >> 4;
+		if (literalLength == 15 && !readLength(ip, end, literalLength))
+			return false;
+		if ((size_t)(end - ip) < literalLength || dstLength - op < literalLength)
+			return false;
+		memcpy(dst + op, ip, literalLength);
+		ip += literalLength;
+		op += literalLength;
+
+		if (ip == end)
+			break;
+
+		if (end - ip < 2)
+			return false;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		size_t matchLength = token & 15;
+		if (matchLength == 15 && !readLength(ip, end, matchLength))
+			return false;
+		matchLength += lzMinMatch;
+		if (offset == 0 || offset > op || dstLength - op < matchLength)
+			return false;
+
+		// Matches may overlap their own output, so copy byte by byte.
+		for (size_t i = 0; i < matchLength; i++, op++)
+			dst[op] = dst[op - offset];
+	}
+	return op == dstLength;
+}
+
+static void fieldRange(const float* field, size_t cells, float& minValue, float& maxValue)
+{
+	minValue = field[0];
+	maxValue = field[0];
+	for (size_t i = 1; i < cells; i++)
+	{
+		minValue = field[i] < minValue ? field[i] : minValue;
+		maxValue = field[i] > maxValue ? field[i] : maxValue;
+	}
+}
+
+static void encodeWords(const float* field, size_t cells, uint32_t quantizeBits, float minValue, float maxValue, uint32_t* words)
+{
+	if (quantizeBits == 0)
+	{
+		memcpy(words, field, cells * sizeof(float));
+		return;
+	}
+
+	float levels = (float)wordMask(quantizeBits);
+	float scale = maxValue > minValue ? levels / (maxValue - minValue) : 0.f;
+	for (size_t i = 0; i < cells; i++)
+		words[i] = (uint32_t)((field[i] - minValue) * scale + .5f);
+}
+
+static void decodeWords(const uint32_t* words, size_t cells, uint32_t quantizeBits, float minValue, float maxValue, float* field)
+{
+	if (quantizeBits == 0)
+	{
+		memcpy(field, words, cells * sizeof(float));
+		return;
+	}
+
+	float step = (maxValue - minValue) / (float)wordMask(quantizeBits);
+	for (size_t i = 0; i < cells; i++)
+		field[i] = minValue + words[i] * step;
+}
+
+/*
+Lossless floats are XORed with the previous frame so unchanged cells become zero words, quantized values
+are subtracted modulo the word size. The result is split into byte planes so the zero high bytes line up.
+*/
+static void deltaToPlanes(uint32_t* words, uint32_t* previous, size_t cells, uint32_t quantizeBits, bool keyframe, uint8_t* planes)
+{
+	uint32_t mask = wordMask(quantizeBits);
+	int bytes = wordBytes(quantizeBits);
+	for (size_t i = 0; i < cells; i++)
+	{
+		uint32_t word = words[i];
+		uint32_t delta = keyframe ? word : quantizeBits == 0 ? word ^ previous[i] : (word - previous[i]) & mask;
+		previous[i] = word;
+		for (int b = 0; b < bytes; b++)
+			planes[b * cells + i] = (uint8_t)(delta >> (8 * b));
+	}
+}
+
+static void planesToWords(const uint8_t* planes, uint32_t* previous, size_t cells, uint32_t quantizeBits, bool keyframe, uint32_t* words)
+{
+	uint32_t mask = wordMask(quantizeBits);
+	int bytes = wordBytes(quantizeBits);
+	for (size_t i = 0; i < cells; i++)
+	{
+		uint32_t delta = 0;
+		for (int b = 0; b < bytes; b++)
+			delta |= (uint32_t)planes[b * cells + i] << (8 * b);
+		uint32_t word = keyframe ? delta : quantizeBits == 0 ? delta ^ previous[i] : (delta + previous[i]) & mask;
+		previous[i] = word;
+		words[i] = word;
+	}
+}
+
+static bool writeFrame(FluidRecorder* recorder, const float* snapshot)
+{
+	const FluidRecordingHeader& header = recorder->header;
+	size_t cells = recorder->cells;
+	size_t planeBytes = cells * wordBytes(header.quantizeBits);
+
+	FluidRecordingFrameHeader frame;
+	frame.frameIndex = recorder->frameIndex;
+	frame.keyframe = header.keyframeInterval == 0 || recorder->frameIndex % header.keyframeInterval == 0;
+	recorder->frameIndex++;
+	if (fwrite(&frame, sizeof(frame), 1, recorder->file) != 1)
+		return false;
+
+	for (uint32_t f = 0; f < header.fieldCount; f++)
+	{
+		const float* field = snapshot + f * cells;
+		FluidRecordingFieldHeader fieldHeader;
+		fieldRange(field, cells, fieldHeader.minValue, fieldHeader.maxValue);
+
+		encodeWords(field, cells, header.quantizeBits, fieldHeader.minValue, fieldHeader.maxValue, recorder->words.data());
+		deltaToPlanes(recorder->words.data(), recorder->previous.data() + f * cells, cells, header.quantizeBits, frame.keyframe != 0, recorder->planes.data());
+		fieldHeader.compressedBytes = lzCompress(recorder->planes.data(), planeBytes, recorder->compressed.data(), recorder->hashTable.data());
+
+		if (fwrite(&fieldHeader, sizeof(fieldHeader), 1, recorder->file) != 1
+			|| fwrite(recorder->compressed.data(), 1, fieldHeader.compressedBytes, recorder->file) != fieldHeader.compressedBytes)
+			return false;
+	}
+	return true;
+}
+
+static void recorderWorker(FluidRecorder* recorder)
+{
+	std::unique_lock<std::mutex> lock(recorder->mutex);
+	for (;;)
+	{
+		recorder->cond.wait(lock, [recorder] { return recorder->slotFull[recorder->writeSlot] || recorder->closing; });
+		if (!recorder->slotFull[recorder->writeSlot])
+			break;
+
+		lock.unlock();
+		bool ok = recorder->failed || writeFrame(recorder, recorder->slots[recorder->writeSlot].data());
+		lock.lock();
+
+		if (!ok && !recorder->failed)
+		{
+			recorder->failed = true;
+			std::cout << "RECORDING_WRITE_FAILED::frame " << recorder->frameIndex << std::endl;
+		}
+		recorder->slotFull[recorder->writeSlot] = false;
+		recorder->writeSlot ^= 1;
+		recorder->cond.notify_all();
+	}
+}
+
+FluidRecorder* FluidRecorderCreate(const char* filePath, int sizeX, int sizeY, int sizeZ, const FluidRecorderOptions& options)
+{
+	if (options.quantizeBits != 0 && options.quantizeBits != 8 && options.quantizeBits != 16)
+	{
+		std::cout << "RECORDING_INVALID_QUANTIZATION::" << options.quantizeBits << std::endl;
+		return nullptr;
+	}
+
+	FILE* file = fopen(filePath, "wb");
+	if (!file)
+	{
+		std::cout << "RECORDING_OPEN_FAILED::" << filePath << std::endl;
+		return nullptr;
+	}
+
+	FluidRecorder* recorder = new FluidRecorder;
+	FluidRecordingHeader& header = recorder->header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, recordingMagic, sizeof(recordingMagic));
+	header.version = FLUID_RECORDING_VERSION;
+	header.headerSize = sizeof(FluidRecordingHeader);
+	header.sizeX = sizeX;
+	header.sizeY = sizeY;
+	header.sizeZ = sizeZ;
+	header.fields = options.fields;
+	header.fieldCount = recordedFieldCount(options.fields, sizeZ);
+	header.quantizeBits = options.quantizeBits;
+	header.keyframeInterval = options.keyframeInterval < 0 ? 0 : options.keyframeInterval;
+
+	recorder->file = file;
+	recorder->cells = (size_t)sizeX * sizeY * sizeZ;
+	recorder->slots[0].resize(recorder->cells * header.fieldCount);
+	recorder->slots[1].resize(recorder->cells * header.fieldCount);
+	recorder->slotFull[0] = recorder->slotFull[1] = false;
+	recorder->captureSlot = 0;
+	recorder->writeSlot = 0;
+	recorder->closing = false;
+	recorder->failed = fwrite(&header, sizeof(header), 1, file) != 1;
+
+	recorder->frameIndex = 0;
+	recorder->previous.assign(recorder->cells * header.fieldCount, 0);
+	recorder->words.resize(recorder->cells);
+	recorder->planes.resize(recorder->cells * wordBytes(header.quantizeBits));
+	recorder->compressed.resize(lzCompressBound(recorder->planes.size()));
+	recorder->hashTable.resize((size_t)1 << lzHashBits);
+
+	recorder->worker = std::thread(recorderWorker, recorder);
+	return recorder;
+}
+
+void FluidRecorderCapture(FluidRecorder* recorder, const float* const* fields)
+{
+	std::unique_lock<std::mutex> lock(recorder->mutex);
+	// Only blocks when the disk has fallen a whole frame behind the solver.
+	recorder->cond.wait(lock, [recorder] { return !recorder->slotFull[recorder->captureSlot]; });
+	int slot = recorder->captureSlot;
+	lock.unlock();
+
+	float* snapshot = recorder->slots[slot].data();
+	for (uint32_t f = 0; f < recorder->header.fieldCount; f++)
+		memcpy(snapshot + f * recorder->cells, fields[f], recorder->cells * sizeof(float));
+
+	lock.lock();
+	recorder->slotFull[slot] = true;
+	recorder->captureSlot ^= 1;
+	recorder->cond.notify_all();
+}
+
+void FluidRecorderCaptureCube(FluidRecorder* recorder, const FluidCube* cube)
+{
+	const float* fields[4];
+	int count = 0;
+	if (recorder->header.fields & FLUID_RECORD_DENSITY)
+		fields[count++] = cube->density;
+	if (recorder->header.fields & FLUID_RECORD_VELOCITY)
+	{
+		fields[count++] = cube->Vx;
+		fields[count++] = cube->Vy;
+		fields[count++] = cube->Vz;
+	}
+
+	if (cube->layout != FLUID_LAYOUT_ROW_MAJOR || cube->storage != FLUID_STORAGE_FP32)
+	{
+		recorder->unpacked.resize(recorder->cells * count);
+		for (int f = 0; f < count; f++)
+		{
+			FluidCubeCopyField(cube, fields[f], recorder->unpacked.data() + f * recorder->cells);
+			fields[f] = recorder->unpacked.data() + f * recorder->cells;
+		}
+	}
+	FluidRecorderCapture(recorder, fields);
+}
+
+void FluidRecorderCaptureSquare(FluidRecorder* recorder, const FluidSquare* square)
+{
+	const float* fields[3];
+	int count = 0;
+	if (recorder->header.fields & FLUID_RECORD_DENSITY)
+		fields[count++] = square->density;
+	if (recorder->header.fields & FLUID_RECORD_VELOCITY)
+	{
+		fields[count++] = square->Vx;
+		fields[count++] = square->Vy;
+	}
+	FluidRecorderCapture(recorder, fields);
+}
+
+bool FluidRecorderClose(FluidRecorder* recorder)
+{
+	{
+		std::lock_guard<std::mutex> lock(recorder->mutex);
+		recorder->closing = true;
+	}
+	recorder->cond.notify_all();
+	recorder->worker.join();
+
+	bool ok = !recorder->failed;
+	if (fclose(recorder->file) != 0)
+		ok = false;
+	delete recorder;
+	return ok;
+}
+
+static bool fileLength(FILE* file, uint64_t& length)
+{
+#ifdef _WIN32
+	bool ok = _fseeki64(file, 0, SEEK_END) == 0;
+	long long end = ok ? _ftelli64(file) : -1;
+	ok = end >= 0 && _fseeki64(file, 0, SEEK_SET) == 0;
+#else
+	bool ok = fseeko(file, 0, SEEK_END) == 0;
+	off_t end = ok ? ftello(file) : -1;
+	ok = end >= 0 && fseeko(file, 0, SEEK_SET) == 0;
+#endif
+	length = ok ? (uint64_t)end : 0;
+	return ok;
+}
+
+/*
+Besides the format fields, the sizes must agree with each other and with the file, which has to hold at least one
+frame: an LZ sequence never expands to more than 255 bytes per compressed byte, so a frame of cells that many per
+field needs at least a 256th of their bytes. This bounds what the buffers allocate before any frame is read.
+*/
+static bool validHeader(const FluidRecordingHeader& header, uint64_t fileLength)
+{
+	if (memcmp(header.magic, recordingMagic, sizeof(recordingMagic)) != 0
+		|| header.version != FLUID_RECORDING_VERSION
+		|| header.headerSize != sizeof(FluidRecordingHeader)
+		|| (header.quantizeBits != 0 && header.quantizeBits != 8 && header.quantizeBits != 16)
+		|| header.sizeX < 1 || header.sizeY < 1 || header.sizeZ < 1
+		|| header.fields == 0 || (header.fields & ~(uint32_t)(FLUID_RECORD_DENSITY | FLUID_RECORD_VELOCITY)) != 0
+		|| header.fieldCount != recordedFieldCount(header.fields, header.sizeZ))
+		return false;
+
+	uint64_t overhead = sizeof(FluidRecordingHeader) + sizeof(FluidRecordingFrameHeader) + header.fieldCount * sizeof(FluidRecordingFieldHeader);
+	if (fileLength <= overhead)
+		return false;
+	uint64_t maxCells = (fileLength - overhead) * 256 / (header.fieldCount * wordBytes(header.quantizeBits));
+	return (uint64_t)header.sizeX * header.sizeY <= maxCells / header.sizeZ;
+}
+
+FluidRecording* FluidRecordingOpen(const char* filePath)
+{
+	FILE* file = fopen(filePath, "rb");
+	if (!file)
+	{
+		std::cout << "RECORDING_OPEN_FAILED::" << filePath << std::endl;
+		return nullptr;
+	}
+
+	uint64_t length;
+	FluidRecordingHeader header;
+	if (!fileLength(file, length)
+		|| fread(&header, sizeof(header), 1, file) != 1
+		|| !validHeader(header, length))
+	{
+		std::cout << "RECORDING_INVALID::" << filePath << std::endl;
+		fclose(file);
+		return nullptr;
+	}
+
+	FluidRecording* recording = new FluidRecording;
+	recording->file = file;
+	recording->header = header;
+	recording->cells = (size_t)header.sizeX * header.sizeY * header.sizeZ;
+	recording->previous.assign(recording->cells * header.fieldCount, 0);
+	recording->words.resize(recording->cells);
+	recording->planes.resize(recording->cells * wordBytes(header.quantizeBits));
+	recording->compressed.resize(lzCompressBound(recording->planes.size()));
+	return recording;
+}
+
+const FluidRecordingHeader* FluidRecordingGetHeader(const FluidRecording* recording)
+{
+	return &recording->header;
+}
+
+bool FluidRecordingReadFrame(FluidRecording* recording, float* const* fields)
+{
+	const FluidRecordingHeader& header = recording->header;
+	size_t cells = recording->cells;
+
+	FluidRecordingFrameHeader frame;
+	if (fread(&frame, sizeof(frame), 1, recording->file) != 1)
+		return false;
+
+	for (uint32_t f = 0; f < header.fieldCount; f++)
+	{
+		FluidRecordingFieldHeader fieldHeader;
+		if (fread(&fieldHeader, sizeof(fieldHeader), 1, recording->file) != 1
+			|| fieldHeader.compressedBytes > recording->compressed.size()
+			|| fread(recording->compressed.data(), 1, fieldHeader.compressedBytes, recording->file) != fieldHeader.compressedBytes
+			|| !lzDecompress(recording->compressed.data(), fieldHeader.compressedBytes, recording->planes.data(), recording->planes.size()))
+		{
+			std::cout << "RECORDING_CORRUPT::frame " << frame.frameIndex << std::endl;
+			return false;
+		}
+
+		planesToWords(recording->planes.data(), recording->previous.data() + f * cells, cells, header.quantizeBits, frame.keyframe != 0, recording->words.data());
+		decodeWords(recording->words.data(), cells, header.quantizeBits, fieldHeader.minValue, fieldHeader.maxValue, fields[f]);
+	}
+	return true;
+}
+
+void FluidRecordingClose(FluidRecording* recording)
+{
+	fclose(recording->file);
+	delete recording;
+}
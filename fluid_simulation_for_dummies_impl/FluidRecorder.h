@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+
+struct FluidCube;
+struct FluidSquare;
+
+/*
+Recording file layout (version 1):
+
+	FluidRecordingHeader
+	frame 0, frame 1, ...
+
+Each frame starts with a FluidRecordingFrameHeader followed by one FluidRecordingFieldHeader and its
+compressed payload per recorded field. A payload is the field quantized to quantizeBits (0 keeps the raw
+32-bit floats), delta-encoded against the previous frame unless the frame is a keyframe, split into byte
+planes and finally LZ compressed.
+*/
+const uint32_t FLUID_RECORDING_VERSION = 1;
+
+enum FluidRecordFields
+{
+	FLUID_RECORD_DENSITY = 1,
+	FLUID_RECORD_VELOCITY = 2
+};
+
+struct FluidRecorderOptions
+{
+	int fields = FLUID_RECORD_DENSITY;
+	// 0 stores lossless floats, 8 or 16 stores values quantized between the per-frame min and max.
+	int quantizeBits = 0;
+	int keyframeInterval = 30;
+};
+
+struct FluidRecordingHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+
+	int32_t sizeX;
+	int32_t sizeY;
+	int32_t sizeZ;
+	uint32_t fieldCount;
+
+	uint32_t fields;
+	uint32_t quantizeBits;
+	uint32_t keyframeInterval;
+	uint32_t reserved;
+};
+
+struct FluidRecordingFrameHeader
+{
+	uint32_t frameIndex;
+	uint32_t keyframe;
+};
+
+struct FluidRecordingFieldHeader
+{
+	float minValue;
+	float maxValue;
+	uint64_t compressedBytes;
+};
+
+struct FluidRecorder;
+struct FluidRecording;
+
+FluidRecorder* FluidRecorderCreate(const char* filePath, int sizeX, int sizeY, int sizeZ, const FluidRecorderOptions& options);
+
+void FluidRecorderCapture(FluidRecorder* recorder, const float* const* fields);
+
+void FluidRecorderCaptureCube(FluidRecorder* recorder, const FluidCube* cube);
+
+void FluidRecorderCaptureSquare(FluidRecorder* recorder, const FluidSquare* square);
+
+bool FluidRecorderClose(FluidRecorder* recorder);
+
+FluidRecording* FluidRecordingOpen(const char* filePath);
+
+const FluidRecordingHeader* FluidRecordingGetHeader(const FluidRecording* recording);
+
+bool FluidRecordingReadFrame(FluidRecording* recording, float* const* fields);
+
+void FluidRecordingClose(FluidRecording* recording);
@@ -0,0 +1,696 @@
+#include "FluidSlab.h"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+// z is a global plane; zBase is the global plane stored first, i.e. the lowest ghost plane.
+#define IX(x,y,z) ((size_t)(x) + ((size_t)(y) + (size_t)((z) - zBase) * Ny) * Nx)
+
+static const char slabMagic[8] = { 'F', 'L', 'U', 'I', 'D', 'S', 'L', '\0' };
+static const size_t cacheLine = 64;
+
+struct FluidSlabHeader
+{
+	char magic[8];
+	uint32_t ranks;
+	int32_t sizeX;
+	int32_t sizeY;
+	int32_t sizeZ;
+	uint64_t length;
+
+	alignas(64) std::atomic<uint32_t> barrierCount;
+	std::atomic<uint32_t> barrierGeneration;
+
+	// Alternating between two sets lets a rank start the next reduction while others still read the last one.
+	alignas(64) float reduceSlots[2][FLUID_SLAB_MAX_RANKS];
+};
+
+/*
+One direction across one slab boundary. The sender waits until the previous exchange was consumed, fills
+planes and publishes the exchange number in produced; the receiver waits for that number, copies the planes
+out and publishes it in consumed. Only neighbours ever wait on each other.
+*/
+struct FluidSlabMailbox
+{
+	alignas(64) std::atomic<uint32_t> produced;
+	alignas(64) std::atomic<uint32_t> consumed;
+};
+
+struct FluidSlabShared
+{
+	void* data;
+	size_t length;
+	FluidSlabHeader* header;
+};
+
+static size_t alignUp(size_t offset)
+{
+	return (offset + cacheLine - 1) / cacheLine * cacheLine;
+}
+
+static size_t mailboxBytes(int sizeX, int sizeY)
+{
+	return alignUp(sizeof(FluidSlabMailbox) + (size_t)sizeX * sizeY * FLUID_SLAB_GHOST * sizeof(float));
+}
+
+static size_t sharedBytes(int ranks, int sizeX, int sizeY)
+{
+	return alignUp(sizeof(FluidSlabHeader)) + (size_t)2 * (ranks - 1) * mailboxBytes(sizeX, sizeY);
+}
+
+// Mailboxes come in pairs per boundary: the one going up from rank boundary, then the one coming back down.
+static FluidSlabMailbox* mailbox(const FluidSlab* slab, int boundary, bool up)
+{
+	char* base = (char*)slab->shared->data + alignUp(sizeof(FluidSlabHeader));
+	return (FluidSlabMailbox*)(base + (size_t)(2 * boundary + (up ? 0 : 1)) * mailboxBytes(slab->sizeX, slab->sizeY));
+}
+
+static float* mailboxPlanes(FluidSlabMailbox* box)
+{
+	return (float*)(box + 1);
+}
+
+static void slabRange(int rank, int ranks, int sizeZ, int& zBegin, int& zEnd)
+{
+	zBegin = (int)((int64_t)sizeZ * rank / ranks);
+	zEnd = (int)((int64_t)sizeZ * (rank + 1) / ranks);
+}
+
+static void futexWait(std::atomic<uint32_t>& word, uint32_t current)
+{
+#ifdef __linux__
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, current, nullptr, nullptr, 0);
+#else
+	std::this_thread::yield();
+#endif
+}
+
+static void futexWake(std::atomic<uint32_t>& word)
+{
+#ifdef __linux__
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+static void waitFor(std::atomic<uint32_t>& word, uint32_t value)
+{
+	// Neighbours usually finish within a few microseconds of each other, so spin briefly before sleeping.
+	for (int spin = 0; spin < 4096; spin++)
+	{
+		if (word.load(std::memory_order_acquire) == value)
+			return;
+	}
+	for (uint32_t current; (current = word.load(std::memory_order_acquire)) != value; )
+		futexWait(word, current);
+}
+
+bool FluidSlabCreateShared(const char* name, int ranks, int sizeX, int sizeY, int sizeZ)
+{
+	if (ranks < 1 || ranks > FLUID_SLAB_MAX_RANKS || sizeX < 3 || sizeY < 3 || sizeZ / ranks < FLUID_SLAB_GHOST)
+	{
+		std::cout << "SLAB_INVALID_LAYOUT::" << name << std::endl;
+		return false;
+	}
+#ifdef _WIN32
+	std::cout << "SLAB_UNSUPPORTED_PLATFORM::" << name << std::endl;
+	return false;
+#else
+	size_t length = sharedBytes(ranks, sizeX, sizeY);
+	int file = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (file < 0 || ftruncate(file, length) != 0)
+	{
+		std::cout << "SLAB_SHARED_CREATE_FAILED::" << name << std::endl;
+		if (file >= 0)
+		{
+			close(file);
+			shm_unlink(name);
+		}
+		return false;
+	}
+
+	void* data = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+	close(file);
+	if (data == MAP_FAILED)
+	{
+		std::cout << "SLAB_SHARED_CREATE_FAILED::" << name << std::endl;
+		shm_unlink(name);
+		return false;
+	}
+
+	FluidSlabHeader* header = new (data) FluidSlabHeader;
+	memcpy(header->magic, slabMagic, sizeof(slabMagic));
+	header->ranks = ranks;
+	header->sizeX = sizeX;
+	header->sizeY = sizeY;
+	header->sizeZ = sizeZ;
+	header->length = length;
+	header->barrierCount.store(0);
+	header->barrierGeneration.store(0);
+	for (int i = 0; i < 2 * (ranks - 1); i++)
+	{
+		FluidSlabMailbox* box = new ((char*)data + alignUp(sizeof(FluidSlabHeader)) + i * mailboxBytes(sizeX, sizeY)) FluidSlabMailbox;
+		box->produced.store(0);
+		box->consumed.store(0);
+	}
+	munmap(data, length);
+	return true;
+#endif
+}
+
+void FluidSlabUnlinkShared(const char* name)
+{
+#ifndef _WIN32
+	shm_unlink(name);
+#endif
+}
+
+static FluidSlabShared* attachShared(const char* name)
+{
+#ifdef _WIN32
+	std::cout << "SLAB_UNSUPPORTED_PLATFORM::" << name << std::endl;
+	return nullptr;
+#else
+	int file = shm_open(name, O_RDWR, 0600);
+	struct stat info;
+	if (file < 0 || fstat(file, &info) != 0 || (size_t)info.st_size < sizeof(FluidSlabHeader))
+	{
+		std::cout << "SLAB_SHARED_OPEN_FAILED::" << name << std::endl;
+		if (file >= 0)
+			close(file);
+		return nullptr;
+	}
+
+	void* data = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+	close(file);
+	if (data == MAP_FAILED)
+	{
+		std::cout << "SLAB_SHARED_OPEN_FAILED::" << name << std::endl;
+		return nullptr;
+	}
+
+	FluidSlabHeader* header = (FluidSlabHeader*)data;
+	if (memcmp(header->magic, slabMagic, sizeof(slabMagic)) != 0 || header->length != (uint64_t)info.st_size)
+	{
+		std::cout << "SLAB_SHARED_INVALID::" << name << std::endl;
+		munmap(data, info.st_size);
+		return nullptr;
+	}
+
+	FluidSlabShared* shared = new FluidSlabShared;
+	shared->data = data;
+	shared->length = info.st_size;
+	shared->header = header;
+	return shared;
+#endif
+}
+
+FluidSlab* FluidSlabAttach(const char* name, int rank, float diffusion, float viscosity, float dt)
+{
+	FluidSlabShared* shared = attachShared(name);
+	if (!shared)
+		return nullptr;
+	const FluidSlabHeader* header = shared->header;
+	if (rank < 0 || rank >= (int)header->ranks)
+	{
+		std::cout << "SLAB_INVALID_RANK::" << rank << std::endl;
+#ifndef _WIN32
+		munmap(shared->data, shared->length);
+#endif
+		delete shared;
+		return nullptr;
+	}
+
+	FluidSlab* slab = new FluidSlab;
+	slab->sizeX = header->sizeX;
+	slab->sizeY = header->sizeY;
+	slab->sizeZ = header->sizeZ;
+	slab->rank = rank;
+	slab->ranks = header->ranks;
+	slabRange(rank, slab->ranks, slab->sizeZ, slab->zBegin, slab->zEnd);
+
+	slab->dt = dt;
+	slab->diff = diffusion;
+	slab->visc = viscosity;
+	slab->cfl = 0.f;
+	slab->maxSubsteps = 1;
+	slab->maxSpeed = 0.f;
+
+	slab->shared = shared;
+	slab->exchanges = 0;
+	slab->reductions = 0;
+
+	// Zero-filled here, so the pages are first touched by the process that works on them.
+	size_t cells = (size_t)slab->sizeX * slab->sizeY * (slab->zEnd - slab->zBegin + 2 * FLUID_SLAB_GHOST);
+	for (float** field : { &slab->s, &slab->density, &slab->Vx, &slab->Vy, &slab->Vz, &slab->Vx0, &slab->Vy0, &slab->Vz0 })
+	{
+		*field = new float[cells];
+		std::fill(*field, *field + cells, 0.f);
+	}
+	return slab;
+}
+
+void FluidSlabFree(FluidSlab* slab)
+{
+	delete[] slab->s;
+	delete[] slab->density;
+
+	delete[] slab->Vx;
+	delete[] slab->Vy;
+	delete[] slab->Vz;
+
+	delete[] slab->Vx0;
+	delete[] slab->Vy0;
+	delete[] slab->Vz0;
+
+#ifndef _WIN32
+	munmap(slab->shared->data, slab->shared->length);
+#endif
+	delete slab->shared;
+	delete slab;
+}
+
+float* FluidSlabPlane(const FluidSlab* slab, float* field, int z)
+{
+	return field + (size_t)(z - slab->zBegin + FLUID_SLAB_GHOST) * slab->sizeX * slab->sizeY;
+}
+
+static bool owns(const FluidSlab* slab, int z)
+{
+	return z >= slab->zBegin && z < slab->zEnd;
+}
+
+void FluidSlabAddDensity(FluidSlab* slab, int x, int y, int z, float amount)
+{
+	if (!owns(slab, z))
+		return;
+	int Nx = slab->sizeX, Ny = slab->sizeY, zBase = slab->zBegin - FLUID_SLAB_GHOST;
+	slab->density[IX(x, y, z)] += amount;
+}
+
+void FluidSlabAddVelocity(FluidSlab* slab, int x, int y, int z, float amountX, float amountY, float amountZ)
+{
+	if (!owns(slab, z))
+		return;
+	int Nx = slab->sizeX, Ny = slab->sizeY, zBase = slab->zBegin - FLUID_SLAB_GHOST;
+	size_t index = IX(x, y, z);
+
+	slab->Vx[index] += amountX;
+	slab->Vy[index] += amountY;
+	slab->Vz[index] += amountZ;
+
+	slab->maxSpeed = fmaxf(slab->maxSpeed, fmaxf(fabsf(slab->Vx[index]), fmaxf(fabsf(slab->Vy[index]), fabsf(slab->Vz[index]))));
+}
+
+void FluidSlabSetCFL(FluidSlab* slab, float cfl, int maxSubsteps)
+{
+	slab->cfl = cfl;
+	slab->maxSubsteps = maxSubsteps < 1 ? 1 : maxSubsteps;
+}
+
+void FluidSlabBarrier(FluidSlab* slab)
+{
+	FluidSlabHeader* header = slab->shared->header;
+	uint32_t generation = header->barrierGeneration.load(std::memory_order_acquire);
+	if (header->barrierCount.fetch_add(1, std::memory_order_acq_rel) + 1 == (uint32_t)slab->ranks)
+	{
+		header->barrierCount.store(0, std::memory_order_relaxed);
+		header->barrierGeneration.store(generation + 1, std::memory_order_release);
+		futexWake(header->barrierGeneration);
+		return;
+	}
+	waitFor(header->barrierGeneration, generation + 1);
+}
+
+float FluidSlabAllreduce(FluidSlab* slab, float value, FluidSlabReduce op)
+{
+	float* slots = slab->shared->header->reduceSlots[slab->reductions++ & 1];
+	slots[slab->rank] = value;
+	FluidSlabBarrier(slab);
+
+	float result = slots[0];
+	for (int rank = 1; rank < slab->ranks; rank++)
+		result = op == FLUID_SLAB_SUM ? result + slots[rank] : fmaxf(result, slots[rank]);
+	return result;
+}
+
+// Sends this slab's outermost owned planes of field to both neighbours and fills the ghost planes from theirs.
+static void exchange(FluidSlab* slab, float* field)
+{
+	if (slab->ranks == 1)
+		return;
+	uint32_t number = ++slab->exchanges;
+	size_t planeBytes = (size_t)slab->sizeX * slab->sizeY * FLUID_SLAB_GHOST * sizeof(float);
+	bool below = slab->rank > 0;
+	bool above = slab->rank < slab->ranks - 1;
+
+	if (below)
+	{
+		FluidSlabMailbox* box = mailbox(slab, slab->rank - 1, false);
+		waitFor(box->consumed, number - 1);
+		memcpy(mailboxPlanes(box), FluidSlabPlane(slab, field, slab->zBegin), planeBytes);
+		box->produced.store(number, std::memory_order_release);
+		futexWake(box->produced);
+	}
+	if (above)
+	{
+		FluidSlabMailbox* box = mailbox(slab, slab->rank, true);
+		waitFor(box->consumed, number - 1);
+		memcpy(mailboxPlanes(box), FluidSlabPlane(slab, field, slab->zEnd - FLUID_SLAB_GHOST), planeBytes);
+		box->produced.store(number, std::memory_order_release);
+		futexWake(box->produced);
+	}
+
+	if (below)
+	{
+		FluidSlabMailbox* box = mailbox(slab, slab->rank - 1, true);
+		waitFor(box->produced, number);
+		memcpy(FluidSlabPlane(slab, field, slab->zBegin - FLUID_SLAB_GHOST), mailboxPlanes(box), planeBytes);
+		box->consumed.store(number, std::memory_order_release);
+		futexWake(box->consumed);
+	}
+	if (above)
+	{
+		FluidSlabMailbox* box = mailbox(slab, slab->rank, false);
+		waitFor(box->produced, number);
+		memcpy(FluidSlabPlane(slab, field, slab->zEnd), mailboxPlanes(box), planeBytes);
+		box->consumed.store(number, std::memory_order_release);
+		futexWake(box->consumed);
+	}
+}
+
+static void FluidSlabSubstep(FluidSlab* slab, float dt);
+static void set_bnd(FluidSlab* slab, int b, float* x);
+static void lin_solve(FluidSlab* slab, int b, float* x, float* x0, float ax, float ay, float az, float c, int iter);
+static void diffuse(FluidSlab* slab, int b, float* x, float* x0, float diff, float dt, int iter);
+static float project(FluidSlab* slab, float* velocX, float* velocY, float* velocZ, float* p, float* div, int iter);
+static void advect(FluidSlab* slab, int b, float* d, float* d0, float* velocX, float* velocY, float* velocZ, float dt);
+
+void FluidSlabStep(FluidSlab* slab)
+{
+	FluidSlabAdvance(slab, slab->dt);
+}
+
+// Same substep rule as FluidCubeAdvance, on the fastest velocity over all slabs so every rank agrees.
+int FluidSlabAdvance(FluidSlab* slab, float duration)
+{
+	float maxSpeed = FluidSlabAllreduce(slab, slab->maxSpeed, FLUID_SLAB_MAX);
+	int substeps = 1;
+	if (slab->cfl > 0.f)
+	{
+		int finest = std::max(slab->sizeX, std::max(slab->sizeY, slab->sizeZ));
+		float cells = maxSpeed * duration * (finest - 2);
+		float needed = ceilf(cells / slab->cfl);
+		substeps = needed < 1.f ? 1 : needed > slab->maxSubsteps ? slab->maxSubsteps : (int)needed;
+	}
+
+	float dt = duration / substeps;
+	for (int i = 0; i < substeps; i++)
+		FluidSlabSubstep(slab, dt);
+	return substeps;
+}
+
+static void FluidSlabSubstep(FluidSlab* slab, float dt)
+{
+	float visc = slab->visc;
+	float diff = slab->diff;
+	float* Vx = slab->Vx;
+	float* Vy = slab->Vy;
+	float* Vz = slab->Vz;
+	float* Vx0 = slab->Vx0;
+	float* Vy0 = slab->Vy0;
+	float* Vz0 = slab->Vz0;
+	float* s = slab->s;
+	float* density = slab->density;
+
+	diffuse(slab, 1, Vx0, Vx, visc, dt, 4);
+	diffuse(slab, 2, Vy0, Vy, visc, dt, 4);
+	diffuse(slab, 3, Vz0, Vz, visc, dt, 4);
+
+	project(slab, Vx0, Vy0, Vz0, Vx, Vy, 4);
+
+	advect(slab, 1, Vx, Vx0, Vx0, Vy0, Vz0, dt);
+	advect(slab, 2, Vy, Vy0, Vx0, Vy0, Vz0, dt);
+	advect(slab, 3, Vz, Vz0, Vx0, Vy0, Vz0, dt);
+
+	slab->maxSpeed = project(slab, Vx, Vy, Vz, Vx0, Vy0, 4);
+
+	diffuse(slab, 0, s, density, diff, dt, 4);
+	advect(slab, 0, density, s, Vx, Vy, Vz, dt);
+}
+
+/*
+The kernels below are FluidCube's over the owned planes. Interior loops run over the owned planes that are
+not walls; the z walls and the corners belong to the first and last slab.
+*/
+static void set_bnd(FluidSlab* slab, int b, float* x)
+{
+	int Nx = slab->sizeX, Ny = slab->sizeY, Nz = slab->sizeZ, zBase = slab->zBegin - FLUID_SLAB_GHOST;
+	int kBegin = std::max(slab->zBegin, 1), kEnd = std::min(slab->zEnd, Nz - 1);
+
+	for (int j = 1; j < Ny - 1; j++)
+	{
+		for (int i = 1; i < Nx - 1; i++)
+		{
+			if (slab->zBegin == 0) x[IX(i, j, 0)] = b == 3 ? -x[IX(i, j, 1)] : x[IX(i, j, 1)];
+			if (slab->zEnd == Nz) x[IX(i, j, Nz - 1)] = b == 3 ? -x[IX(i, j, Nz - 2)] : x[IX(i, j, Nz - 2)];
+		}
+	}
+	for (int k = kBegin; k < kEnd; k++)
+	{
+		for (int i = 1; i < Nx - 1; i++)
+		{
+			x[IX(i, 0, k)] = b == 2 ? -x[IX(i, 1, k)] : x[IX(i, 1, k)];
+			x[IX(i, Ny - 1, k)] = b == 2 ? -x[IX(i, Ny - 2, k)] : x[IX(i, Ny - 2, k)];
+		}
+	}
+	for (int k = kBegin; k < kEnd; k++)
+	{
+		for (int j = 1; j < Ny - 1; j++)
+		{
+			x[IX(0, j, k)] = b == 1 ? -x[IX(1, j, k)] : x[IX(1, j, k)];
+			x[IX(Nx - 1, j, k)] = b == 1 ? -x[IX(Nx - 2, j, k)] : x[IX(Nx - 2, j, k)];
+		}
+	}
+
+	if (slab->zBegin == 0)
+	{
+		x[IX(0, 0, 0)] = .33f * (x[IX(1, 0, 0)]
+			+ x[IX(0, 1, 0)]
+			+ x[IX(0, 0, 1)]);
+		x[IX(0, Ny - 1, 0)] = .33f * (x[IX(1, Ny - 1, 0)]
+			+ x[IX(0, Ny - 2, 0)]
+			+ x[IX(0, Ny - 1, 1)]);
+		x[IX(Nx - 1, 0, 0)] = .33f * (x[IX(Nx - 2, 0, 0)]
+			+ x[IX(Nx - 1, 1, 0)]
+			+ x[IX(Nx - 1, 0, 1)]);
+		x[IX(Nx - 1, Ny - 1, 0)] = .33f * (x[IX(Nx - 2, Ny - 1, 0)]
+			+ x[IX(Nx - 1, Ny - 2, 0)]
+			+ x[IX(Nx - 1, Ny - 1, 1)]);
+	}
+	if (slab->zEnd == Nz)
+	{
+		x[IX(0, 0, Nz - 1)] = .33f * (x[IX(1, 0, Nz - 1)]
+			+ x[IX(0, 1, Nz - 1)]
+			+ x[IX(0, 0, Nz - 2)]);
+		x[IX(0, Ny - 1, Nz - 1)] = .33f * (x[IX(1, Ny - 1, Nz - 1)]
+			+ x[IX(0, Ny - 2, Nz - 1)]
+			+ x[IX(0, Ny - 1, Nz - 2)]);
+		x[IX(Nx - 1, 0, Nz - 1)] = .33f * (x[IX(Nx - 2, 0, Nz - 1)]
+			+ x[IX(Nx - 1, 1, Nz - 1)]
+			+ x[IX(Nx - 1, 0, Nz - 2)]);
+		x[IX(Nx - 1, Ny - 1, Nz - 1)] = .33f * (x[IX(Nx - 2, Ny - 1, Nz - 1)]
+			+ x[IX(Nx - 1, Ny - 2, Nz - 1)]
+			+ x[IX(Nx - 1, Ny - 1, Nz - 2)]);
+	}
+}
+
+// Ghosts are refreshed after every sweep but the last, and once more after set_bnd has filled the walls.
+static void lin_solve(FluidSlab* slab, int b, float* x, float* x0, float ax, float ay, float az, float c, int iter)
+{
+	int Nx = slab->sizeX, Ny = slab->sizeY, Nz = slab->sizeZ, zBase = slab->zBegin - FLUID_SLAB_GHOST;
+	int kBegin = std::max(slab->zBegin, 1), kEnd = std::min(slab->zEnd, Nz - 1);
+	float cRecip = 1.0f / c;
+
+	for (int k = 0; k < iter; k++)
+	{
+		for (int m = kBegin; m < kEnd; m++)
+		{
+			for (int j = 1; j < Ny - 1; j++)
+			{
+				for (int i = 1; i < Nx - 1; i++)
+				{
+					x[IX(i, j, m)] = (x0[IX(i, j, m)]
+						+ ax * (x[IX(i + 1, j, m)] + x[IX(i - 1, j, m)])
+						+ ay * (x[IX(i, j + 1, m)] + x[IX(i, j - 1, m)])
+						+ az * (x[IX(i, j, m + 1)] + x[IX(i, j, m - 1)])
+						) * cRecip;
+				}
+			}
+		}
+		if (k < iter - 1)
+			exchange(slab, x);
+	}
+	set_bnd(slab, b, x);
+	exchange(slab, x);
+}
+
+static void diffuse(FluidSlab* slab, int b, float* x, float* x0, float diff, float dt, int iter)
+{
+	int Nx = slab->sizeX, Ny = slab->sizeY, Nz = slab->sizeZ;
+	float ax = dt * diff * (Nx - 2) * (Nx - 2);
+	float ay = dt * diff * (Ny - 2) * (Ny - 2);
+	float az = dt * diff * (Nz - 2) * (Nz - 2);
+	lin_solve(slab, b, x, x0, ax, ay, az, 1 + 2 * (ax + ay + az), iter);
+}
+
+static float project(FluidSlab* slab, float* velocX, float* velocY, float* velocZ, float* p, float* div, int iter)
+{
+	int Nx = slab->sizeX, Ny = slab->sizeY, Nz = slab->sizeZ, zBase = slab->zBegin - FLUID_SLAB_GHOST;
+	int kBegin = std::max(slab->zBegin, 1), kEnd = std::min(slab->zEnd, Nz - 1);
+	float maxSpeed = 0.f;
+
+	float wy = (float)Ny * Ny / ((float)Nx * Nx);
+	float wz = (float)Nz * Nz / ((float)Nx * Nx);
+	float scaleY = (float)Ny / Nx;
+	float scaleZ = (float)Nz / Nx;
+
+	for (int k = kBegin; k < kEnd; k++)
+	{
+		for (int j = 1; j < Ny - 1; j++)
+		{
+			for (int i = 1; i < Nx - 1; i++)
+			{
+				div[IX(i, j, k)] = -.5f * (
+					velocX[IX(i + 1, j, k)]
+					- velocX[IX(i - 1, j, k)]
+					+ scaleY * (velocY[IX(i, j + 1, k)]
+						- velocY[IX(i, j - 1, k)])
+					+ scaleZ * (velocZ[IX(i, j, k + 1)]
+						- velocZ[IX(i, j, k - 1)])
+					) / Nx;
+			}
+		}
+	}
+	set_bnd(slab, 0, div);
+	// p starts at zero everywhere, ghosts included, so it needs no exchange before the solve.
+	std::fill(p, p + (size_t)Nx * Ny * (slab->zEnd - zBase + FLUID_SLAB_GHOST), 0.f);
+	lin_solve(slab, 0, p, div, 1, wy, wz, 2 * (1 + wy + wz), iter);
+
+	for (int k = kBegin; k < kEnd; k++)
+	{
+		for (int j = 1; j < Ny - 1; j++)
+		{
+			for (int i = 1; i < Nx - 1; i++)
+			{
+				velocX[IX(i, j, k)] -= .5f * (p[IX(i + 1, j, k)] - p[IX(i - 1, j, k)]) * Nx;
+				velocY[IX(i, j, k)] -= .5f * (p[IX(i, j + 1, k)] - p[IX(i, j - 1, k)]) * Ny;
+				velocZ[IX(i, j, k)] -= .5f * (p[IX(i, j, k + 1)] - p[IX(i, j, k - 1)]) * Nz;
+
+				maxSpeed = fmaxf(maxSpeed, fmaxf(fabsf(velocX[IX(i, j, k)]), fmaxf(fabsf(velocY[IX(i, j, k)]), fabsf(velocZ[IX(i, j, k)]))));
+			}
+		}
+	}
+	set_bnd(slab, 1, velocX);
+	set_bnd(slab, 2, velocY);
+	set_bnd(slab, 3, velocZ);
+	exchange(slab, velocX);
+	exchange(slab, velocY);
+	exchange(slab, velocZ);
+
+	return maxSpeed;
+}
+
+static void advect(FluidSlab* slab, int b, float* d, float* d0, float* velocX, float* velocY, float* velocZ, float dt)
+{
+	int Nx = slab->sizeX, Ny = slab->sizeY, Nz = slab->sizeZ, zBase = slab->zBegin - FLUID_SLAB_GHOST;
+	int kBegin = std::max(slab->zBegin, 1), kEnd = std::min(slab->zEnd, Nz - 1);
+
+	float i0, i1, j0, j1, k0, k1;
+
+	float dtx = dt * (Nx - 2);
+	float dty = dt * (Ny - 2);
+	float dtz = dt * (Nz - 2);
+
+	float s0, s1, t0, t1, u0, u1;
+	float tmp1, tmp2, tmp3, x, y, z;
+
+	float maxX = Nx - 1.5f;
+	float maxY = Ny - 1.5f;
+	// Besides the walls, z may not leave the planes this slab holds.
+	float minZ = std::max(.5f, (float)(slab->zBegin - FLUID_SLAB_GHOST));
+	float maxZ = std::min(Nz - 1.5f, (float)(slab->zEnd + FLUID_SLAB_GHOST - 2));
+	int i, j, k;
+
+	for (k = kBegin; k < kEnd; k++)
+	{
+		for (j = 1; j < Ny - 1; j++)
+		{
+			for (i = 1; i < Nx - 1; i++)
+			{
+				tmp1 = dtx * velocX[IX(i, j, k)];
+				tmp2 = dty * velocY[IX(i, j, k)];
+				tmp3 = dtz * velocZ[IX(i, j, k)];
+
+				x = i - tmp1;
+				y = j - tmp2;
+				z = k - tmp3;
+
+				if (x < .5f) x = .5f;
+				if (x > maxX) x = maxX;
+				i0 = floorf(x);
+				i1 = i0 + 1.0f;
+
+				if (y < .5f) y = .5f;
+				if (y > maxY) y = maxY;
+				j0 = floorf(y);
+				j1 = j0 + 1.0f;
+
+				if (z < minZ) z = minZ;
+				if (z > maxZ) z = maxZ;
+				k0 = floorf(z);
+				k1 = k0 + 1.0f;
+				s1 = x - i0;
+				s0 = 1.0f - s1;
+				t1 = y - j0;
+				t0 = 1.0f - t1;
+				u1 = z - k0;
+				u0 = 1.0f - u1;
+
+				int i0i = i0;
+				int i1i = i1;
+				int j0i = j0;
+				int j1i = j1;
+				int k0i = k0;
+				int k1i = k1;
+
+				d[IX(i, j, k)] =
+					s0 * (t0 * (u0 * d0[IX(i0i, j0i, k0i)]
+						+ u1 * d0[IX(i0i, j0i, k1i)])
+						+ (t1 * (u0 * d0[IX(i0i, j1i, k0i)]
+							+ u1 * d0[IX(i0i, j1i, k1i)])))
+					+ s1 * (t0 * (u0 * d0[IX(i1i, j0i, k0i)]
+						+ u1 * d0[IX(i1i, j0i, k1i)])
+						+ (t1 * (u0 * d0[IX(i1i, j1i, k0i)]
+							+ u1 * d0[IX(i1i, j1i, k1i)])));
+			}
+		}
+	}
+	set_bnd(slab, b, d);
+	exchange(slab, d);
+}
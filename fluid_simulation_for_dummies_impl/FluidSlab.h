@@ -0,0 +1,93 @@
+#pragma once
+#include <cstdint>
+
+// Ghost planes kept on each side of a slab. Advection reads at most FLUID_SLAB_GHOST - 1 planes away, so runs
+// should keep the CFL number at or below that; the backtrace is clamped to the ghosts otherwise.
+#define FLUID_SLAB_GHOST 2
+#define FLUID_SLAB_MAX_RANKS 64
+
+enum FluidSlabReduce
+{
+	FLUID_SLAB_SUM,
+	FLUID_SLAB_MAX
+};
+
+struct FluidSlabShared;
+
+/*
+One process's part of a FluidCube split along z. The process owns the global planes [zBegin, zEnd) and keeps
+FLUID_SLAB_GHOST copies of each neighbour's nearest planes on either side. Every kernel that writes a field
+refreshes those ghosts through the shared segment before the next kernel reads them, which includes every
+lin_solve sweep, so slabs meet like Jacobi blocks inside an otherwise Gauss-Seidel solve.
+
+The fields hold (zEnd - zBegin + 2 * FLUID_SLAB_GHOST) planes of sizeX * sizeY cells; FluidSlabPlane finds a
+global plane in them.
+*/
+struct FluidSlab
+{
+	int sizeX;
+	int sizeY;
+	int sizeZ;
+	int rank;
+	int ranks;
+	int zBegin;
+	int zEnd;
+
+	float dt;
+	float diff;
+	float visc;
+	float cfl;
+	int maxSubsteps;
+	// Largest velocity component in this slab; FluidSlabAdvance takes the maximum over all slabs.
+	float maxSpeed;
+
+	float* s;
+	float* density;
+
+	float* Vx;
+	float* Vy;
+	float* Vz;
+
+	float* Vx0;
+	float* Vy0;
+	float* Vz0;
+
+	FluidSlabShared* shared;
+	uint32_t exchanges;
+	uint32_t reductions;
+
+	FluidSlab() = default;
+};
+
+/*
+Creates the shared segment for ranks processes working on one sizeX * sizeY * sizeZ grid; every process then
+attaches with its rank. Each slab needs at least FLUID_SLAB_GHOST planes. name follows shm_open rules, e.g.
+"/fluid_1234".
+*/
+bool FluidSlabCreateShared(const char* name, int ranks, int sizeX, int sizeY, int sizeZ);
+
+void FluidSlabUnlinkShared(const char* name);
+
+FluidSlab* FluidSlabAttach(const char* name, int rank, float diffusion, float viscosity, float dt);
+
+void FluidSlabFree(FluidSlab* slab);
+
+// Sources take global coordinates and are ignored by every slab but the owner of z.
+void FluidSlabAddDensity(FluidSlab* slab, int x, int y, int z, float amount);
+
+void FluidSlabAddVelocity(FluidSlab* slab, int x, int y, int z, float amountX, float amountY, float amountZ);
+
+void FluidSlabSetCFL(FluidSlab* slab, float cfl, int maxSubsteps);
+
+// Every rank must make the same sequence of Step, Advance, Allreduce and Barrier calls.
+void FluidSlabStep(FluidSlab* slab);
+
+int FluidSlabAdvance(FluidSlab* slab, float duration);
+
+// Combines value over all ranks in rank order, so every rank gets the same, reproducible result.
+float FluidSlabAllreduce(FluidSlab* slab, float value, FluidSlabReduce op);
+
+void FluidSlabBarrier(FluidSlab* slab);
+
+// Global plane z of field, which must be owned or a ghost plane.
+float* FluidSlabPlane(const FluidSlab* slab, float* field, int z);
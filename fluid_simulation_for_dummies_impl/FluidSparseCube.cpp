@@ -0,0 +1,480 @@
+#include "FluidSparseCube.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#define LOCAL(x,y,z) ((x) + ((y) + (z) * FLUID_BRICK_SIZE) * FLUID_BRICK_SIZE)
+
+static const int brickMask = FLUID_BRICK_SIZE - 1;
+static const float backgroundField[FLUID_BRICK_CELLS] = {};
+
+static size_t brickSlot(const FluidSparseCube* cube, int bx, int by, int bz)
+{
+	size_t B = cube->bricksPerSide;
+	return bx + (by + bz * B) * B;
+}
+
+static float* cell(const FluidSparseCube* cube, int f, int x, int y, int z)
+{
+	int index = cube->brickTable[brickSlot(cube, x >> FLUID_BRICK_SHIFT, y >> FLUID_BRICK_SHIFT, z >> FLUID_BRICK_SHIFT)];
+	return index < 0 ? nullptr : &cube->bricks[index]->fields[f][LOCAL(x & brickMask, y & brickMask, z & brickMask)];
+}
+
+static float at(const FluidSparseCube* cube, int f, int x, int y, int z)
+{
+	const float* value = cell(cube, f, x, y, z);
+	return value ? *value : 0.f;
+}
+
+static FluidBrick* activate(FluidSparseCube* cube, int bx, int by, int bz)
+{
+	int& index = cube->brickTable[brickSlot(cube, bx, by, bz)];
+	if (index >= 0)
+		return cube->bricks[index];
+
+	FluidBrick* brick;
+	if (!cube->pool.empty())
+	{
+		brick = cube->pool.back();
+		cube->pool.pop_back();
+	}
+	else
+		brick = new FluidBrick;
+	memset(brick->fields, 0, sizeof(brick->fields));
+	brick->x = bx;
+	brick->y = by;
+	brick->z = bz;
+
+	index = (int)cube->bricks.size();
+	cube->bricks.push_back(brick);
+	return brick;
+}
+
+static void reindex(FluidSparseCube* cube)
+{
+	for (size_t i = 0; i < cube->bricks.size(); i++)
+	{
+		const FluidBrick* brick = cube->bricks[i];
+		cube->brickTable[brickSlot(cube, brick->x, brick->y, brick->z)] = (int)i;
+	}
+}
+
+FluidSparseCube* FluidSparseCreate(int size, float diffusion, float viscosity, float dt, float threshold)
+{
+	if (size < FLUID_BRICK_SIZE || size % FLUID_BRICK_SIZE != 0)
+	{
+		std::cout << "SPARSE_SIZE_NOT_BRICK_MULTIPLE::" << size << std::endl;
+		return nullptr;
+	}
+
+	FluidSparseCube* cube = new FluidSparseCube;
+	cube->size = size;
+	cube->bricksPerSide = size / FLUID_BRICK_SIZE;
+	cube->dt = dt;
+	cube->diff = diffusion;
+	cube->visc = viscosity;
+	cube->threshold = threshold;
+	cube->maxSpeed = 0.f;
+
+	size_t slots = (size_t)cube->bricksPerSide * cube->bricksPerSide * cube->bricksPerSide;
+	cube->brickTable = new int[slots];
+	std::fill(cube->brickTable, cube->brickTable + slots, -1);
+	return cube;
+}
+
+void FluidSparseFree(FluidSparseCube* cube)
+{
+	for (FluidBrick* brick : cube->bricks)
+		delete brick;
+	for (FluidBrick* brick : cube->pool)
+		delete brick;
+	delete[] cube->brickTable;
+	delete cube;
+}
+
+void FluidSparseAddDensity(FluidSparseCube* cube, int x, int y, int z, float amount)
+{
+	activate(cube, x >> FLUID_BRICK_SHIFT, y >> FLUID_BRICK_SHIFT, z >> FLUID_BRICK_SHIFT);
+	*cell(cube, FLUID_SPARSE_DENSITY, x, y, z) += amount;
+}
+
+void FluidSparseAddVelocity(FluidSparseCube* cube, int x, int y, int z, float amountX, float amountY, float amountZ)
+{
+	activate(cube, x >> FLUID_BRICK_SHIFT, y >> FLUID_BRICK_SHIFT, z >> FLUID_BRICK_SHIFT);
+	float* vx = cell(cube, FLUID_SPARSE_VX, x, y, z);
+	float* vy = cell(cube, FLUID_SPARSE_VY, x, y, z);
+	float* vz = cell(cube, FLUID_SPARSE_VZ, x, y, z);
+	*vx += amountX;
+	*vy += amountY;
+	*vz += amountZ;
+
+	cube->maxSpeed = fmaxf(cube->maxSpeed, fmaxf(fabsf(*vx), fmaxf(fabsf(*vy), fabsf(*vz))));
+}
+
+float FluidSparseValue(const FluidSparseCube* cube, FluidSparseField field, int x, int y, int z)
+{
+	return at(cube, field, x, y, z);
+}
+
+void FluidSparseSlice(const FluidSparseCube* cube, FluidSparseField field, int z, float* out)
+{
+	int N = cube->size;
+	std::fill(out, out + (size_t)N * N, 0.f);
+	int bz = z >> FLUID_BRICK_SHIFT;
+	int lz = z & brickMask;
+
+	for (const FluidBrick* brick : cube->bricks)
+	{
+		if (brick->z != bz)
+			continue;
+		for (int ly = 0; ly < FLUID_BRICK_SIZE; ly++)
+		{
+			const float* row = &brick->fields[field][LOCAL(0, ly, lz)];
+			std::copy(row, row + FLUID_BRICK_SIZE, out + (size_t)(brick->y * FLUID_BRICK_SIZE + ly) * N + brick->x * FLUID_BRICK_SIZE);
+		}
+	}
+}
+
+void FluidSparseProjection(const FluidSparseCube* cube, FluidSparseField field, float* out)
+{
+	int N = cube->size;
+	int B = cube->bricksPerSide;
+	std::fill(out, out + (size_t)N * N, -INFINITY);
+	std::vector<int> activeAlongZ((size_t)B * B, 0);
+
+	for (const FluidBrick* brick : cube->bricks)
+	{
+		activeAlongZ[brick->x + brick->y * B]++;
+		for (int lz = 0; lz < FLUID_BRICK_SIZE; lz++)
+		{
+			for (int ly = 0; ly < FLUID_BRICK_SIZE; ly++)
+			{
+				const float* row = &brick->fields[field][LOCAL(0, ly, lz)];
+				float* target = out + (size_t)(brick->y * FLUID_BRICK_SIZE + ly) * N + brick->x * FLUID_BRICK_SIZE;
+				for (int lx = 0; lx < FLUID_BRICK_SIZE; lx++)
+					target[lx] = fmaxf(target[lx], row[lx]);
+			}
+		}
+	}
+
+	// Columns with an inactive brick also contain background cells.
+	for (int y = 0; y < N; y++)
+		for (int x = 0; x < N; x++)
+			if (activeAlongZ[(x >> FLUID_BRICK_SHIFT) + (y >> FLUID_BRICK_SHIFT) * B] < B)
+				out[(size_t)y * N + x] = fmaxf(out[(size_t)y * N + x], 0.f);
+}
+
+// Field f of the six face neighbours of brick, ordered -x, +x, -y, +y, -z, +z; inactive ones read as background.
+static void faceNeighbours(const FluidSparseCube* cube, const FluidBrick* brick, int f, const float* neighbours[6])
+{
+	static const int offsets[6][3] = { { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 } };
+	int B = cube->bricksPerSide;
+	for (int n = 0; n < 6; n++)
+	{
+		int bx = brick->x + offsets[n][0];
+		int by = brick->y + offsets[n][1];
+		int bz = brick->z + offsets[n][2];
+		int index = bx < 0 || by < 0 || bz < 0 || bx >= B || by >= B || bz >= B ? -1 : cube->brickTable[brickSlot(cube, bx, by, bz)];
+		neighbours[n] = index < 0 ? backgroundField : cube->bricks[index]->fields[f];
+	}
+}
+
+struct Stencil
+{
+	float xm, xp, ym, yp, zm, zp;
+};
+
+static inline Stencil stencil(const float* d, const float* const neighbours[6], int lx, int ly, int lz)
+{
+	const int S = FLUID_BRICK_SIZE;
+	int i = LOCAL(lx, ly, lz);
+	Stencil n;
+	n.xm = lx > 0 ? d[i - 1] : neighbours[0][i + (S - 1)];
+	n.xp = lx < S - 1 ? d[i + 1] : neighbours[1][i - (S - 1)];
+	n.ym = ly > 0 ? d[i - S] : neighbours[2][i + (S - 1) * S];
+	n.yp = ly < S - 1 ? d[i + S] : neighbours[3][i - (S - 1) * S];
+	n.zm = lz > 0 ? d[i - S * S] : neighbours[4][i + (S - 1) * S * S];
+	n.zp = lz < S - 1 ? d[i + S * S] : neighbours[5][i - (S - 1) * S * S];
+	return n;
+}
+
+// Local cell range of brick along each axis, leaving out the cells on the domain walls.
+static void interiorRange(const FluidSparseCube* cube, const FluidBrick* brick, int lo[3], int hi[3])
+{
+	int coords[3] = { brick->x, brick->y, brick->z };
+	for (int a = 0; a < 3; a++)
+	{
+		lo[a] = coords[a] == 0 ? 1 : 0;
+		hi[a] = coords[a] == cube->bricksPerSide - 1 ? FLUID_BRICK_SIZE - 2 : FLUID_BRICK_SIZE - 1;
+	}
+}
+
+template <typename F>
+static void forInterior(const FluidSparseCube* cube, const FluidBrick* brick, F f)
+{
+	int lo[3], hi[3];
+	interiorRange(cube, brick, lo, hi);
+	for (int lz = lo[2]; lz <= hi[2]; lz++)
+		for (int ly = lo[1]; ly <= hi[1]; ly++)
+			for (int lx = lo[0]; lx <= hi[0]; lx++)
+				f(lx, ly, lz);
+}
+
+static void set_bnd(FluidSparseCube* cube, int b, int f)
+{
+	const int S = FLUID_BRICK_SIZE;
+	int N = cube->size;
+	int last = cube->bricksPerSide - 1;
+
+	for (FluidBrick* brick : cube->bricks)
+	{
+		if (brick->x != 0 && brick->x != last && brick->y != 0 && brick->y != last && brick->z != 0 && brick->z != last)
+			continue;
+
+		float* x = brick->fields[f];
+		int lo[3], hi[3];
+		interiorRange(cube, brick, lo, hi);
+
+		for (int ly = lo[1]; ly <= hi[1]; ly++)
+		{
+			for (int lx = lo[0]; lx <= hi[0]; lx++)
+			{
+				if (brick->z == 0) x[LOCAL(lx, ly, 0)] = b == 3 ? -x[LOCAL(lx, ly, 1)] : x[LOCAL(lx, ly, 1)];
+				if (brick->z == last) x[LOCAL(lx, ly, S - 1)] = b == 3 ? -x[LOCAL(lx, ly, S - 2)] : x[LOCAL(lx, ly, S - 2)];
+			}
+		}
+		for (int lz = lo[2]; lz <= hi[2]; lz++)
+		{
+			for (int lx = lo[0]; lx <= hi[0]; lx++)
+			{
+				if (brick->y == 0) x[LOCAL(lx, 0, lz)] = b == 2 ? -x[LOCAL(lx, 1, lz)] : x[LOCAL(lx, 1, lz)];
+				if (brick->y == last) x[LOCAL(lx, S - 1, lz)] = b == 2 ? -x[LOCAL(lx, S - 2, lz)] : x[LOCAL(lx, S - 2, lz)];
+			}
+		}
+		for (int lz = lo[2]; lz <= hi[2]; lz++)
+		{
+			for (int ly = lo[1]; ly <= hi[1]; ly++)
+			{
+				if (brick->x == 0) x[LOCAL(0, ly, lz)] = b == 1 ? -x[LOCAL(1, ly, lz)] : x[LOCAL(1, ly, lz)];
+				if (brick->x == last) x[LOCAL(S - 1, ly, lz)] = b == 1 ? -x[LOCAL(S - 2, ly, lz)] : x[LOCAL(S - 2, ly, lz)];
+			}
+		}
+	}
+
+	for (int corner = 0; corner < 8; corner++)
+	{
+		int cx = corner & 1 ? N - 1 : 0;
+		int cy = corner & 2 ? N - 1 : 0;
+		int cz = corner & 4 ? N - 1 : 0;
+		float* value = cell(cube, f, cx, cy, cz);
+		if (!value)
+			continue;
+		*value = .33f * (at(cube, f, cx ? N - 2 : 1, cy, cz)
+			+ at(cube, f, cx, cy ? N - 2 : 1, cz)
+			+ at(cube, f, cx, cy, cz ? N - 2 : 1));
+	}
+}
+
+static void lin_solve(FluidSparseCube* cube, int b, int x, int x0, float a, float c, int iter)
+{
+	float cRecip = 1.0f / c;
+	const float* neighbours[6];
+	for (int k = 0; k < iter; k++)
+	{
+		for (FluidBrick* brick : cube->bricks)
+		{
+			float* d = brick->fields[x];
+			const float* d0 = brick->fields[x0];
+			faceNeighbours(cube, brick, x, neighbours);
+			forInterior(cube, brick, [&](int lx, int ly, int lz)
+			{
+				int i = LOCAL(lx, ly, lz);
+				Stencil n = stencil(d, neighbours, lx, ly, lz);
+				d[i] = (d0[i] + a * (n.xp + n.xm + n.yp + n.ym + n.zp + n.zm)) * cRecip;
+			});
+		}
+	}
+	set_bnd(cube, b, x);
+}
+
+static void diffuse(FluidSparseCube* cube, int b, int x, int x0, float diff, float dt, int iter)
+{
+	int N = cube->size;
+	float a = dt * diff * (N - 2) * (N - 2);
+	lin_solve(cube, b, x, x0, a, 1 + 6 * a, iter);
+}
+
+// Term for term the same as FluidCube's project, so both backends can be compared cell by cell.
+static float project(FluidSparseCube* cube, int velocX, int velocY, int velocZ, int p, int div, int iter)
+{
+	int N = cube->size;
+	float maxSpeed = 0.f;
+	const float* neighboursX[6];
+	const float* neighboursY[6];
+	const float* neighboursZ[6];
+
+	for (FluidBrick* brick : cube->bricks)
+	{
+		const float* vx = brick->fields[velocX];
+		const float* vy = brick->fields[velocY];
+		const float* vz = brick->fields[velocZ];
+		float* pd = brick->fields[p];
+		float* divd = brick->fields[div];
+		faceNeighbours(cube, brick, velocX, neighboursX);
+		faceNeighbours(cube, brick, velocY, neighboursY);
+		faceNeighbours(cube, brick, velocZ, neighboursZ);
+		forInterior(cube, brick, [&](int lx, int ly, int lz)
+		{
+			Stencil nx = stencil(vx, neighboursX, lx, ly, lz);
+			Stencil ny = stencil(vy, neighboursY, lx, ly, lz);
+			Stencil nz = stencil(vz, neighboursZ, lx, ly, lz);
+			int i = LOCAL(lx, ly, lz);
+			divd[i] = -.5f * (nx.xp - nx.xm + ny.yp - ny.ym + nz.zp - nz.zm) / N;
+			pd[i] = 0;
+		});
+	}
+	set_bnd(cube, 0, div);
+	set_bnd(cube, 0, p);
+	lin_solve(cube, 0, p, div, 1, 6, iter);
+
+	const float* neighboursP[6];
+	for (FluidBrick* brick : cube->bricks)
+	{
+		float* vx = brick->fields[velocX];
+		float* vy = brick->fields[velocY];
+		float* vz = brick->fields[velocZ];
+		const float* pd = brick->fields[p];
+		faceNeighbours(cube, brick, p, neighboursP);
+		forInterior(cube, brick, [&](int lx, int ly, int lz)
+		{
+			Stencil n = stencil(pd, neighboursP, lx, ly, lz);
+			int i = LOCAL(lx, ly, lz);
+			vx[i] -= .5f * (n.xp - n.xm) * N;
+			vy[i] -= .5f * (n.yp - n.ym) * N;
+			vz[i] -= .5f * (n.zp - n.zm) * N;
+
+			maxSpeed = fmaxf(maxSpeed, fmaxf(fabsf(vx[i]), fmaxf(fabsf(vy[i]), fabsf(vz[i]))));
+		});
+	}
+	set_bnd(cube, 1, velocX);
+	set_bnd(cube, 2, velocY);
+	set_bnd(cube, 3, velocZ);
+
+	return maxSpeed;
+}
+
+static void advect(FluidSparseCube* cube, int b, int d, int d0, int velocX, int velocY, int velocZ, float dt)
+{
+	int N = cube->size;
+	float dtx = dt * (N - 2);
+	float dty = dt * (N - 2);
+	float dtz = dt * (N - 2);
+	float maxCoord = N - 1.5f;
+
+	for (FluidBrick* brick : cube->bricks)
+	{
+		float* out = brick->fields[d];
+		forInterior(cube, brick, [&](int lx, int ly, int lz)
+		{
+			int i = LOCAL(lx, ly, lz);
+			float x = brick->x * FLUID_BRICK_SIZE + lx - dtx * brick->fields[velocX][i];
+			float y = brick->y * FLUID_BRICK_SIZE + ly - dty * brick->fields[velocY][i];
+			float z = brick->z * FLUID_BRICK_SIZE + lz - dtz * brick->fields[velocZ][i];
+
+			x = fminf(fmaxf(x, .5f), maxCoord);
+			y = fminf(fmaxf(y, .5f), maxCoord);
+			z = fminf(fmaxf(z, .5f), maxCoord);
+			float i0 = floorf(x), j0 = floorf(y), k0 = floorf(z);
+			float s1 = x - i0, s0 = 1.0f - s1;
+			float t1 = y - j0, t0 = 1.0f - t1;
+			float u1 = z - k0, u0 = 1.0f - u1;
+			int i0i = (int)i0, j0i = (int)j0, k0i = (int)k0;
+			int i1i = i0i + 1, j1i = j0i + 1, k1i = k0i + 1;
+
+			out[i] =
+				s0 * (t0 * (u0 * at(cube, d0, i0i, j0i, k0i)
+					+ u1 * at(cube, d0, i0i, j0i, k1i))
+					+ (t1 * (u0 * at(cube, d0, i0i, j1i, k0i)
+						+ u1 * at(cube, d0, i0i, j1i, k1i))))
+				+ s1 * (t0 * (u0 * at(cube, d0, i1i, j0i, k0i)
+					+ u1 * at(cube, d0, i1i, j0i, k1i))
+					+ (t1 * (u0 * at(cube, d0, i1i, j1i, k0i)
+						+ u1 * at(cube, d0, i1i, j1i, k1i))));
+		});
+	}
+	set_bnd(cube, b, d);
+}
+
+// Activates every brick within margin bricks of an active one, then puts them in sweep order.
+static void activateReachable(FluidSparseCube* cube, int margin)
+{
+	int B = cube->bricksPerSide;
+	size_t count = cube->bricks.size();
+	for (size_t n = 0; n < count; n++)
+	{
+		int bx = cube->bricks[n]->x, by = cube->bricks[n]->y, bz = cube->bricks[n]->z;
+		for (int z = std::max(bz - margin, 0); z <= std::min(bz + margin, B - 1); z++)
+			for (int y = std::max(by - margin, 0); y <= std::min(by + margin, B - 1); y++)
+				for (int x = std::max(bx - margin, 0); x <= std::min(bx + margin, B - 1); x++)
+					activate(cube, x, y, z);
+	}
+
+	std::sort(cube->bricks.begin(), cube->bricks.end(), [](const FluidBrick* a, const FluidBrick* b)
+	{
+		return a->z != b->z ? a->z < b->z : a->y != b->y ? a->y < b->y : a->x < b->x;
+	});
+	reindex(cube);
+}
+
+// Returns bricks whose density and velocity are all within threshold to the pool.
+static void retireEmpty(FluidSparseCube* cube)
+{
+	size_t kept = 0;
+	for (FluidBrick* brick : cube->bricks)
+	{
+		bool empty = true;
+		for (int f : { FLUID_SPARSE_DENSITY, FLUID_SPARSE_VX, FLUID_SPARSE_VY, FLUID_SPARSE_VZ })
+			for (int i = 0; empty && i < FLUID_BRICK_CELLS; i++)
+				empty = fabsf(brick->fields[f][i]) <= cube->threshold;
+
+		if (empty)
+		{
+			cube->brickTable[brickSlot(cube, brick->x, brick->y, brick->z)] = -1;
+			cube->pool.push_back(brick);
+		}
+		else
+			cube->bricks[kept++] = brick;
+	}
+	cube->bricks.resize(kept);
+	reindex(cube);
+}
+
+void FluidSparseStep(FluidSparseCube* cube)
+{
+	int N = cube->size;
+	float dt = cube->dt;
+	float visc = cube->visc;
+	float diff = cube->diff;
+
+	// Advection carries values at most maxSpeed * dt cells; each of the 4 solver iterations reaches one more.
+	int reach = (int)ceilf(cube->maxSpeed * dt * (N - 2)) + 4 + 1;
+	activateReachable(cube, (reach + FLUID_BRICK_SIZE - 1) / FLUID_BRICK_SIZE);
+
+	diffuse(cube, 1, FLUID_SPARSE_VX0, FLUID_SPARSE_VX, visc, dt, 4);
+	diffuse(cube, 2, FLUID_SPARSE_VY0, FLUID_SPARSE_VY, visc, dt, 4);
+	diffuse(cube, 3, FLUID_SPARSE_VZ0, FLUID_SPARSE_VZ, visc, dt, 4);
+
+	project(cube, FLUID_SPARSE_VX0, FLUID_SPARSE_VY0, FLUID_SPARSE_VZ0, FLUID_SPARSE_VX, FLUID_SPARSE_VY, 4);
+
+	advect(cube, 1, FLUID_SPARSE_VX, FLUID_SPARSE_VX0, FLUID_SPARSE_VX0, FLUID_SPARSE_VY0, FLUID_SPARSE_VZ0, dt);
+	advect(cube, 2, FLUID_SPARSE_VY, FLUID_SPARSE_VY0, FLUID_SPARSE_VX0, FLUID_SPARSE_VY0, FLUID_SPARSE_VZ0, dt);
+	advect(cube, 3, FLUID_SPARSE_VZ, FLUID_SPARSE_VZ0, FLUID_SPARSE_VX0, FLUID_SPARSE_VY0, FLUID_SPARSE_VZ0, dt);
+
+	cube->maxSpeed = project(cube, FLUID_SPARSE_VX, FLUID_SPARSE_VY, FLUID_SPARSE_VZ, FLUID_SPARSE_VX0, FLUID_SPARSE_VY0, 4);
+
+	diffuse(cube, 0, FLUID_SPARSE_S, FLUID_SPARSE_DENSITY, diff, dt, 4);
+	advect(cube, 0, FLUID_SPARSE_DENSITY, FLUID_SPARSE_S, FLUID_SPARSE_VX, FLUID_SPARSE_VY, FLUID_SPARSE_VZ, dt);
+
+	retireEmpty(cube);
+}
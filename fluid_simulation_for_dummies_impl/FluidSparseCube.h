@@ -0,0 +1,72 @@
+#pragma once
+#include <vector>
+
+// Bricks hold FLUID_BRICK_SIZE^3 cells; the cube size must be a multiple of FLUID_BRICK_SIZE.
+#define FLUID_BRICK_SHIFT 3
+#define FLUID_BRICK_SIZE (1 << FLUID_BRICK_SHIFT)
+#define FLUID_BRICK_CELLS (FLUID_BRICK_SIZE * FLUID_BRICK_SIZE * FLUID_BRICK_SIZE)
+
+enum FluidSparseField
+{
+	FLUID_SPARSE_S,
+	FLUID_SPARSE_DENSITY,
+	FLUID_SPARSE_VX,
+	FLUID_SPARSE_VY,
+	FLUID_SPARSE_VZ,
+	FLUID_SPARSE_VX0,
+	FLUID_SPARSE_VY0,
+	FLUID_SPARSE_VZ0,
+	FLUID_SPARSE_FIELD_COUNT
+};
+
+struct FluidBrick
+{
+	int x;
+	int y;
+	int z;
+	float fields[FLUID_SPARSE_FIELD_COUNT][FLUID_BRICK_CELLS];
+};
+
+/*
+Same solver as FluidCube, but the fields only exist in bricks that hold fluid. Everything outside the active
+bricks reads as 0. Each step first activates the bricks that advection and the solver can reach, then returns
+bricks whose density and velocity stay within threshold to the pool, so memory and work follow the fluid
+rather than the domain.
+*/
+struct FluidSparseCube
+{
+	int size;
+	int bricksPerSide;
+	float dt;
+	float diff;
+	float visc;
+	float threshold;
+	// Largest velocity component seen by the last projection, in grid units per time.
+	float maxSpeed;
+
+	// bricksPerSide^3 entries indexing bricks, -1 where the brick is inactive.
+	int* brickTable;
+	// Active bricks ordered by position, so the Gauss-Seidel sweeps visit them in a fixed order.
+	std::vector<FluidBrick*> bricks;
+	std::vector<FluidBrick*> pool;
+
+	FluidSparseCube() = default;
+};
+
+FluidSparseCube* FluidSparseCreate(int size, float diffusion, float viscosity, float dt, float threshold);
+
+void FluidSparseFree(FluidSparseCube* cube);
+
+void FluidSparseAddDensity(FluidSparseCube* cube, int x, int y, int z, float amount);
+
+void FluidSparseAddVelocity(FluidSparseCube* cube, int x, int y, int z, float amountX, float amountY, float amountZ);
+
+void FluidSparseStep(FluidSparseCube* cube);
+
+float FluidSparseValue(const FluidSparseCube* cube, FluidSparseField field, int x, int y, int z);
+
+// Writes the size^2 cells of slice z into out, row-major in x.
+void FluidSparseSlice(const FluidSparseCube* cube, FluidSparseField field, int z, float* out);
+
+// Writes the maximum along z of every (x, y) column into out; only active bricks are visited.
+void FluidSparseProjection(const FluidSparseCube* cube, FluidSparseField field, float* out);
@@ -1,26 +1,41 @@
 #include "FluidSquare.h"
 #include <malloc.h>
 #include <iostream> 
-#define IX_2D(x,y) ((x) + (y) * N)
+#include <cmath>
+#include <cstring>
+#define IX_2D(x,y) ((size_t)(x) + (size_t)(y) * Nx)
 
 FluidSquare* FluidSquareCreate(int size, int diffusion, int viscosity, float dt)
+{
+	return FluidSquareCreateRect(size, size, diffusion, viscosity, dt);
+}
+
+FluidSquare* FluidSquareCreateRect(int sizeX, int sizeY, float diffusion, float viscosity, float dt)
 {
 	FluidSquare* square = new FluidSquare;
-	int N = size;
+	size_t cells = (size_t)sizeX * sizeY;
 
-	square->size = size;
+	square->sizeX = sizeX;
+	square->sizeY = sizeY;
 	square->dt = dt;
 	square->diff = diffusion;
 	square->visc = viscosity;
 
-	square->s = new float[N * N];
-	square->density = new float[N * N];
+	square->s = new float[cells];
+	square->density = new float[cells];
+
+	square->Vx = new float[cells];
+	square->Vy = new float[cells];
 
-	square->Vx = new float[N * N];
-	square->Vy = new float[N * N];
+	square->Vx0 = new float[cells];
+	square->Vy0 = new float[cells];
 
-	square->Vx0 = new float[N * N];
-	square->Vy0 = new float[N * N];
+	square->tilesX = (sizeX + FLUID_SQUARE_TILE_SIZE - 1) / FLUID_SQUARE_TILE_SIZE;
+	square->tilesY = (sizeY + FLUID_SQUARE_TILE_SIZE - 1) / FLUID_SQUARE_TILE_SIZE;
+	square->dirtyTiles = new unsigned char[square->tilesX * square->tilesY];
+	square->tileThreshold = 0.f;
+	square->stats = nullptr;
+	memset(square->dirtyTiles, 1, square->tilesX * square->tilesY);
 
 	return square;
 }
@@ -36,19 +51,22 @@ void FluidSquareFree(FluidSquare* square)
 	delete[] square->Vx0;
 	delete[] square->Vy0;
 
+	delete[] square->dirtyTiles;
+
 	free(square);
 }
 
 void FluidSquareAddDensity(FluidSquare* square, int x, int y, float amount)
 {
-	int N = square->size;
+	int Nx = square->sizeX;
 	square->density[IX_2D(x, y)] += amount;
+	square->dirtyTiles[y / FLUID_SQUARE_TILE_SIZE * square->tilesX + x / FLUID_SQUARE_TILE_SIZE] = 1;
 }
 
 void FluidSquareAddVelocity(FluidSquare* square, int x, int y, float amountX, float amountY)
 {
-	int N = square->size;
-	int index = IX_2D(x, y);
+	int Nx = square->sizeX;
+	size_t index = IX_2D(x, y);
 
 	square->Vx[index] += amountX;
 	square->Vy[index] += amountY;
@@ -56,7 +74,13 @@ void FluidSquareAddVelocity(FluidSquare* square, int x, int y, float amountX, fl
 
 void FluidSquareStep(FluidSquare* square)
 {
-	int N = square->size;
+	FluidSquareStepInto(square, square->density);
+}
+
+void FluidSquareStepInto(FluidSquare* square, float* densityOut)
+{
+	int Nx = square->sizeX;
+	int Ny = square->sizeY;
 	float visc = square->visc;
 	float diff = square->diff;
 	float dt = square->dt;
@@ -67,131 +91,184 @@ void FluidSquareStep(FluidSquare* square)
 	float* s = square->s;
 	float* density = square->density;
 
-	diffuse_2D(1, Vx0, Vx, visc, dt, 4, N);
-	diffuse_2D(2, Vy0, Vy, visc, dt, 4, N);
+	diffuse_2D(1, Vx0, Vx, visc, dt, 4, Nx, Ny);
+	diffuse_2D(2, Vy0, Vy, visc, dt, 4, Nx, Ny);
 
-	project_2D(Vx0, Vy0, Vx, Vy, 4, N);
+	project_2D(Vx0, Vy0, Vx, Vy, 4, Nx, Ny);
 
-	advect_2D(1, Vx, Vx0, Vx0, Vy0, dt, N);
-	advect_2D(2, Vy, Vy0, Vx0, Vy0, dt, N);
+	advect_2D(1, Vx, Vx0, Vx0, Vy0, dt, Nx, Ny);
+	advect_2D(2, Vy, Vy0, Vx0, Vy0, dt, Nx, Ny);
 
-	project_2D(Vx, Vy, Vx0, Vy0, 4, N);
+	project_2D(Vx, Vy, Vx0, Vy0, 4, Nx, Ny, square->stats);
 
-	diffuse_2D(0, s, density, diff, dt, 4, N);
-	advect_2D(0, density, s, Vx, Vy, dt, N);
+	diffuse_2D(0, s, density, diff, dt, 4, Nx, Ny);
+	advect_2D(0, densityOut, s, Vx, Vy, dt, Nx, Ny, density, square->dirtyTiles, square->tileThreshold, square->stats);
+	square->density = densityOut;
 }
 
-void set_bnd_2D(int b, float* x, int N)
+void FluidSquareClearDirtyTiles(FluidSquare* square)
 {
-	for (int i = 1; i < N - 1; i++)
+	memset(square->dirtyTiles, 0, square->tilesX * square->tilesY);
+}
+
+/*
+set_bnd_2D copies each boundary cell from its interior neighbour, which shares its tile unless the last row or
+column of cells starts a tile of its own; that tile then follows the one next to it.
+*/
+static void markBoundaryTiles_2D(unsigned char* dirtyTiles, int Nx, int Ny)
+{
+	int tilesX = (Nx + FLUID_SQUARE_TILE_SIZE - 1) / FLUID_SQUARE_TILE_SIZE;
+	int tilesY = (Ny + FLUID_SQUARE_TILE_SIZE - 1) / FLUID_SQUARE_TILE_SIZE;
+
+	if ((Nx - 1) % FLUID_SQUARE_TILE_SIZE == 0 && tilesX >= 2)
+	{
+		for (int t = 0; t < tilesY; t++)
+			dirtyTiles[t * tilesX + tilesX - 1] |= dirtyTiles[t * tilesX + tilesX - 2];
+	}
+	if ((Ny - 1) % FLUID_SQUARE_TILE_SIZE == 0 && tilesY >= 2)
+	{
+		for (int t = 0; t < tilesX; t++)
+			dirtyTiles[(tilesY - 1) * tilesX + t] |= dirtyTiles[(tilesY - 2) * tilesX + t];
+	}
+}
+
+void set_bnd_2D(int b, float* x, int Nx, int Ny)
+{
+	for (int i = 1; i < Nx - 1; i++)
 	{
 		x[IX_2D(i, 0)] = b == 2 ? -x[IX_2D(i, 1)] : x[IX_2D(i, 1)];
-		x[IX_2D(i, N - 1)] = b == 2 ? -x[IX_2D(i, N - 2)] : x[IX_2D(i, N - 2)];
+		x[IX_2D(i, Ny - 1)] = b == 2 ? -x[IX_2D(i, Ny - 2)] : x[IX_2D(i, Ny - 2)];
 	}
-	for (int j = 1; j < N - 1; j++)
+	for (int j = 1; j < Ny - 1; j++)
 	{
 		x[IX_2D(0, j)] = b == 1 ? -x[IX_2D(1, j)] : x[IX_2D(1, j)];
-		x[IX_2D(N - 1, j)] = b == 1 ? -x[IX_2D(N - 2, j)] : x[IX_2D(N - 2, j)];
+		x[IX_2D(Nx - 1, j)] = b == 1 ? -x[IX_2D(Nx - 2, j)] : x[IX_2D(Nx - 2, j)];
 	}
 
 	x[IX_2D(0, 0)] = .5f * (x[IX_2D(1, 0)] + x[IX_2D(0, 1)]);
-	x[IX_2D(0, N - 1)] = .5f * (x[IX_2D(1, N - 1)] + x[IX_2D(0, N - 2)]);
-	x[IX_2D(N - 1, 0)] = .5f * (x[IX_2D(N - 2, 0)] + x[IX_2D(N - 1, 1)]);
-	x[IX_2D(N - 1, N - 1)] = .5f * (x[IX_2D(N - 2, N - 1)] + x[IX_2D(N - 1, N - 2)]);
+	x[IX_2D(0, Ny - 1)] = .5f * (x[IX_2D(1, Ny - 1)] + x[IX_2D(0, Ny - 2)]);
+	x[IX_2D(Nx - 1, 0)] = .5f * (x[IX_2D(Nx - 2, 0)] + x[IX_2D(Nx - 1, 1)]);
+	x[IX_2D(Nx - 1, Ny - 1)] = .5f * (x[IX_2D(Nx - 2, Ny - 1)] + x[IX_2D(Nx - 1, Ny - 2)]);
 }
 
-void lin_solve_2D(int b, float* x, float* x0, float a, float c, int iter, int N)
+// ax and ay weight the neighbours along each axis, which differ once the cells are not squares.
+void lin_solve_2D(int b, float* x, float* x0, float ax, float ay, float c, int iter, int Nx, int Ny)
 {
 	float cRecip = 1.f / c;
 
 	for (int k = 0; k < iter; k++)
 	{
-		for (int j = 1; j < N - 2; j++)
+		for (int j = 1; j < Ny - 1; j++)
 		{
-			for (int i = 1; i < N - 2; i++)
+			for (int i = 1; i < Nx - 1; i++)
 			{
 				x[IX_2D(i, j)] = (x0[IX_2D(i, j)]
-					+ a * (
-						x[IX_2D(i + 1, j)]
-						+ x[IX_2D(i - 1, j)]
-						+ x[IX_2D(i, j + 1)]
-						+ x[IX_2D(i, j - 1)]
-						)) * cRecip;
+					+ ax * (x[IX_2D(i + 1, j)] + x[IX_2D(i - 1, j)])
+					+ ay * (x[IX_2D(i, j + 1)] + x[IX_2D(i, j - 1)])
+					) * cRecip;
 			}
 		}
 	}
 
-	set_bnd_2D(b, x, N);
+	set_bnd_2D(b, x, Nx, Ny);
 }
 
-void diffuse_2D(int b, float* x, float* x0, float diff, float dt, int iter, int N)
+void diffuse_2D(int b, float* x, float* x0, float diff, float dt, int iter, int Nx, int Ny)
 {
-	float a = dt * diff * (N - 2) * (N - 2);
-	lin_solve_2D(b, x, x0, a, 1 + 6 * a, iter, N);
+	float ax = dt * diff * (Nx - 2) * (Nx - 2);
+	float ay = dt * diff * (Ny - 2) * (Ny - 2);
+	lin_solve_2D(b, x, x0, ax, ay, 1 + 2 * (ax + ay), iter, Nx, Ny);
 }
 
-void project_2D(float* velocX, float* velocY, float* p, float* div, int iter, int N)
+/*
+Same scaling as the 3D project: pressure in units of the x spacing, y weighted by how much finer it is. stats gets
+the kinetic energy and largest speed of the new velocity.
+*/
+void project_2D(float* velocX, float* velocY, float* p, float* div, int iter, int Nx, int Ny, FluidStats* stats)
 {
-	for (int j = 1; j < N - 1; j++)
+	float wy = (float)Ny * Ny / ((float)Nx * Nx);
+	float scaleY = (float)Ny / Nx;
+
+	for (int j = 1; j < Ny - 1; j++)
 	{
-		for (int i = 1; i < N - 1; i++)
+		for (int i = 1; i < Nx - 1; i++)
 		{
 			div[IX_2D(i, j)] = -.5f * (
 				velocX[IX_2D(i + 1, j)]
 				- velocX[IX_2D(i - 1, j)]
-				+ velocY[IX_2D(i, j + 1)]
-				- velocY[IX_2D(i, j - 1)]
-				) / N;
+				+ scaleY * (velocY[IX_2D(i, j + 1)]
+					- velocY[IX_2D(i, j - 1)])
+				) / Nx;
 			p[IX_2D(i, j)] = 0;
 		}
 	}
-	set_bnd_2D(0, div, N);
-	set_bnd_2D(0, p, N);
-	lin_solve_2D(0, p, div, 1, 6, iter, N);
+	set_bnd_2D(0, div, Nx, Ny);
+	set_bnd_2D(0, p, Nx, Ny);
+	lin_solve_2D(0, p, div, 1, wy, 2 * (1 + wy), iter, Nx, Ny);
 
-	for (int j = 1; j < N - 1; j++)
+	double energy = 0.;
+	float squaredSpeed = 0.f;
+	for (int j = 1; j < Ny - 1; j++)
 	{
-		for (int i = 1; i < N - 1; i++)
+		for (int i = 1; i < Nx - 1; i++)
 		{
-			velocX[IX_2D(i, j)] -= .5f * (p[IX_2D(i + 1, j)] - p[IX_2D(i - 1, j)]) * N;
-			velocY[IX_2D(i, j)] -= .5f * (p[IX_2D(i, j + 1)] - p[IX_2D(i, j - 1)]) * N;
+			velocX[IX_2D(i, j)] -= .5f * (p[IX_2D(i + 1, j)] - p[IX_2D(i - 1, j)]) * Nx;
+			velocY[IX_2D(i, j)] -= .5f * (p[IX_2D(i, j + 1)] - p[IX_2D(i, j - 1)]) * Ny;
+			if (stats)
+			{
+				float squared = velocX[IX_2D(i, j)] * velocX[IX_2D(i, j)] + velocY[IX_2D(i, j)] * velocY[IX_2D(i, j)];
+				energy += squared;
+				squaredSpeed = squared > squaredSpeed ? squared : squaredSpeed;
+			}
 		}
 	}
-	set_bnd_2D(1, velocX, N);
-	set_bnd_2D(2, velocY, N);
+	if (stats)
+	{
+		stats->kineticEnergy = .5 * energy;
+		stats->maxSpeed = sqrtf(squaredSpeed);
+	}
+	set_bnd_2D(1, velocX, Nx, Ny);
+	set_bnd_2D(2, velocY, Nx, Ny);
 }
 
-void advect_2D(int b, float* d, float* d0, float* velocX, float* velocY, float dt, int N)
+// stats gets the total of d and the largest divergence of the velocity, which is read here anyway.
+void advect_2D(int b, float* d, float* d0, float* velocX, float* velocY, float dt, int Nx, int Ny,
+	const float* previous, unsigned char* dirtyTiles, float threshold, FluidStats* stats)
 {
+	int tilesX = (Nx + FLUID_SQUARE_TILE_SIZE - 1) / FLUID_SQUARE_TILE_SIZE;
+	float scaleY = (float)Ny / Nx;
+	double total = 0.;
+	float maxDivergence = 0.f;
+
 	float i0, i1, j0, j1;
 
-	float dtx = dt * (N - 2);
-	float dty = dt * (N - 2);
+	float dtx = dt * (Nx - 2);
+	float dty = dt * (Ny - 2);
 
 	float s0, s1, t0, t1;
 	float tmp1, tmp2, x, y;
 
-	float Nfloat = N;
-	float ifloat = 0.f, jfloat = 0.f;
+	float maxX = Nx - 1.5f;
+	float maxY = Ny - 1.5f;
 	int i, j;
 
-	for (j = 1; j < N - 1; j++, jfloat++)
+	for (j = 1; j < Ny - 1; j++)
 	{
-		for (i = 1; i < N - 1; i++, ifloat)
+		for (i = 1; i < Nx - 1; i++)
 		{
 			tmp1 = dtx * velocX[IX_2D(i, j)];
 			tmp2 = dty * velocY[IX_2D(i, j)];
 
-			x = ifloat - tmp1;
-			y = jfloat - tmp2;
+			x = i - tmp1;
+			y = j - tmp2;
 
 			if (x < .5f) x = .5f;
-			if (x > Nfloat + .5f) x = Nfloat + .5f;
+			if (x > maxX) x = maxX;
 			i0 = floorf(x);
 			i1 = i0 + 1.0f;
 
 			if (y < .5f) y = .5f;
-			if (y > Nfloat + .5f) y = Nfloat + .5f;
+			if (y > maxY) y = maxY;
 			j0 = floorf(y);
 			j1 = j0 + 1.0f;
 
@@ -205,12 +282,36 @@ void advect_2D(int b, float* d, float* d0, float* velocX, float* velocY, float d
 			int j0i = j0;
 			int j1i = j1;
 
-			d[IX_2D(i, j)] =
+			float value =
 				s0 * (t0 * d0[IX_2D(i0i, j0i)]
 					+ t1 * d0[IX_2D(i0i, j1i)]) + 
 				s1 * (t0 * d0[IX_2D(i1i, j0i)]
 					+ t1 * d0[IX_2D(i1i, j1i)]);
+
+			// Read before the store: previous may be d itself when stepping in place.
+			if (dirtyTiles)
+				dirtyTiles[j / FLUID_SQUARE_TILE_SIZE * tilesX + i / FLUID_SQUARE_TILE_SIZE] |= fabsf(value - previous[IX_2D(i, j)]) > threshold;
+			d[IX_2D(i, j)] = value;
+
+			if (stats)
+			{
+				total += value;
+				float divergence = .5f * (
+					velocX[IX_2D(i + 1, j)]
+					- velocX[IX_2D(i - 1, j)]
+					+ scaleY * (velocY[IX_2D(i, j + 1)]
+						- velocY[IX_2D(i, j - 1)])
+					) / Nx;
+				maxDivergence = fabsf(divergence) > maxDivergence ? fabsf(divergence) : maxDivergence;
+			}
 		}
 	}
-	set_bnd_2D(b, d, N);
+	if (stats)
+	{
+		stats->mass = total;
+		stats->maxDivergence = maxDivergence;
+	}
+	set_bnd_2D(b, d, Nx, Ny);
+	if (dirtyTiles)
+		markBoundaryTiles_2D(dirtyTiles, Nx, Ny);
 }
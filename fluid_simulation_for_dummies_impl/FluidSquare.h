@@ -1,7 +1,14 @@
 #pragma once
+#include "FluidStats.h"
+
+// Side length, in cells, of the density tiles tracked in FluidSquare::dirtyTiles.
+#define FLUID_SQUARE_TILE_SIZE 16
+
 struct FluidSquare
 {
-	int size;
+	// Cells per axis, walls included; both axes span the same unit length.
+	int sizeX;
+	int sizeY;
 	float dt;
 	float diff;
 	float visc;
@@ -15,11 +22,23 @@ struct FluidSquare
 	float* Vx0;
 	float* Vy0;
 
+	// One byte per density tile, row-major, set when a cell in the tile changed by more than tileThreshold.
+	// Tiles stay set until FluidSquareClearDirtyTiles, so a consumer sees everything since its last update.
+	unsigned char* dirtyTiles;
+	int tilesX;
+	int tilesY;
+	float tileThreshold;
+
+	// When set, every step overwrites it with the FluidStats of the fields it leaves.
+	FluidStats* stats;
+
 	FluidSquare() = default;
 };
 
 FluidSquare* FluidSquareCreate(int size, int diffusion, int viscosity, float dt);
 
+FluidSquare* FluidSquareCreateRect(int sizeX, int sizeY, float diffusion, float viscosity, float dt);
+
 void FluidSquareFree(FluidSquare* square);
 
 void FluidSquareAddDensity(FluidSquare* square, int x, int y, float amount);
@@ -28,12 +47,22 @@ void FluidSquareAddVelocity(FluidSquare* square, int x, int y, float amountX, fl
 
 void FluidSquareStep(FluidSquare* square);
 
-static void set_bnd_2D(int b, float* x, int N);
+/*
+Runs a step whose density is advected straight into densityOut, which then becomes square->density; the old
+array is only read. This lets the field live in caller memory such as a mapped pixel buffer. The array from
+FluidSquareCreate must be put back into square->density before FluidSquareFree.
+*/
+void FluidSquareStepInto(FluidSquare* square, float* densityOut);
+
+void FluidSquareClearDirtyTiles(FluidSquare* square);
+
+static void set_bnd_2D(int b, float* x, int Nx, int Ny);
 
-static void lin_solve_2D(int b, float* x, float* x0, float a, float c, int iter, int N);
+static void lin_solve_2D(int b, float* x, float* x0, float ax, float ay, float c, int iter, int Nx, int Ny);
 
-static void diffuse_2D(int b, float* x, float* x0, float diff, float dt, int iter, int N);
+static void diffuse_2D(int b, float* x, float* x0, float diff, float dt, int iter, int Nx, int Ny);
 
-static void project_2D(float* velocX, float* velocY, float* p, float* div, int iter, int N);
+static void project_2D(float* velocX, float* velocY, float* p, float* div, int iter, int Nx, int Ny, FluidStats* stats = nullptr);
 
-static void advect_2D(int b, float* d, float* d0, float* velocX, float* velocY, float dt, int N);
\ No newline at end of file
+static void advect_2D(int b, float* d, float* d0, float* velocX, float* velocY, float dt, int Nx, int Ny,
+	const float* previous = nullptr, unsigned char* dirtyTiles = nullptr, float threshold = 0.f, FluidStats* stats = nullptr);
\ No newline at end of file
@@ -0,0 +1,18 @@
+#pragma once
+
+/*
+Totals over the interior cells at the end of a step. The solvers gather them in loops that already read each
+field: kinetic energy and speed as the last projection writes the velocity, mass and divergence as the dye is
+advected along it.
+*/
+struct FluidStats
+{
+	// Sum of density.
+	double mass;
+	// Half the sum of the squared velocity, in grid units per time.
+	double kineticEnergy;
+	// Largest velocity magnitude.
+	float maxSpeed;
+	// Largest divergence the projection left, in the units it solves in.
+	float maxDivergence;
+};
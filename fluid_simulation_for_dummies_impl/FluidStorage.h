@@ -0,0 +1,173 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+/*
+Number formats a FluidCube can keep its fields in. Only the fields that carry state from one step to the next take
+the narrow format: s, Vx0, Vy0 and Vz0 are scratch for the solves and stay FP32, so the pressure and the diffused
+values are never rounded. The kernels compute in float and convert a row at a time. A narrow cube takes a quarter
+less memory; the Gauss-Seidel sweeps are bound by their own recurrence rather than by bandwidth, so its steps take
+about as long as in FP32.
+*/
+enum FluidStorageKind
+{
+	FLUID_STORAGE_FP32,
+	// IEEE half: 11 significant bits, values up to 65504.
+	FLUID_STORAGE_FP16,
+	// The upper half of a float: float's range with 8 significant bits.
+	FLUID_STORAGE_BF16,
+	// density as int16 scaled to a fixed range; the velocity, whose range is not known in advance, is kept in FP16.
+	FLUID_STORAGE_INT16
+};
+
+inline float FluidAsFloat(uint32_t bits)
+{
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+inline uint32_t FluidAsBits(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+/*
+Round to nearest even, like the F16C instructions the kernels use where the processor has them. This is plain code
+on purpose: the kernel files built for wider instruction sets include this header too, and an inline function must
+compile the same in all of them. Every case is worked out and the right one selected, so loops over a row compile
+to vector code.
+*/
+inline uint16_t FluidFloatToHalf(float value)
+{
+	uint32_t bits = FluidAsBits(value);
+	uint32_t sign = bits & 0x80000000u;
+	bits ^= sign;
+	uint32_t overflow = bits > 0x7F800000u ? 0x7E00 : 0x7C00;
+	// Subnormal halves shift the mantissa right by 14 to 24 places, and 31 leaves anything smaller at zero. This is
+	// integer work since float arithmetic on the tiny values the solves leave would stall on denormals.
+	uint32_t shift = 126 - (bits >> 23);
+	shift = shift < 14 || shift > 31 ? 31 : shift;
+	uint32_t mantissa = (bits & 0x7FFFFFu) | 0x800000u;
+	uint32_t subnormal = (mantissa + (1u << (shift - 1)) - 1 + ((mantissa >> shift) & 1)) >> shift;
+	uint32_t normal = (bits + ((uint32_t)(15 - 127) << 23) + 0xFFF + ((bits >> 13) & 1)) >> 13;
+	uint32_t half = bits >= 0x47800000u ? overflow : bits < 0x38800000u ? subnormal : normal;
+	return (uint16_t)(half | (sign >> 16));
+}
+
+inline float FluidHalfToFloat(uint16_t half)
+{
+	uint32_t bits = (uint32_t)(half & 0x7FFF) << 13;
+	uint32_t exponent = bits & (0x7C00u << 13);
+	uint32_t normal = bits + ((uint32_t)(127 - 15) << 23);
+	uint32_t special = normal + ((uint32_t)(128 - 16) << 23);
+	uint32_t subnormal = FluidAsBits(FluidAsFloat(bits + (113u << 23)) - FluidAsFloat(113u << 23));
+	bits = exponent == 0x7C00u << 13 ? special : exponent == 0 ? subnormal : normal;
+	return FluidAsFloat(bits | (uint32_t)(half & 0x8000) << 16);
+}
+
+inline uint16_t FluidFloatToBfloat(float value)
+{
+	uint32_t bits = FluidAsBits(value);
+	uint32_t rounded = (bits + 0x7FFF + ((bits >> 16) & 1)) >> 16;
+	return (uint16_t)((bits & 0x7FFFFFFFu) > 0x7F800000u ? (bits >> 16) | 0x40 : rounded);
+}
+
+inline float FluidBfloatToFloat(uint16_t bfloat)
+{
+	return FluidAsFloat((uint32_t)bfloat << 16);
+}
+
+// scale is the steps per unit: the range maps onto +-32767 and anything beyond saturates.
+inline int16_t FluidFloatToFixed(float value, float scale)
+{
+	float scaled = value * scale;
+	scaled = scaled > 32767.f ? 32767.f : scaled < -32767.f ? -32767.f : scaled;
+	return (int16_t)(scaled < 0.f ? scaled - .5f : scaled + .5f);
+}
+
+inline float FluidFixedToFloat(int16_t fixed, float scale)
+{
+	return fixed / scale;
+}
+
+/*
+A field in any storage for the kernel templates. Indexing it gives a reference that reads and writes float, so
+the kernels are written once for float* and this alike; each access converts one cell. Assigning one reference
+to another copies the value. scale is the steps per unit of FLUID_STORAGE_INT16.
+*/
+struct FluidStoredField
+{
+	struct Reference
+	{
+		void* cells;
+		size_t index;
+		FluidStorageKind storage;
+		float scale;
+
+		operator float() const
+		{
+			switch (storage)
+			{
+			case FLUID_STORAGE_FP16:
+				return FluidHalfToFloat(((const uint16_t*)cells)[index]);
+			case FLUID_STORAGE_BF16:
+				return FluidBfloatToFloat(((const uint16_t*)cells)[index]);
+			case FLUID_STORAGE_INT16:
+				return FluidFixedToFloat(((const int16_t*)cells)[index], scale);
+			default:
+				return ((const float*)cells)[index];
+			}
+		}
+		Reference& operator=(float value)
+		{
+			switch (storage)
+			{
+			case FLUID_STORAGE_FP16:
+				((uint16_t*)cells)[index] = FluidFloatToHalf(value);
+				break;
+			case FLUID_STORAGE_BF16:
+				((uint16_t*)cells)[index] = FluidFloatToBfloat(value);
+				break;
+			case FLUID_STORAGE_INT16:
+				((int16_t*)cells)[index] = FluidFloatToFixed(value, scale);
+				break;
+			default:
+				((float*)cells)[index] = value;
+				break;
+			}
+			return *this;
+		}
+		Reference& operator=(const Reference& other) { return *this = (float)other; }
+		Reference& operator-=(float value) { return *this = (float)*this - value; }
+	};
+
+	void* cells;
+	FluidStorageKind storage;
+	float scale;
+
+	Reference operator[](size_t index) const { return Reference{ cells, index, storage, scale }; }
+};
+
+// Bytes a cell of a field takes in storage.
+inline int FluidStorageBytes(FluidStorageKind storage)
+{
+	return storage == FLUID_STORAGE_FP32 ? 4 : 2;
+}
+
+inline const char* FluidStorageName(FluidStorageKind storage)
+{
+	switch (storage)
+	{
+	case FLUID_STORAGE_FP16:
+		return "fp16";
+	case FLUID_STORAGE_BF16:
+		return "bf16";
+	case FLUID_STORAGE_INT16:
+		return "int16";
+	default:
+		return "fp32";
+	}
+}
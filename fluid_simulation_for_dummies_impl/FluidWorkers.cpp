@@ -0,0 +1,335 @@
+#include "FluidWorkers.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+// Memory policy modes from linux/mempolicy.h, which is not installed everywhere.
+static const int mpolBind = 2;
+static const int mpolInterleave = 3;
+static const int maxNodes = 64;
+
+struct FluidWorkers
+{
+	FluidPlacement placement;
+	std::vector<std::thread> threads;
+	// Node and CPU per worker; cpu is -1 when the worker is not pinned.
+	std::vector<int> nodes;
+	std::vector<int> cpus;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	uint64_t generation;
+	int remaining;
+	bool stopping;
+	const std::function<void(int, int, int)>* job;
+	int count;
+
+	std::atomic<int> arrived;
+	std::atomic<uint32_t> barrierGeneration;
+};
+
+#ifdef __linux__
+static std::vector<int> parseCpuList(const std::string& list)
+{
+	std::vector<int> cpus;
+	size_t position = 0;
+	while (position < list.size())
+	{
+		size_t comma = list.find(',', position);
+		std::string range = list.substr(position, comma == std::string::npos ? std::string::npos : comma - position);
+		size_t dash = range.find('-');
+		int first = atoi(range.c_str());
+		int last = dash == std::string::npos ? first : atoi(range.c_str() + dash + 1);
+		for (int cpu = first; cpu <= last; cpu++)
+			cpus.push_back(cpu);
+		if (comma == std::string::npos)
+			break;
+		position = comma + 1;
+	}
+	return cpus;
+}
+#endif
+
+// CPUs this process may run on, grouped by NUMA node. Machines without node information count as one node.
+static std::vector<std::vector<int>> nodeCpus()
+{
+	std::vector<std::vector<int>> nodes;
+#ifdef __linux__
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	sched_getaffinity(0, sizeof(allowed), &allowed);
+	for (int node = 0; node < maxNodes; node++)
+	{
+		std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+		std::string list;
+		if (!file || !std::getline(file, list))
+			continue;
+		std::vector<int> cpus;
+		for (int cpu : parseCpuList(list))
+			if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+				cpus.push_back(cpu);
+		if (!cpus.empty())
+		{
+			nodes.resize(node + 1);
+			nodes[node] = cpus;
+		}
+	}
+	if (nodes.empty())
+	{
+		nodes.resize(1);
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (CPU_ISSET(cpu, &allowed))
+				nodes[0].push_back(cpu);
+	}
+#else
+	nodes.resize(1);
+	int processors = (int)std::thread::hardware_concurrency();
+	for (int cpu = 0; cpu < (processors > 0 ? processors : 1); cpu++)
+		nodes[0].push_back(cpu);
+#endif
+	return nodes;
+}
+
+static void pinCurrentThread(int cpu)
+{
+#ifdef _WIN32
+	if (cpu < 64)
+		SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu);
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+		std::cout << "WORKER_PIN_FAILED::" << cpu << std::endl;
+#else
+	(void)cpu;
+#endif
+}
+
+static void shareOf(int worker, int workers, int count, int& begin, int& end)
+{
+	begin = (int)((int64_t)count * worker / workers);
+	end = (int)((int64_t)count * (worker + 1) / workers);
+}
+
+static void workerLoop(FluidWorkers* workers, int worker)
+{
+	if (workers->cpus[worker] >= 0)
+		pinCurrentThread(workers->cpus[worker]);
+
+	uint64_t seen = 0;
+	std::unique_lock<std::mutex> guard(workers->lock);
+	for (;;)
+	{
+		workers->wake.wait(guard, [&] { return workers->stopping || workers->generation != seen; });
+		if (workers->stopping)
+			return;
+		seen = workers->generation;
+		const std::function<void(int, int, int)>& job = *workers->job;
+		int begin, end;
+		shareOf(worker, (int)workers->threads.size(), workers->count, begin, end);
+		guard.unlock();
+
+		job(worker, begin, end);
+
+		guard.lock();
+		if (--workers->remaining == 0)
+			workers->done.notify_one();
+	}
+}
+
+FluidWorkers* FluidWorkersCreate(int threads, FluidPlacement placement)
+{
+	if (threads < 1)
+		threads = (int)std::thread::hardware_concurrency();
+	if (threads < 1)
+		threads = 1;
+
+	FluidWorkers* workers = new FluidWorkers;
+	workers->placement = placement;
+	workers->generation = 0;
+	workers->remaining = 0;
+	workers->stopping = false;
+	workers->job = nullptr;
+	workers->count = 0;
+	workers->arrived.store(0);
+	workers->barrierGeneration.store(0);
+
+	// Consecutive workers share a node, so consecutive slabs of planes do as well.
+	std::vector<std::vector<int>> nodes = nodeCpus();
+	std::vector<int> populated;
+	for (int node = 0; node < (int)nodes.size(); node++)
+		if (!nodes[node].empty())
+			populated.push_back(node);
+	for (int worker = 0; worker < threads; worker++)
+	{
+		int slot = (int)((int64_t)worker * populated.size() / threads);
+		int node = populated[slot];
+		int firstOnNode = (int)(((int64_t)slot * threads + populated.size() - 1) / populated.size());
+		const std::vector<int>& cpus = nodes[node];
+		workers->nodes.push_back(placement == FLUID_PLACEMENT_NONE ? 0 : node);
+		workers->cpus.push_back(placement == FLUID_PLACEMENT_NONE ? -1 : cpus[(worker - firstOnNode) % cpus.size()]);
+	}
+
+	for (int worker = 0; worker < threads; worker++)
+		workers->threads.emplace_back(workerLoop, workers, worker);
+	return workers;
+}
+
+void FluidWorkersFree(FluidWorkers* workers)
+{
+	{
+		std::lock_guard<std::mutex> guard(workers->lock);
+		workers->stopping = true;
+	}
+	workers->wake.notify_all();
+	for (std::thread& thread : workers->threads)
+		thread.join();
+	delete workers;
+}
+
+int FluidWorkersCount(const FluidWorkers* workers)
+{
+	return (int)workers->threads.size();
+}
+
+int FluidWorkersNode(const FluidWorkers* workers, int worker)
+{
+	return workers->nodes[worker];
+}
+
+void FluidWorkersRun(FluidWorkers* workers, int count, const std::function<void(int worker, int begin, int end)>& planes)
+{
+	std::unique_lock<std::mutex> guard(workers->lock);
+	workers->job = &planes;
+	workers->count = count;
+	workers->remaining = (int)workers->threads.size();
+	workers->generation++;
+	workers->wake.notify_all();
+	workers->done.wait(guard, [&] { return workers->remaining == 0; });
+	workers->job = nullptr;
+}
+
+// Barriers come once per diagonal inside lin_solve, too often to sleep on a condition variable each time.
+void FluidWorkersBarrier(FluidWorkers* workers)
+{
+	uint32_t generation = workers->barrierGeneration.load(std::memory_order_acquire);
+	if (workers->arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == (int)workers->threads.size())
+	{
+		workers->arrived.store(0, std::memory_order_relaxed);
+		workers->barrierGeneration.store(generation + 1, std::memory_order_release);
+		return;
+	}
+	for (int spin = 0; workers->barrierGeneration.load(std::memory_order_acquire) == generation; spin++)
+	{
+		if (spin > 256)
+			std::this_thread::yield();
+	}
+}
+
+static size_t pageSize()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+#else
+	return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+static void bindPages(void* start, size_t length, int mode, const std::vector<int>& nodes)
+{
+#ifdef __linux__
+	unsigned long mask[maxNodes / (8 * sizeof(unsigned long)) + 1] = {};
+	for (int node : nodes)
+		mask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+	if (length && syscall(SYS_mbind, start, length, mode, mask, (unsigned long)maxNodes + 1, 0) != 0)
+		std::cout << "WORKER_MBIND_FAILED::" << mode << std::endl;
+#else
+	(void)start;
+	(void)length;
+	(void)mode;
+	(void)nodes;
+#endif
+}
+
+float* FluidWorkersAllocField(FluidWorkers* workers, size_t planeCells, int planes)
+{
+	size_t bytes = planeCells * planes * sizeof(float);
+	size_t page = pageSize();
+	size_t length = (bytes + page - 1) / page * page;
+#ifdef _WIN32
+	float* field = (float*)VirtualAlloc(nullptr, length, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (!field)
+#else
+	void* mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	float* field = mapped == MAP_FAILED ? nullptr : (float*)mapped;
+	if (!field)
+#endif
+	{
+		std::cout << "FIELD_ALLOCATION_FAILED::" << bytes << std::endl;
+		return nullptr;
+	}
+
+	// Nothing has touched the pages yet, so a policy set now decides where every one of them goes.
+	int threads = FluidWorkersCount(workers);
+	if (workers->placement == FLUID_PLACEMENT_INTERLEAVE)
+	{
+		std::vector<int> nodes(workers->nodes.begin(), workers->nodes.end());
+		bindPages(field, length, mpolInterleave, nodes);
+	}
+	else if (workers->placement == FLUID_PLACEMENT_BIND)
+	{
+		// A page shared by two workers' planes goes to the later one.
+		for (int worker = 0; worker < threads; worker++)
+		{
+			int begin, end;
+			shareOf(worker, threads, planes, begin, end);
+			size_t first = planeCells * begin * sizeof(float) / page * page;
+			size_t last = worker == threads - 1 ? length : planeCells * end * sizeof(float) / page * page;
+			if (first < last)
+				bindPages((char*)field + first, last - first, mpolBind, { workers->nodes[worker] });
+		}
+	}
+
+	FluidWorkersRun(workers, planes, [=](int, int begin, int end)
+	{
+		memset(field + planeCells * begin, 0, planeCells * (end - begin) * sizeof(float));
+	});
+	return field;
+}
+
+void FluidWorkersFreeField(float* field, size_t cells)
+{
+	if (!field)
+		return;
+#ifdef _WIN32
+	(void)cells;
+	VirtualFree(field, 0, MEM_RELEASE);
+#else
+	size_t page = pageSize();
+	munmap(field, (cells * sizeof(float) + page - 1) / page * page);
+#endif
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+
+enum FluidPlacement
+{
+	// Workers may run on any CPU; pages land on the node of whichever worker zeroes them.
+	FLUID_PLACEMENT_NONE,
+	// Workers are pinned and zero their own planes, so each plane lives on the node of the worker that updates it.
+	FLUID_PLACEMENT_FIRST_TOUCH,
+	// As FIRST_TOUCH, but every worker's planes are bound to its node with mbind before they are touched.
+	FLUID_PLACEMENT_BIND,
+	// Pages are spread round-robin over the workers' nodes; workers are still pinned.
+	FLUID_PLACEMENT_INTERLEAVE
+};
+
+struct FluidWorkers;
+
+/*
+A fixed set of threads that split a range of planes between them. Worker t always gets the t-th contiguous share
+of the range, so the planes a worker zeroes when a field is allocated are the ones it updates in every kernel.
+Pinned workers are placed in blocks per NUMA node: the first workers share the first node, and so on.
+*/
+FluidWorkers* FluidWorkersCreate(int threads, FluidPlacement placement);
+
+void FluidWorkersFree(FluidWorkers* workers);
+
+int FluidWorkersCount(const FluidWorkers* workers);
+
+// Node of the CPU the worker is pinned to; 0 when unpinned or on a single-node machine.
+int FluidWorkersNode(const FluidWorkers* workers, int worker);
+
+// Calls planes(worker, begin, end) on every worker for its share of [0, count), which may be empty, and waits
+// for all of them.
+void FluidWorkersRun(FluidWorkers* workers, int count, const std::function<void(int worker, int begin, int end)>& planes);
+
+// Waits until every worker of the running FluidWorkersRun call has reached the barrier; only valid inside one.
+void FluidWorkersBarrier(FluidWorkers* workers);
+
+// Allocates planes * planeCells zeroed floats, placed by the workers' placement policy.
+float* FluidWorkersAllocField(FluidWorkers* workers, size_t planeCells, int planes);
+
+void FluidWorkersFreeField(float* field, size_t cells);
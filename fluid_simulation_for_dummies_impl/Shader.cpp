@@ -1,29 +1,168 @@
 #include "Shader.h"
+#include "UniformBlock.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
-#include <sstream>
-#include <fstream>
 #include <gtc/type_ptr.hpp>
 
 
-GLuint Shader::compileShader(const char* filePath, const GLenum shader_type)
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+static const char programBinaryMagic[4] = { 'F', 'L', 'P', 'B' };
+
+struct ProgramBinaryHeader
+{
+	char magic[4];
+	GLenum format;
+	uint32_t length;
+	uint64_t key;
+};
+
+static void makeDirectory(const string& path)
 {
-	std::string codeString;
-	std::ifstream file;
-	file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-	std::stringstream fileStream;
-	try
+#ifdef _WIN32
+	_mkdir(path.c_str());
+#else
+	mkdir(path.c_str(), 0755);
+#endif
+}
+
+// Reads a whole file with a single fread instead of copying it through stream buffers.
+static bool readFile(const char* filePath, string& contents)
+{
+	FILE* file = fopen(filePath, "rb");
+	if (!file)
 	{
-		file.open(filePath);
-		fileStream << file.rdbuf();
-		codeString = fileStream.str();
+		std::cout << "FILE_OPEN_FAILED::" << filePath << std::endl;
+		return false;
 	}
-	catch (std::ifstream::failure e)
+
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	bool ok = length >= 0;
+	if (ok)
 	{
-		std::cout << "FILE_OPEN_FAILED::" << filePath << std::endl;
+		contents.resize(length);
+		ok = fread(&contents[0], 1, length, file) == (size_t)length;
+	}
+	fclose(file);
+	if (!ok)
+		std::cout << "FILE_READ_FAILED::" << filePath << std::endl;
+	return ok;
+}
+
+static const int maxIncludeDepth = 16;
+
+static bool startsWithDirective(const string& line, const char* directive, size_t& end)
+{
+	size_t begin = line.find_first_not_of(" \t");
+	size_t length = strlen(directive);
+	if (begin == string::npos || line.compare(begin, length, directive) != 0)
+		return false;
+	end = begin + length;
+	return true;
+}
+
+/*
+Expands #include "file" (relative to the including file) and, in the root file, injects the variant
+defines right after #version. Each file is included once. #line directives keep compiler messages
+pointing at the original line, with the source string number being the file's index in includedFiles.
+*/
+static bool preprocessFile(const string& filePath, const vector<string>* defines, vector<string>& includedFiles, string& output, int depth)
+{
+	string source;
+	if (!readFile(filePath.c_str(), source))
+		return false;
+
+	int fileIndex = (int)includedFiles.size();
+	includedFiles.push_back(filePath);
+	string directory = filePath.substr(0, filePath.find_last_of("/\\") + 1);
+
+	bool definesInjected = defines == nullptr || defines->empty();
+	if (!definesInjected && source.find("#version") == string::npos)
+	{
+		for (const string& define : *defines)
+			output += "#define " + define + "\n";
+		output += "#line 1 " + std::to_string(fileIndex) + "\n";
+		definesInjected = true;
 	}
-	const char* code = codeString.c_str();
 
+	int lineNumber = 1;
+	for (size_t begin = 0; begin < source.size(); lineNumber++)
+	{
+		size_t end = source.find('\n', begin);
+		if (end == string::npos)
+			end = source.size();
+		string line = source.substr(begin, end - begin);
+		begin = end + 1;
+
+		size_t directiveEnd;
+		if (startsWithDirective(line, "#include", directiveEnd))
+		{
+			size_t open = line.find('"', directiveEnd);
+			size_t close = open == string::npos ? string::npos : line.find('"', open + 1);
+			if (close == string::npos || depth >= maxIncludeDepth)
+			{
+				std::cout << "SHADER_INCLUDE_FAILED::" << filePath << ":" << lineNumber << std::endl;
+				return false;
+			}
+
+			string includePath = directory + line.substr(open + 1, close - open - 1);
+			if (std::find(includedFiles.begin(), includedFiles.end(), includePath) == includedFiles.end())
+			{
+				output += "#line 1 " + std::to_string(includedFiles.size()) + "\n";
+				if (!preprocessFile(includePath, nullptr, includedFiles, output, depth + 1))
+					return false;
+			}
+			output += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileIndex) + "\n";
+			continue;
+		}
+
+		output += line;
+		output += '\n';
+		if (!definesInjected && startsWithDirective(line, "#version", directiveEnd))
+		{
+			for (const string& define : *defines)
+				output += "#define " + define + "\n";
+			output += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileIndex) + "\n";
+			definesInjected = true;
+		}
+	}
+	return true;
+}
+
+bool Shader::preprocess(const char* filePath, const vector<string>& defines, string& source)
+{
+	vector<string> includedFiles;
+	source.clear();
+	return preprocessFile(filePath, &defines, includedFiles, source, 0);
+}
+
+// The same FNV-1a as Shader::hashName, but in a loop: that one recurses once per character, and whole shader
+// sources would run it out of stack in unoptimized builds.
+static uint64_t hashText(const char* text, uint64_t hash = 14695981039346656037ull)
+{
+	for (; *text; text++)
+		hash = (hash ^ (unsigned char)*text) * 1099511628211ull;
+	return hash;
+}
+
+static uint64_t hashDriverString(GLenum name, uint64_t hash)
+{
+	const GLubyte* value = glGetString(name);
+	return value ? hashText((const char*)value, hash) : hash;
+}
 
+GLuint Shader::compileShader(const string& source, const char* filePath, const GLenum shader_type)
+{
+	const char* code = source.c_str();
 
 	GLuint shaderID = glCreateShader(shader_type);
 	if (!shaderID)
@@ -51,6 +190,100 @@ GLuint Shader::compileShader(const char* filePath, const GLenum shader_type)
 	return shaderID;
 }
 
+string Shader::binaryCacheDirectory = "shader_cache";
+
+void Shader::setBinaryCacheDirectory(const string& directory)
+{
+	binaryCacheDirectory = directory;
+}
+
+static bool programBinarySupported()
+{
+	// Core only from GL 4.1; on the 3.3 context GLEW leaves the entry points null unless the driver has the extension.
+	if (!GLEW_ARB_get_program_binary)
+		return false;
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+static string programBinaryPath(const string& directory, uint64_t key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)key);
+	return directory + name;
+}
+
+/*
+The key covers the sources and the driver identification, so a driver update or an edited source simply
+misses the cache. A driver may still reject a blob it wrote itself; that also falls back to compiling.
+*/
+bool Shader::loadProgramBinary(uint64_t key)
+{
+	if (binaryCacheDirectory.empty() || !programBinarySupported())
+		return false;
+
+	FILE* file = fopen(programBinaryPath(binaryCacheDirectory, key).c_str(), "rb");
+	if (!file)
+		return false;
+
+	ProgramBinaryHeader header;
+	std::vector<char> binary;
+	bool ok = fread(&header, sizeof(header), 1, file) == 1
+		&& memcmp(header.magic, programBinaryMagic, sizeof(programBinaryMagic)) == 0
+		&& header.key == key;
+	if (ok)
+	{
+		binary.resize(header.length);
+		ok = fread(binary.data(), 1, header.length, file) == header.length;
+	}
+	fclose(file);
+	if (!ok)
+		return false;
+
+	id = glCreateProgram();
+	glProgramBinary(id, header.format, binary.data(), (GLsizei)binary.size());
+
+	GLint isLinked = 0;
+	glGetProgramiv(id, GL_LINK_STATUS, &isLinked);
+	if (!isLinked)
+	{
+		glDeleteProgram(id);
+		id = 0;
+		return false;
+	}
+	return true;
+}
+
+void Shader::saveProgramBinary(uint64_t key) const
+{
+	if (binaryCacheDirectory.empty() || !programBinarySupported())
+		return;
+
+	GLint length = 0;
+	glGetProgramiv(id, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	ProgramBinaryHeader header;
+	memcpy(header.magic, programBinaryMagic, sizeof(programBinaryMagic));
+	header.key = key;
+	std::vector<char> binary(length);
+	GLsizei written = 0;
+	glGetProgramBinary(id, length, &written, &header.format, binary.data());
+	header.length = written;
+
+	makeDirectory(binaryCacheDirectory);
+	FILE* file = fopen(programBinaryPath(binaryCacheDirectory, key).c_str(), "wb");
+	if (!file)
+		return;
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(binary.data(), 1, written, file);
+	fclose(file);
+}
+
+GLuint Shader::boundProgram = 0;
+
 Shader::Shader()
 	:id(0)
 {
@@ -58,25 +291,55 @@ Shader::Shader()
 
 Shader::~Shader()
 {
+	if (boundProgram == id)
+		boundProgram = 0;
 	glDeleteProgram(id);
 }
 
 void Shader::use()
 {
-	glUseProgram(id);
+	bind();
 }
 
 void Shader::unuse()
 {
-	glUseProgram(0);
+	if (boundProgram != 0)
+		glUseProgram(0);
+	boundProgram = 0;
 }
 
-void Shader::compile(const char* vertexShaderFile, const char* fragmentShaderFile, const char* geometryShaderFile)
+void Shader::bind() const
 {
-	GLuint vertShader = compileShader(vertexShaderFile, GL_VERTEX_SHADER);
-	GLuint fragShader = compileShader(fragmentShaderFile, GL_FRAGMENT_SHADER);
+	if (boundProgram == id)
+		return;
+	glUseProgram(id);
+	boundProgram = id;
+}
+
+void Shader::compile(const char* vertexShaderFile, const char* fragmentShaderFile, const char* geometryShaderFile, const vector<string>& defines)
+{
+	string vertexSource, fragmentSource, geometrySource;
+	preprocess(vertexShaderFile, defines, vertexSource);
+	preprocess(fragmentShaderFile, defines, fragmentSource);
+	if (geometryShaderFile != nullptr) preprocess(geometryShaderFile, defines, geometrySource);
+
+	uint64_t key = hashText(vertexSource.c_str());
+	key = hashText(fragmentSource.c_str(), hashText("\n//fragment\n", key));
+	key = hashText(geometrySource.c_str(), hashText("\n//geometry\n", key));
+	key = hashDriverString(GL_VENDOR, key);
+	key = hashDriverString(GL_RENDERER, key);
+	key = hashDriverString(GL_VERSION, key);
+
+	if (loadProgramBinary(key))
+	{
+		buildUniformTable();
+		return;
+	}
+
+	GLuint vertShader = compileShader(vertexSource, vertexShaderFile, GL_VERTEX_SHADER);
+	GLuint fragShader = compileShader(fragmentSource, fragmentShaderFile, GL_FRAGMENT_SHADER);
 	GLuint geomShader = 0;
-	if (geometryShaderFile != nullptr) geomShader = compileShader(geometryShaderFile, GL_GEOMETRY_SHADER);
+	if (geometryShaderFile != nullptr) geomShader = compileShader(geometrySource, geometryShaderFile, GL_GEOMETRY_SHADER);
 
 	id = glCreateProgram();
 	if (!id)
@@ -85,6 +348,8 @@ void Shader::compile(const char* vertexShaderFile, const char* fragmentShaderFil
 	glAttachShader(id, fragShader);
 	if (geomShader) glAttachShader(id, geomShader);
 
+	if (!binaryCacheDirectory.empty() && programBinarySupported())
+		glProgramParameteri(id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(id);
 
 	GLint isLinked = 0;
@@ -102,15 +367,98 @@ void Shader::compile(const char* vertexShaderFile, const char* fragmentShaderFil
 		std::cout << "Shader program failed to compile!" << std::endl;
 
 		glDeleteProgram(id);
+		id = 0;
 	}
 	glDeleteShader(vertShader);
 	glDeleteShader(fragShader);
 	if (geomShader) glDeleteShader(geomShader);
+
+	if (id)
+		saveProgramBinary(key);
+	buildUniformTable();
+}
+
+/*
+Every active uniform is looked up once after linking. Arrays of basic types are reported once as "name[0]",
+so each element is registered separately, plus the bare name which GL treats as element 0. Uniforms inside
+blocks have no location and are skipped.
+*/
+void Shader::buildUniformTable()
+{
+	uniformLocations.clear();
+	uniformValues.clear();
+	if (!id)
+		return;
+
+	GLint count = 0, maxNameLength = 0;
+	glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+	std::vector<char> nameBuffer(maxNameLength + 1);
+	int maxLocation = -1;
+	for (GLint i = 0; i < count; i++)
+	{
+		GLsizei length = 0;
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveUniform(id, i, (GLsizei)nameBuffer.size(), &length, &size, &type, nameBuffer.data());
+
+		string name(nameBuffer.data(), length);
+		if (size > 1 && name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+			name.resize(name.size() - 3);
+
+		for (GLint element = 0; element < size; element++)
+		{
+			string elementName = size > 1 ? name + "[" + std::to_string(element) + "]" : name;
+			int location = glGetUniformLocation(id, elementName.c_str());
+			if (location < 0)
+				continue;
+			uniformLocations[hashName(elementName.c_str())] = location;
+			if (size > 1 && element == 0)
+				uniformLocations[hashName(name.c_str())] = location;
+			maxLocation = location > maxLocation ? location : maxLocation;
+		}
+	}
+	uniformValues.assign(maxLocation + 1, UniformValue{ false, 0, {} });
+}
+
+bool Shader::changed(int location, const void* data, unsigned int size) const
+{
+	if (location < 0)
+		return false;
+	if (location >= (int)uniformValues.size())
+		return true;
+
+	UniformValue& cached = uniformValues[location];
+	if (cached.valid && cached.size == size && memcmp(cached.data, data, size) == 0)
+		return false;
+	cached.valid = true;
+	cached.size = (unsigned char)size;
+	memcpy(cached.data, data, size);
+	return true;
+}
+
+uint64_t Shader::hashIndex(uint64_t hash, unsigned int idx)
+{
+	char digits[16];
+	snprintf(digits, sizeof(digits), "[%u]", idx);
+	return hashName(digits, hash);
+}
+
+uint64_t Shader::hashMember(uint64_t hash, const string& memberName)
+{
+	return hashName(memberName.c_str(), hashName(".", hash));
 }
 
 int Shader::getUniformLocation(const string& name) const
 {
-	return glGetUniformLocation(id, name.c_str());
+	return getUniformLocationByHash(hashName(name.c_str()));
+}
+
+int Shader::getUniformLocationByHash(uint64_t nameHash) const
+{
+	auto found = uniformLocations.find(nameHash);
+	return found == uniformLocations.end() ? -1 : found->second;
 }
 
 GLuint Shader::getUniformBlockIndex(const string& name) const
@@ -128,412 +476,405 @@ void Shader::uniformBlockBinding(GLuint uniformBlockIndex, int bindingPoint)
 	glUniformBlockBinding(id, uniformBlockIndex, bindingPoint);
 }
 
+void Shader::bindUniformBlock(const string& blockName, const UniformBlock& block, int bindingPoint)
+{
+	GLuint blockIndex = getUniformBlockIndex(blockName);
+	if (blockIndex == GL_INVALID_INDEX)
+		return;
+	uniformBlockBinding(blockIndex, bindingPoint);
+	block.bind(bindingPoint);
+}
+
 void Shader::setBool(const string& name, bool value) const
 {
-	glUseProgram(id);
-	glUniform1i(glGetUniformLocation(id, name.c_str()), (int)value);
+	setInt(getUniformLocation(name), (int)value);
 }
 
 void Shader::setBool(int location, bool value) const
 {
-	glUseProgram(id);
-	glUniform1i(location, (int)value);
+	setInt(location, (int)value);
 }
 
 void Shader::setInt(const string& name, int value) const
 {
-	glUseProgram(id);
-	glUniform1i(glGetUniformLocation(id, name.c_str()), value);
+	setInt(getUniformLocation(name), value);
 }
 
 void Shader::setInt(const string& listName, const string& memberName, const int& value) const
 {
-	glUseProgram(id);
-	glUniform1i(glGetUniformLocation(id, (listName + "." + memberName).c_str()), value);
+	setInt(getUniformLocationByHash(hashMember(hashName(listName.c_str()), memberName)), value);
 }
 
 void Shader::setInt(const string& listName, const string& memberName, int value, const unsigned int& idx) const
 {
-	glUseProgram(id);
-	glUniform1i(getUniformBlockIndex(listName, memberName, idx), value);
+	setInt(getUniformLocationByHash(hashMember(hashIndex(hashName(listName.c_str()), idx), memberName)), value);
 }
 
 void Shader::setInt(int location, int value) const
 {
-	glUseProgram(id);
-	glUniform1i(location, value);
+	bind();
+	if (changed(location, &value, sizeof(value)))
+		glUniform1i(location, value);
 }
 
 void Shader::setInt_vector(const string& name, const vector<int> vec) const
 {
-	glUseProgram(id);
+	uint64_t nameHash = hashName(name.c_str());
 	for (size_t i = 0; i < vec.size(); i++)
-		setInt(getUniformLocation(name + "[" + std::to_string(i) + "]"), vec[i]);
+		setInt(getUniformLocationByHash(hashIndex(nameHash, (unsigned int)i)), vec[i]);
 }
 
 void Shader::setInt_vector(const string& name, const int& value, const unsigned int& size) const
 {
-	glUseProgram(id);
-	for (size_t i = 0; i < size; i++)
-		setInt(getUniformLocation(name + "[" + std::to_string(i) + "]"), value);
+	uint64_t nameHash = hashName(name.c_str());
+	for (unsigned int i = 0; i < size; i++)
+		setInt(getUniformLocationByHash(hashIndex(nameHash, i)), value);
 }
 
 void Shader::setInt_vector(const string& listName, const string& memberName, const vector<int>& vec) const
 {
-	glUseProgram(id);
+	uint64_t listHash = hashName(listName.c_str());
 	for (size_t i = 0; i < vec.size(); i++)
-		setInt(getUniformLocation(listName + "[" + std::to_string(i) + "]." + memberName), vec[i]);
+		setInt(getUniformLocationByHash(hashMember(hashIndex(listHash, (unsigned int)i), memberName)), vec[i]);
 }
 
 void Shader::setInt_vector(const string& listName, const string& memberName, const int& value, const unsigned int& size) const
 {
-	glUseProgram(id);
-	for (size_t i = 0; i < size; i++)
-		setInt(getUniformLocation(listName + "[" + std::to_string(i) + "]." + memberName), value);
+	uint64_t listHash = hashName(listName.c_str());
+	for (unsigned int i = 0; i < size; i++)
+		setInt(getUniformLocationByHash(hashMember(hashIndex(listHash, i), memberName)), value);
 }
 
 void Shader::setFloat(const string& name, float value) const
 {
-	glUseProgram(id);
-	glUniform1f(glGetUniformLocation(id, name.c_str()), value);
+	setFloat(getUniformLocation(name), value);
 }
 
 void Shader::setFloat(const string& listName, const string& memberName, const float& value) const
 {
-	glUseProgram(id);
-	glUniform1f(glGetUniformLocation(id, (listName + "." + memberName).c_str()), value);
+	setFloat(getUniformLocationByHash(hashMember(hashName(listName.c_str()), memberName)), value);
 }
 
 void Shader::setFloat(const string& listName, const string& memberName, float value, const unsigned int& idx) const
 {
-	glUseProgram(id);
-	glUniform1f(getUniformBlockIndex(listName, memberName, idx), value);
+	setFloat(getUniformLocationByHash(hashMember(hashIndex(hashName(listName.c_str()), idx), memberName)), value);
 }
 
 void Shader::setFloat(int location, float value) const
 {
-	glUseProgram(id);
-	glUniform1f(location, value);
+	bind();
+	if (changed(location, &value, sizeof(value)))
+		glUniform1f(location, value);
 }
 
 void Shader::setFloat_vector(const string& name, const vector<float>& vec) const
 {
-	glUseProgram(id);
+	uint64_t nameHash = hashName(name.c_str());
 	for (size_t i = 0; i < vec.size(); i++)
-		setFloat(getUniformLocation(name + "[" + std::to_string(i) + "]"), vec[i]);
+		setFloat(getUniformLocationByHash(hashIndex(nameHash, (unsigned int)i)), vec[i]);
 }
 
 void Shader::setFloat_vector(const string& name, const float& value, const unsigned int& size) const
 {
-	glUseProgram(id);
-	for (size_t i = 0; i < size; i++)
-		setFloat(getUniformLocation(name + "[" + std::to_string(i) + "]"), value);
+	uint64_t nameHash = hashName(name.c_str());
+	for (unsigned int i = 0; i < size; i++)
+		setFloat(getUniformLocationByHash(hashIndex(nameHash, i)), value);
 }
 
 void Shader::setFloat_vector(const string& listName, const string& memberName, const vector<float>& vec) const
 {
-	glUseProgram(id);
+	uint64_t listHash = hashName(listName.c_str());
 	for (size_t i = 0; i < vec.size(); i++)
-		setFloat(getUniformLocation(listName + "[" + std::to_string(i) + "]." + memberName), vec[i]);
+		setFloat(getUniformLocationByHash(hashMember(hashIndex(listHash, (unsigned int)i), memberName)), vec[i]);
 }
 
 void Shader::setFloat_vector(const string& listName, const string& memberName, const float& value, const unsigned int& size) const
 {
-	glUseProgram(id);
-	for (size_t i = 0; i < size; i++)
-		setFloat(getUniformLocation(listName + "[" + std::to_string(i) + "]." + memberName), value);
+	uint64_t listHash = hashName(listName.c_str());
+	for (unsigned int i = 0; i < size; i++)
+		setFloat(getUniformLocationByHash(hashMember(hashIndex(listHash, i), memberName)), value);
 }
 
 void Shader::set2fv(const string& name, const glm::vec2& vec) const
 {
-	glUseProgram(id);
-	glUniform2fv(glGetUniformLocation(id, name.c_str()), 1, glm::value_ptr(vec));
+	set2fv(getUniformLocation(name), vec);
 }
 
 void Shader::set2fv(const string& listName, const string& memberName, const glm::vec2& vec) const
 {
-	glUseProgram(id);
-	glUniform2fv(glGetUniformLocation(id, (listName + "." + memberName).c_str()), 1, glm::value_ptr(vec));
+	set2fv(getUniformLocationByHash(hashMember(hashName(listName.c_str()), memberName)), vec);
 }
 
 void Shader::set2fv(const string& listName, const string& memberName, const glm::vec2& vec, const unsigned int& idx) const
 {
-	glUseProgram(id);
-	glUniform2fv(getUniformBlockIndex(listName, memberName, idx), 1, glm::value_ptr(vec));
+	set2fv(getUniformLocationByHash(hashMember(hashIndex(hashName(listName.c_str()), idx), memberName)), vec);
 }
 
 void Shader::set2fv(int location, const glm::vec2& vec) const
 {
-	glUseProgram(id);
-	glUniform2fv(location, 1, glm::value_ptr(vec));
+	bind();
+	if (changed(location, glm::value_ptr(vec), sizeof(vec)))
+		glUniform2fv(location, 1, glm::value_ptr(vec));
 }
 
 void Shader::set2f(const string& name, float v1, float v2) const
 {
-	glUseProgram(id);
-	glUniform2f(glGetUniformLocation(id, name.c_str()), v1, v2);
+	set2fv(getUniformLocation(name), glm::vec2(v1, v2));
 }
 
 void Shader::set2f(int location, float v1, float v2) const
 {
-	glUseProgram(id);
-	glUniform2f(location, v1, v2);
+	set2fv(location, glm::vec2(v1, v2));
 }
 
 void Shader::set2fv_vector(const string& name, const vector<glm::vec2>& vec) const
 {
-	glUseProgram(id);
+	uint64_t nameHash = hashName(name.c_str());
 	for (size_t i = 0; i < vec.size(); i++)
-		set2fv(getUniformLocation(name + "[" + std::to_string(i) + "]"), vec[i]);
+		set2fv(getUniformLocationByHash(hashIndex(nameHash, (unsigned int)i)), vec[i]);
 }
 
 void Shader::set2fv_vector(const string& name, const glm::vec2& vec, const unsigned int& size) const
 {
-	glUseProgram(id);
-	for (size_t i = 0; i < size; i++)
-		set2fv(getUniformLocation(name + "[" + std::to_string(i) + "]"), vec);
+	uint64_t nameHash = hashName(name.c_str());
+	for (unsigned int i = 0; i < size; i++)
+		set2fv(getUniformLocationByHash(hashIndex(nameHash, i)), vec);
 }
 
 void Shader::set2fv_vector(const string& listName, const string& memberName, const vector<glm::vec2>& vec) const
 {
-	glUseProgram(id);
+	uint64_t listHash = hashName(listName.c_str());
 	for (size_t i = 0; i < vec.size(); i++)
-		set2fv(getUniformLocation(listName + "[" + std::to_string(i) + "]." + memberName), vec[i]);
+		set2fv(getUniformLocationByHash(hashMember(hashIndex(listHash, (unsigned int)i), memberName)), vec[i]);
 }
 
 void Shader::set2fv_vector(const string& listName, const string& memberName, const glm::vec2& vec, const unsigned int& size) const
 {
-	glUseProgram(id);
-	for (size_t i = 0; i < size; i++)
-		set2fv(getUniformLocation(listName + "[" + std::to_string(i) + "]." + memberName), vec);
+	uint64_t listHash = hashName(listName.c_str());
+	for (unsigned int i = 0; i < size; i++)
+		set2fv(getUniformLocationByHash(hashMember(hashIndex(listHash, i), memberName)), vec);
 }
 
 void Shader::set3fv(const string& name, const glm::vec3& vec) const
 {
-	glUseProgram(id);
-	glUniform3fv(glGetUniformLocation(id, name.c_str()), 1, glm::value_ptr(vec));
+	set3fv(getUniformLocation(name), vec);
 }
 
 void Shader::set3fv(const string& listName, const string& memberName, const glm::vec3& vec) const
 {
-	glUseProgram(id);
-	glUniform3fv(glGetUniformLocation(id, (listName + "." + memberName).c_str()), 1, glm::value_ptr(vec));
+	set3fv(getUniformLocationByHash(hashMember(hashName(listName.c_str()), memberName)), vec);
 }
 
 void Shader::set3fv(const string& listName, const string& memberName, const glm::vec3& vec, const unsigned int& idx) const
 {
-	glUseProgram(id);
-	glUniform3fv(getUniformBlockIndex(listName, memberName, idx), 1, glm::value_ptr(vec));
+	set3fv(getUniformLocationByHash(hashMember(hashIndex(hashName(listName.c_str()), idx), memberName)), vec);
 }
 
 void Shader::set3fv(int location, const glm::vec3& vec) const
 {
-	glUseProgram(id);
-	glUniform3fv(location, 1, glm::value_ptr(vec));
+	bind();
+	if (changed(location, glm::value_ptr(vec), sizeof(vec)))
+		glUniform3fv(location, 1, glm::value_ptr(vec));
 }
 
 void Shader::set3f(const string& name, float v1, float v2, float v3) const
 {
-	glUseProgram(id);
-	glUniform3f(glGetUniformLocation(id, name.c_str()), v1, v2, v3);
+	set3fv(getUniformLocation(name), glm::vec3(v1, v2, v3));
 }
 
 void Shader::set3f(int location, float v1, float v2, float v3) const
 {
-	glUseProgram(id);
-	glUniform3f(location, v1, v2, v3);
+	set3fv(location, glm::vec3(v1, v2, v3));
 }
 
 void Shader::set3fv_vector(const string& name, const vector<glm::vec3>& vec) const
 {
-	glUseProgram(id);
+	uint64_t nameHash = hashName(name.c_str());
 	for (size_t i = 0; i < vec.size(); i++)
-		set3fv(getUniformLocation(name + "[" + std::to_string(i) + "]"), vec[i]);
+		set3fv(getUniformLocationByHash(hashIndex(nameHash, (unsigned int)i)), vec[i]);
 }
 
 void Shader::set3fv_vector(const string& name, const glm::vec3& vec, const unsigned int& size) const
 {
-	glUseProgram(id);
-	for (size_t i = 0; i < size; i++)
-		set3fv(getUniformLocation(name + "[" + std::to_string(i) + "]"), vec);
+	uint64_t nameHash = hashName(name.c_str());
+	for (unsigned int i = 0; i < size; i++)
+		set3fv(getUniformLocationByHash(hashIndex(nameHash, i)), vec);
 }
 
 void Shader::set3fv_vector(const string& listName, const string& memberName, const vector<glm::vec3>& vec) const
 {
-	glUseProgram(id);
+	uint64_t listHash = hashName(listName.c_str());
 	for (size_t i = 0; i < vec.size(); i++)
-		set3fv(getUniformLocation(listName + "[" + std::to_string(i) + "]." + memberName), vec[i]);
+		set3fv(getUniformLocationByHash(hashMember(hashIndex(listHash, (unsigned int)i), memberName)), vec[i]);
 }
 
 void Shader::set3fv_vector(const string& listName, const string& memberName, const glm::vec3& vec, const unsigned int& size) const
 {
-	glUseProgram(id);
-	for (size_t i = 0; i < size; i++)
-		set3fv(getUniformLocation(listName + "[" + std::to_string(i) + "]." + memberName), vec);
-}
-
-void Shader::set4f(const string& name, float v1, float v2, float v3, float v4) const
-{
-	glUseProgram(id);
-	glUniform4f(glGetUniformLocation(id, name.c_str()), v1, v2, v3, v4);
+	uint64_t listHash = hashName(listName.c_str());
+	for (unsigned int i = 0; i < size; i++)
+		set3fv(getUniformLocationByHash(hashMember(hashIndex(listHash, i), memberName)), vec);
 }
 
 void Shader::set4fv(const string& name, const glm::vec4& vec) const
 {
-	glUseProgram(id);
-	glUniform4fv(glGetUniformLocation(id, name.c_str()), 1, glm::value_ptr(vec));
+	set4fv(getUniformLocation(name), vec);
 }
 
 void Shader::set4fv(const string& listName, const string& memberName, const glm::vec4& vec) const
 {
-	glUseProgram(id);
-	glUniform4fv(glGetUniformLocation(id, (listName + "." + memberName).c_str()), 1, glm::value_ptr(vec));
+	set4fv(getUniformLocationByHash(hashMember(hashName(listName.c_str()), memberName)), vec);
 }
 
 void Shader::set4fv(const string& listName, const string& memberName, const glm::vec4& vec, const unsigned int& idx) const
 {
-	glUseProgram(id);
-	glUniform4fv(getUniformBlockIndex(listName, memberName, idx), 1, glm::value_ptr(vec));
+	set4fv(getUniformLocationByHash(hashMember(hashIndex(hashName(listName.c_str()), idx), memberName)), vec);
 }
 
 void Shader::set4fv(int location, const glm::vec4& vec) const
 {
-	glUseProgram(id);
-	glUniform4fv(location, 1, glm::value_ptr(vec));
+	bind();
+	if (changed(location, glm::value_ptr(vec), sizeof(vec)))
+		glUniform4fv(location, 1, glm::value_ptr(vec));
+}
+
+void Shader::set4f(const string& name, float v1, float v2, float v3, float v4) const
+{
+	set4fv(getUniformLocation(name), glm::vec4(v1, v2, v3, v4));
 }
 
 void Shader::set4f(int location, float v1, float v2, float v3, float v4) const
 {
-	glUseProgram(id);
-	glUniform4f(location, v1, v2, v3, v4);
+	set4fv(location, glm::vec4(v1, v2, v3, v4));
 }
 
 void Shader::set4fv_vector(const string& name, const vector<glm::vec4>& vec) const
 {
-	glUseProgram(id);
+	uint64_t nameHash = hashName(name.c_str());
 	for (size_t i = 0; i < vec.size(); i++)
-		set4fv(getUniformLocation(name + "[" + std::to_string(i) + "]"), vec[i]);
+		set4fv(getUniformLocationByHash(hashIndex(nameHash, (unsigned int)i)), vec[i]);
 }
 
 void Shader::set4fv_vector(const string& name, const glm::vec4& vec, const unsigned int& size) const
 {
-	glUseProgram(id);
-	for (size_t i = 0; i < size; i++)
-		set4fv(getUniformLocation(name + "[" + std::to_string(i) + "]"), vec);
+	uint64_t nameHash = hashName(name.c_str());
+	for (unsigned int i = 0; i < size; i++)
+		set4fv(getUniformLocationByHash(hashIndex(nameHash, i)), vec);
 }
 
 void Shader::set4fv_vector(const string& listName, const string& memberName, const vector<glm::vec4>& vec) const
 {
+	uint64_t listHash = hashName(listName.c_str());
 	for (size_t i = 0; i < vec.size(); i++)
-		set4fv(getUniformLocation(listName + "[" + std::to_string(i) + "]." + memberName), vec[i]);
+		set4fv(getUniformLocationByHash(hashMember(hashIndex(listHash, (unsigned int)i), memberName)), vec[i]);
 }
 
 void Shader::set4fv_vector(const string& listName, const string& memberName, const glm::vec4& vec, const unsigned int& size) const
 {
-	for (size_t i = 0; i < size; i++)
-		set4fv(getUniformLocation(listName + "[" + std::to_string(i) + "]." + memberName), vec);
+	uint64_t listHash = hashName(listName.c_str());
+	for (unsigned int i = 0; i < size; i++)
+		set4fv(getUniformLocationByHash(hashMember(hashIndex(listHash, i), memberName)), vec);
 }
 
 void Shader::setMat3fv(const string& name, const glm::mat3& mat, bool transpose) const
 {
-	glUseProgram(id);
-	glUniformMatrix3fv(glGetUniformLocation(id, name.c_str()), 1, transpose, glm::value_ptr(mat));
+	setMat3fv(getUniformLocation(name), mat, transpose);
 }
 
 void Shader::setMat3fv(const string& listName, const string& memberName, const glm::mat3& mat, bool transpose) const
 {
-	glUseProgram(id);
-	glUniformMatrix3fv(glGetUniformLocation(id, (listName + "." + memberName).c_str()), 1, transpose, glm::value_ptr(mat));
+	setMat3fv(getUniformLocationByHash(hashMember(hashName(listName.c_str()), memberName)), mat, transpose);
 }
 
 void Shader::setMat3fv(const string& listName, const string& memberName, const glm::mat3& mat, const unsigned int& idx, bool transpose) const
 {
-	glUseProgram(id);
-	glUniformMatrix3fv(getUniformBlockIndex(listName, memberName, idx), 1, transpose, glm::value_ptr(mat));
+	setMat3fv(getUniformLocationByHash(hashMember(hashIndex(hashName(listName.c_str()), idx), memberName)), mat, transpose);
 }
 
 void Shader::setMat3fv(int location, const glm::mat3& mat, bool transpose) const
 {
-	glUseProgram(id);
-	glUniformMatrix3fv(location, 1, transpose, glm::value_ptr(mat));
+	// Transpose on the CPU so the cached value is exactly what the program sees.
+	glm::mat3 value = transpose ? glm::transpose(mat) : mat;
+	bind();
+	if (changed(location, glm::value_ptr(value), sizeof(value)))
+		glUniformMatrix3fv(location, 1, GL_FALSE, glm::value_ptr(value));
 }
 
 void Shader::setMat3fv_vector(const string& name, const vector<glm::mat3>& vec, bool transpose) const
 {
-	glUseProgram(id);
+	uint64_t nameHash = hashName(name.c_str());
 	for (size_t i = 0; i < vec.size(); i++)
-		setMat3fv(getUniformLocation(name + "[" + std::to_string(i) + "]"), vec[i], transpose);
+		setMat3fv(getUniformLocationByHash(hashIndex(nameHash, (unsigned int)i)), vec[i], transpose);
 }
 
 void Shader::setMat3fv_vector(const string& name, const glm::mat3& mat, const unsigned int& size, bool transpose) const
 {
-	glUseProgram(id);
-	for (size_t i = 0; i < size; i++)
-		setMat3fv(getUniformLocation(name + "[" + std::to_string(i) + "]"), mat, transpose);
+	uint64_t nameHash = hashName(name.c_str());
+	for (unsigned int i = 0; i < size; i++)
+		setMat3fv(getUniformLocationByHash(hashIndex(nameHash, i)), mat, transpose);
 }
 
 void Shader::setMat3fv_vector(const string& listName, const string& memberName, const vector<glm::mat3>& vec, bool transpose) const
 {
-	glUseProgram(id);
+	uint64_t listHash = hashName(listName.c_str());
 	for (size_t i = 0; i < vec.size(); i++)
-		setMat3fv(getUniformLocation(listName + "[" + std::to_string(i) + "]." + memberName), vec[i], transpose);
+		setMat3fv(getUniformLocationByHash(hashMember(hashIndex(listHash, (unsigned int)i), memberName)), vec[i], transpose);
 }
 
 void Shader::setMat3fv_vector(const string& listName, const string& memberName, const glm::mat3& mat, const unsigned int& size, bool transpose) const
 {
-	glUseProgram(id);
-	for (size_t i = 0; i < size; i++)
-		setMat3fv(getUniformLocation(listName + "[" + std::to_string(i) + "]." + memberName), mat, transpose);
+	uint64_t listHash = hashName(listName.c_str());
+	for (unsigned int i = 0; i < size; i++)
+		setMat3fv(getUniformLocationByHash(hashMember(hashIndex(listHash, i), memberName)), mat, transpose);
 }
 
 void Shader::setMat4fv(const string& name, const glm::mat4& mat, bool transpose) const
 {
-	glUseProgram(id);
-	glUniformMatrix4fv(glGetUniformLocation(id, name.c_str()), 1, transpose, glm::value_ptr(mat));
+	setMat4fv(getUniformLocation(name), mat, transpose);
 }
 
 void Shader::setMat4fv(const string& listName, const string& memberName, const glm::mat4& mat, bool transpose) const
 {
-	glUseProgram(id);
-	glUniformMatrix4fv(glGetUniformLocation(id, (listName + "." + memberName).c_str()), 1, transpose, glm::value_ptr(mat));
+	setMat4fv(getUniformLocationByHash(hashMember(hashName(listName.c_str()), memberName)), mat, transpose);
 }
 
 void Shader::setMat4fv(const string& listName, const string& memberName, const glm::mat4& mat, const unsigned int& idx, bool transpose) const
 {
-	glUseProgram(id);
-	glUniformMatrix4fv(getUniformBlockIndex(listName, memberName, idx), 1, transpose, glm::value_ptr(mat));
+	setMat4fv(getUniformLocationByHash(hashMember(hashIndex(hashName(listName.c_str()), idx), memberName)), mat, transpose);
 }
 
 void Shader::setMat4fv(int location, const glm::mat4& mat, bool transpose) const
 {
-	glUseProgram(id);
-	glUniformMatrix4fv(location, 1, transpose, glm::value_ptr(mat));
+	// Transpose on the CPU so the cached value is exactly what the program sees.
+	glm::mat4 value = transpose ? glm::transpose(mat) : mat;
+	bind();
+	if (changed(location, glm::value_ptr(value), sizeof(value)))
+		glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
 }
 
 void Shader::setMat4fv_vector(const string& name, const vector<glm::mat4>& vec, bool transpose) const
 {
-	glUseProgram(id);
+	uint64_t nameHash = hashName(name.c_str());
 	for (size_t i = 0; i < vec.size(); i++)
-		setMat4fv(getUniformLocation(name + "[" + std::to_string(i) + "]"), vec[i], transpose);
+		setMat4fv(getUniformLocationByHash(hashIndex(nameHash, (unsigned int)i)), vec[i], transpose);
 }
 
 void Shader::setMat4fv_vector(const string& name, const glm::mat4& mat, const unsigned int& size, bool transpose) const
 {
-	glUseProgram(id);
-	for (size_t i = 0; i < size; i++)
-		setMat4fv(getUniformLocation(name + "[" + std::to_string(i) + "]"), mat, transpose);
+	uint64_t nameHash = hashName(name.c_str());
+	for (unsigned int i = 0; i < size; i++)
+		setMat4fv(getUniformLocationByHash(hashIndex(nameHash, i)), mat, transpose);
 }
 
 void Shader::setMat4fv_vector(const string& listName, const string& memberName, const vector<glm::mat4>& vec, bool transpose) const
 {
-	glUseProgram(id);
+	uint64_t listHash = hashName(listName.c_str());
 	for (size_t i = 0; i < vec.size(); i++)
-		setMat4fv(getUniformLocation(listName + "[" + std::to_string(i) + "]." + memberName), vec[i], transpose);
+		setMat4fv(getUniformLocationByHash(hashMember(hashIndex(listHash, (unsigned int)i), memberName)), vec[i], transpose);
 }
 
 void Shader::setMat4fv_vector(const string& listName, const string& memberName, const glm::mat4& mat, const unsigned int& size, bool transpose) const
 {
-	glUseProgram(id);
-	for (size_t i = 0; i < size; i++)
-		setMat4fv(getUniformLocation(listName + "[" + std::to_string(i) + "]." + memberName), mat, transpose);
+	uint64_t listHash = hashName(listName.c_str());
+	for (unsigned int i = 0; i < size; i++)
+		setMat4fv(getUniformLocationByHash(hashMember(hashIndex(listHash, i), memberName)), mat, transpose);
 }
\ No newline at end of file
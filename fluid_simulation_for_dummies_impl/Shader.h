@@ -1,6 +1,8 @@
 #pragma once
 #include <glew.h>
+#include <cstdint>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <glm.hpp>
 
@@ -10,24 +12,63 @@ using std::vector;
 typedef unsigned int GLenum;
 typedef unsigned int GLuint;
 
+class UniformBlock;
+
 class Shader
 {
 private:
-	GLuint compileShader(const char* fileName, const GLenum shader_type);
+	// Last value uploaded to a uniform location, so setting the same value again costs no GL call.
+	struct UniformValue
+	{
+		bool valid;
+		unsigned char size;
+		unsigned char data[64];
+	};
+
+	GLuint compileShader(const string& source, const char* fileName, const GLenum shader_type);
+	bool loadProgramBinary(uint64_t key);
+	void saveProgramBinary(uint64_t key) const;
+	void buildUniformTable();
+	void bind() const;
+	bool changed(int location, const void* data, unsigned int size) const;
+	static uint64_t hashMember(uint64_t hash, const string& memberName);
+
 	GLuint id;
+	std::unordered_map<uint64_t, int> uniformLocations;
+	mutable std::vector<UniformValue> uniformValues;
+
+	// Program currently bound through any Shader; code that calls glUseProgram directly must go through use()/unuse() instead.
+	static GLuint boundProgram;
+	// Linked program binaries are cached here, keyed by a hash of the sources and the driver; empty disables the cache.
+	static string binaryCacheDirectory;
 public:
 	Shader();
 	~Shader();
 	void use();
 	void unuse();
 
-	void compile(const char* vertexShaderFile, const char* fragmentShaderFile, const char* geometryShaderFile = nullptr);
+	// Each define is "NAME" or "NAME value" and is injected after #version in every stage.
+	void compile(const char* vertexShaderFile, const char* fragmentShaderFile, const char* geometryShaderFile = nullptr, const vector<string>& defines = {});
+	static bool preprocess(const char* filePath, const vector<string>& defines, string& source);
+	static void setBinaryCacheDirectory(const string& directory);
+
+	// FNV-1a over the uniform name; usable at compile time to precompute lookups for hot uniforms. It recurses once
+	// per character, so keep it to names.
+	static constexpr uint64_t hashName(const char* name, uint64_t hash = 14695981039346656037ull)
+	{
+		return *name ? hashName(name + 1, (hash ^ (unsigned char)*name) * 1099511628211ull) : hash;
+	}
+	static uint64_t hashIndex(uint64_t hash, unsigned int idx);
 
 	int getUniformLocation(const string& name) const;
+	int getUniformLocationByHash(uint64_t nameHash) const;
 	GLuint getUniformBlockIndex(const string& name) const;
 	GLuint getUniformBlockIndex(const string& listName, const string& memberName, const unsigned int& idx) const;
 	void uniformBlockBinding(GLuint uniformBlockIndex, int bindingPoint);
+	void bindUniformBlock(const string& blockName, const UniformBlock& block, int bindingPoint);
 
+	// Every setter makes this program current, as glUseProgram did before values were cached, even when the value
+	// is unchanged and no upload is needed.
 	void setBool(const string& name, bool value) const;
 	void setBool(int location, bool value) const;
 
@@ -0,0 +1,25 @@
+#include "ShaderVariants.h"
+#include <algorithm>
+
+ShaderVariants::ShaderVariants(const char* vertexShaderFile, const char* fragmentShaderFile, const char* geometryShaderFile)
+	:vertexShaderFile(vertexShaderFile), fragmentShaderFile(fragmentShaderFile), geometryShaderFile(geometryShaderFile ? geometryShaderFile : "")
+{
+}
+
+Shader& ShaderVariants::get(const vector<string>& defines)
+{
+	vector<string> sorted = defines;
+	std::sort(sorted.begin(), sorted.end());
+	string key;
+	for (const string& define : sorted)
+		key += define + '\n';
+
+	std::unique_ptr<Shader>& variant = variants[key];
+	if (!variant)
+	{
+		variant.reset(new Shader());
+		variant->compile(vertexShaderFile.c_str(), fragmentShaderFile.c_str(),
+			geometryShaderFile.empty() ? nullptr : geometryShaderFile.c_str(), sorted);
+	}
+	return *variant;
+}
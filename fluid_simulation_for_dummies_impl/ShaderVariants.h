@@ -0,0 +1,32 @@
+#pragma once
+#include "Shader.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+/*
+One set of shader files compiled into a separate program per define set, so each render path gets a
+specialized shader instead of branching on uniforms:
+
+	ShaderVariants field("shaders/fullscreen.vert", "shaders/field.frag");
+	Shader& density = field.get({ "COLORMAP_INFERNO" });
+	Shader& speed = field.get({ "VELOCITY_MAGNITUDE" });
+
+Variants compile on first use; the order of the defines does not matter.
+*/
+class ShaderVariants
+{
+private:
+	string vertexShaderFile;
+	string fragmentShaderFile;
+	string geometryShaderFile;
+	std::unordered_map<string, std::unique_ptr<Shader>> variants;
+public:
+	ShaderVariants(const char* vertexShaderFile, const char* fragmentShaderFile, const char* geometryShaderFile = nullptr);
+
+	Shader& get(const vector<string>& defines = {});
+};
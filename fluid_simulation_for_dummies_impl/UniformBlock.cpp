@@ -0,0 +1,207 @@
+#include "UniformBlock.h"
+#include <cstring>
+#include <utility>
+#include <gtc/type_ptr.hpp>
+
+static const unsigned int std140ArrayStride = 16;
+
+Std140Layout::Std140Layout()
+	:offset(0)
+{
+}
+
+unsigned int Std140Layout::align(unsigned int alignment, unsigned int size)
+{
+	unsigned int member = (offset + alignment - 1) / alignment * alignment;
+	offset = member + size;
+	return member;
+}
+
+unsigned int Std140Layout::addInt()
+{
+	return align(4, 4);
+}
+
+unsigned int Std140Layout::addFloat()
+{
+	return align(4, 4);
+}
+
+unsigned int Std140Layout::addVec2()
+{
+	return align(8, 8);
+}
+
+unsigned int Std140Layout::addVec3()
+{
+	return align(16, 12);
+}
+
+unsigned int Std140Layout::addVec4()
+{
+	return align(16, 16);
+}
+
+unsigned int Std140Layout::addMat3()
+{
+	return addArray(3);
+}
+
+unsigned int Std140Layout::addMat4()
+{
+	return addArray(4);
+}
+
+unsigned int Std140Layout::addArray(unsigned int count, unsigned int columnsPerElement)
+{
+	return align(16, count * columnsPerElement * std140ArrayStride);
+}
+
+unsigned int Std140Layout::size() const
+{
+	return (offset + 15) / 16 * 16;
+}
+
+UniformBlock::UniformBlock()
+	:id(0), dirtyBegin(0), dirtyEnd(0)
+{
+}
+
+UniformBlock::~UniformBlock()
+{
+	glDeleteBuffers(1, &id);
+}
+
+UniformBlock::UniformBlock(UniformBlock&& other) noexcept
+	:id(other.id), data(std::move(other.data)), dirtyBegin(other.dirtyBegin), dirtyEnd(other.dirtyEnd)
+{
+	other.id = 0;
+	other.dirtyBegin = other.dirtyEnd = 0;
+}
+
+UniformBlock& UniformBlock::operator=(UniformBlock&& other) noexcept
+{
+	if (this != &other)
+	{
+		glDeleteBuffers(1, &id);
+		id = other.id;
+		data = std::move(other.data);
+		dirtyBegin = other.dirtyBegin;
+		dirtyEnd = other.dirtyEnd;
+		other.id = 0;
+		other.dirtyBegin = other.dirtyEnd = 0;
+	}
+	return *this;
+}
+
+void UniformBlock::create(unsigned int size)
+{
+	data.assign(size, 0);
+	if (!id)
+		glGenBuffers(1, &id);
+	glBindBuffer(GL_UNIFORM_BUFFER, id);
+	glBufferData(GL_UNIFORM_BUFFER, size, data.data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	dirtyBegin = dirtyEnd = 0;
+}
+
+void UniformBlock::bind(int bindingPoint) const
+{
+	glBindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, id);
+}
+
+void UniformBlock::upload()
+{
+	if (dirtyBegin >= dirtyEnd)
+		return;
+	glBindBuffer(GL_UNIFORM_BUFFER, id);
+	glBufferSubData(GL_UNIFORM_BUFFER, dirtyBegin, dirtyEnd - dirtyBegin, data.data() + dirtyBegin);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	dirtyBegin = dirtyEnd = 0;
+}
+
+void UniformBlock::write(unsigned int offset, const void* value, unsigned int size)
+{
+	if (offset + size > data.size() || memcmp(data.data() + offset, value, size) == 0)
+		return;
+	memcpy(data.data() + offset, value, size);
+
+	if (dirtyBegin >= dirtyEnd)
+	{
+		dirtyBegin = offset;
+		dirtyEnd = offset + size;
+		return;
+	}
+	dirtyBegin = offset < dirtyBegin ? offset : dirtyBegin;
+	dirtyEnd = offset + size > dirtyEnd ? offset + size : dirtyEnd;
+}
+
+void UniformBlock::setInt(unsigned int offset, int value)
+{
+	write(offset, &value, sizeof(value));
+}
+
+void UniformBlock::setFloat(unsigned int offset, float value)
+{
+	write(offset, &value, sizeof(value));
+}
+
+void UniformBlock::set2fv(unsigned int offset, const glm::vec2& vec)
+{
+	write(offset, glm::value_ptr(vec), sizeof(vec));
+}
+
+void UniformBlock::set3fv(unsigned int offset, const glm::vec3& vec)
+{
+	write(offset, glm::value_ptr(vec), sizeof(vec));
+}
+
+void UniformBlock::set4fv(unsigned int offset, const glm::vec4& vec)
+{
+	write(offset, glm::value_ptr(vec), sizeof(vec));
+}
+
+void UniformBlock::setMat3fv(unsigned int offset, const glm::mat3& mat)
+{
+	for (int column = 0; column < 3; column++)
+		write(offset + column * std140ArrayStride, glm::value_ptr(mat[column]), sizeof(glm::vec3));
+}
+
+void UniformBlock::setMat4fv(unsigned int offset, const glm::mat4& mat)
+{
+	write(offset, glm::value_ptr(mat), sizeof(mat));
+}
+
+void UniformBlock::setInt_vector(unsigned int offset, const vector<int>& vec)
+{
+	for (size_t i = 0; i < vec.size(); i++)
+		setInt(offset + (unsigned int)i * std140ArrayStride, vec[i]);
+}
+
+void UniformBlock::setFloat_vector(unsigned int offset, const vector<float>& vec)
+{
+	for (size_t i = 0; i < vec.size(); i++)
+		setFloat(offset + (unsigned int)i * std140ArrayStride, vec[i]);
+}
+
+void UniformBlock::set2fv_vector(unsigned int offset, const vector<glm::vec2>& vec)
+{
+	for (size_t i = 0; i < vec.size(); i++)
+		set2fv(offset + (unsigned int)i * std140ArrayStride, vec[i]);
+}
+
+void UniformBlock::set3fv_vector(unsigned int offset, const vector<glm::vec3>& vec)
+{
+	for (size_t i = 0; i < vec.size(); i++)
+		set3fv(offset + (unsigned int)i * std140ArrayStride, vec[i]);
+}
+
+void UniformBlock::set4fv_vector(unsigned int offset, const vector<glm::vec4>& vec)
+{
+	write(offset, vec.data(), (unsigned int)(vec.size() * sizeof(glm::vec4)));
+}
+
+void UniformBlock::setMat4fv_vector(unsigned int offset, const vector<glm::mat4>& vec)
+{
+	write(offset, vec.data(), (unsigned int)(vec.size() * sizeof(glm::mat4)));
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <glew.h>
+#include <vector>
+#include <glm.hpp>
+
+using std::vector;
+
+/*
+Computes std140 member offsets in declaration order, so a CPU-side block matches the GLSL one:
+
+	layout(std140) uniform Params { float scale; vec3 tint; float weights[256]; };
+
+	Std140Layout layout;
+	unsigned int scale = layout.addFloat();
+	unsigned int tint = layout.addVec3();
+	unsigned int weights = layout.addArray(256);
+*/
+class Std140Layout
+{
+private:
+	unsigned int offset;
+	unsigned int align(unsigned int alignment, unsigned int size);
+public:
+	Std140Layout();
+
+	unsigned int addInt();
+	unsigned int addFloat();
+	unsigned int addVec2();
+	unsigned int addVec3();
+	unsigned int addVec4();
+	unsigned int addMat3();
+	unsigned int addMat4();
+	// Arrays of scalars and vectors use a 16-byte element stride; matrices take 16 bytes per column.
+	unsigned int addArray(unsigned int count, unsigned int columnsPerElement = 1);
+
+	unsigned int size() const;
+};
+
+/*
+CPU mirror of a uniform block. Setters write into the mirror and grow a single dirty byte range;
+upload() sends that range with one glBufferSubData, so a whole array costs one call per frame.
+*/
+class UniformBlock
+{
+private:
+	void write(unsigned int offset, const void* data, unsigned int size);
+
+	GLuint id;
+	vector<unsigned char> data;
+	unsigned int dirtyBegin;
+	unsigned int dirtyEnd;
+public:
+	UniformBlock();
+	~UniformBlock();
+	// The block owns its buffer: copies would delete it twice, moves hand it over.
+	UniformBlock(const UniformBlock&) = delete;
+	UniformBlock& operator=(const UniformBlock&) = delete;
+	UniformBlock(UniformBlock&& other) noexcept;
+	UniformBlock& operator=(UniformBlock&& other) noexcept;
+
+	void create(unsigned int size);
+	void bind(int bindingPoint) const;
+	void upload();
+
+	void setInt(unsigned int offset, int value);
+	void setFloat(unsigned int offset, float value);
+	void set2fv(unsigned int offset, const glm::vec2& vec);
+	void set3fv(unsigned int offset, const glm::vec3& vec);
+	void set4fv(unsigned int offset, const glm::vec4& vec);
+	void setMat3fv(unsigned int offset, const glm::mat3& mat);
+	void setMat4fv(unsigned int offset, const glm::mat4& mat);
+
+	void setInt_vector(unsigned int offset, const vector<int>& vec);
+	void setFloat_vector(unsigned int offset, const vector<float>& vec);
+	void set2fv_vector(unsigned int offset, const vector<glm::vec2>& vec);
+	void set3fv_vector(unsigned int offset, const vector<glm::vec3>& vec);
+	void set4fv_vector(unsigned int offset, const vector<glm::vec4>& vec);
+	void setMat4fv_vector(unsigned int offset, const vector<glm::mat4>& vec);
+};
@@ -0,0 +1,40 @@
+#version 330 core
+#include "colormap.glsl"
+
+// Variants:
+//   VOLUME_SLICE        sample a z slice of a 3D texture instead of a 2D one
+//   VELOCITY_MAGNITUDE  draw the length of the velocity stored in the texture channels instead of the red channel
+//   COLORMAP_INFERNO    see colormap.glsl
+
+in vec2 uv;
+out vec4 color;
+
+uniform float minValue;
+uniform float maxValue;
+
+#ifdef VOLUME_SLICE
+uniform sampler3D field;
+uniform float slice;
+#else
+uniform sampler2D field;
+#endif
+
+float sampleField()
+{
+#ifdef VOLUME_SLICE
+	vec4 texel = texture(field, vec3(uv, slice));
+#else
+	vec4 texel = texture(field, uv);
+#endif
+#ifdef VELOCITY_MAGNITUDE
+	return length(texel.xyz);
+#else
+	return texel.r;
+#endif
+}
+
+void main()
+{
+	float t = clamp((sampleField() - minValue) / (maxValue - minValue), 0.0, 1.0);
+	color = vec4(colormap(t), 1.0);
+}
@@ -0,0 +1,11 @@
+#version 330 core
+
+out vec2 uv;
+
+void main()
+{
+	// A single triangle covering the viewport, generated from gl_VertexID so no vertex buffer is needed.
+	vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	uv = position;
+	gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}